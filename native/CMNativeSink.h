@@ -0,0 +1,205 @@
+//-------------------------------------------------------------------------------
+//
+// Package csvread
+//
+// Column sinks with their own storage for the native programs.
+//
+// Sergei Izrailev, 2011-2014
+//-------------------------------------------------------------------------------
+// Copyright 2011-2014 Collective, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//-------------------------------------------------------------------------------
+
+#ifndef CMNativeSink_INCLUDED
+#define CMNativeSink_INCLUDED
+
+#include <string.h>
+#include <math.h>
+#include <vector>
+
+using namespace std;
+
+#include "CMColumnSink.h"
+#include "CMConverters.h"
+
+namespace cm
+{
+
+//-----------------------------------------------------------------------------
+//
+// CMNativeSink - A column sink that stores the values in a std::vector.
+//
+//-----------------------------------------------------------------------------
+/// Stores up to capacity values of type T. Derived classes implement the conversion and
+/// the NA value, which is stored when the conversion fails.
+template <typename T>
+class CMNativeSink : public CMColumnSink
+{
+protected:
+   vector<T> m_data;
+   int m_capacity;
+
+   /// Converts s to x; returns false if s can't be converted.
+   virtual bool parse(const char* s, T& x) = 0;
+   /// Returns the value stored for empty fields and parse errors.
+   virtual T na() const = 0;
+
+public:
+   explicit CMNativeSink(int capacity) : m_capacity(capacity)
+   {
+      m_data.reserve(capacity);
+   }
+   virtual ~CMNativeSink() {}
+
+   virtual bool append(const char* s)
+   {
+      if ((int) m_data.size() >= m_capacity) return false;
+      T x;
+      bool ok = parse(s, x);
+      m_data.push_back(ok ? x : na());
+      return ok;
+   }
+   virtual int size() const
+   {
+      return m_data.size();
+   }
+   virtual int capacity() const
+   {
+      return m_capacity;
+   }
+   virtual void clear()
+   {
+      m_data.clear();
+   }
+   virtual void resize(int n)
+   {
+      m_data.resize(n > m_capacity ? m_capacity : n, na());
+   }
+   const T& operator[](int i) const
+   {
+      return m_data[i];
+   }
+};
+
+//-----------------------------------------------------------------------------
+
+/// 32-bit integers; NA is the smallest int as in R.
+class CMNativeSinkInt : public CMNativeSink<int>
+{
+protected:
+   virtual bool parse(const char* s, int& x) { return cmParseInt(s, x); }
+   virtual int na() const { return (-2147483647 - 1); }
+public:
+   explicit CMNativeSinkInt(int capacity) : CMNativeSink<int>(capacity) {}
+};
+
+/// Doubles; NA is NaN.
+class CMNativeSinkDbl : public CMNativeSink<double>
+{
+protected:
+   virtual bool parse(const char* s, double& x) { return cmParseDouble(s, x); }
+   virtual double na() const { return NAN; }
+public:
+   explicit CMNativeSinkDbl(int capacity) : CMNativeSink<double>(capacity) {}
+};
+
+/// 64-bit integers in base 10 or 16; NA is NA_LONG.
+class CMNativeSinkLong : public CMNativeSink<CMInt64>
+{
+protected:
+   int m_base;
+   virtual bool parse(const char* s, CMInt64& x) { return cmParseInt64(s, m_base, x); }
+   virtual CMInt64 na() const { return NA_LONG.L; }
+public:
+   CMNativeSinkLong(int capacity, int base) : CMNativeSink<CMInt64>(capacity), m_base(base) {}
+};
+
+//-----------------------------------------------------------------------------
+
+/// Strings, copied into one character pool. As in CMRDataCollectorStr, "NULL" is NA,
+/// which is stored as offset -1.
+class CMNativeSinkStr : public CMColumnSink
+{
+protected:
+   vector<char> m_pool;
+   vector<long> m_offsets;
+   int m_capacity;
+
+public:
+   explicit CMNativeSinkStr(int capacity) : m_capacity(capacity)
+   {
+      m_offsets.reserve(capacity);
+   }
+   virtual ~CMNativeSinkStr() {}
+
+   virtual bool append(const char* s)
+   {
+      if (s == 0 || (int) m_offsets.size() >= m_capacity) return false;
+      if (strcmp(s, "NULL") == 0)
+      {
+         m_offsets.push_back(-1);
+         return true;
+      }
+      m_offsets.push_back(m_pool.size());
+      m_pool.insert(m_pool.end(), s, s + strlen(s) + 1);
+      return true;
+   }
+   virtual int size() const
+   {
+      return m_offsets.size();
+   }
+   virtual int capacity() const
+   {
+      return m_capacity;
+   }
+   virtual void clear()
+   {
+      m_offsets.clear();
+      m_pool.clear();
+   }
+   virtual void resize(int n)
+   {
+      if (n < (int) m_offsets.size()) m_offsets.resize(n);
+   }
+   /// Returns the i-th string or NULL for NA.
+   const char* operator[](int i) const
+   {
+      return m_offsets[i] < 0 ? 0 : &m_pool[m_offsets[i]];
+   }
+   /// Returns the size of the character pool.
+   size_t poolSize() const
+   {
+      return m_pool.size();
+   }
+};
+
+//-----------------------------------------------------------------------------
+
+/// Returns a sink for a csvread column type ("integer", "double", "long", "integer64",
+/// "longhex" or "string") or 0 if the type is not supported.
+inline CMColumnSink* cmNativeSink(const char* type, int capacity)
+{
+   if (strcmp(type, "integer") == 0) return new CMNativeSinkInt(capacity);
+   if (strcmp(type, "double") == 0) return new CMNativeSinkDbl(capacity);
+   if (strcmp(type, "long") == 0 || strcmp(type, "integer64") == 0) return new CMNativeSinkLong(capacity, 10);
+   if (strcmp(type, "longhex") == 0) return new CMNativeSinkLong(capacity, 16);
+   if (strcmp(type, "string") == 0) return new CMNativeSinkStr(capacity);
+   return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+}
+
+#endif // CMNativeSink_INCLUDED
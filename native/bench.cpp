@@ -0,0 +1,163 @@
+//-------------------------------------------------------------------------------
+//
+// Package csvread
+//
+// Benchmark of the CSV loader without R.
+//
+// Usage: bench <file> <types> [header] [delimiter] [repeats]
+//   types     - comma-separated column types as in csvread, e.g. integer,string,double
+//   header    - 1 (default) if the file has a header line, 0 otherwise
+//   delimiter - one or more characters, or '' for runs of blanks, default ','
+//   repeats   - number of times each pass is run; the fastest run is reported (default 3)
+//
+// Sergei Izrailev, 2011-2014
+//-------------------------------------------------------------------------------
+// Copyright 2011-2014 Collective, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//-------------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#include "SfiDelimitedRecordSTD.h"
+#include "CMLineStream.h"
+#include "CMLoader.h"
+#include "CMTimer.h"
+#include "CMNativeSink.h"
+
+using namespace cm;
+
+//-----------------------------------------------------------------------------
+
+// The passes are the same as in benchCSV (src/csvbench.cpp): each one adds a step to the
+// previous one, and the time of a stage is the difference between its pass and the pass it
+// builds on. Unlike benchCSV, the values are stored in sinks that own their memory, so the
+// numbers do not include creating R strings and the program can be run under perf, valgrind
+// or the sanitizers.
+
+enum CMBenchPass { CM_PASS_GETLINE, CM_PASS_SPLIT, CM_PASS_PARSE };
+
+/// Runs one pass over the file and returns the number of records.
+static int cmRunPass(const char* filename, bool hasHeader, const string& delim, CMBenchPass pass,
+                     const vector<CMColumnSink*>& sinks)
+{
+   CMLineStream lstr(filename);
+   SfiDelimitedRecordSTD rec(0, delim);
+   char* s;
+   int n = 0;
+   if (hasHeader) s = lstr.getline();
+   if (pass == CM_PASS_PARSE)
+   {
+      for (size_t i = 0; i < sinks.size(); i++) sinks[i]->clear();
+      return cmParseLines(lstr, rec, sinks);
+   }
+   while ((s = lstr.getline()))
+   {
+      if (pass == CM_PASS_SPLIT) rec.split(s, lstr.len());
+      n++;
+   }
+   return n;
+}
+
+/// Returns the fastest wall-clock time of repeats runs of a pass.
+static double cmTimePass(const char* filename, bool hasHeader, const string& delim, CMBenchPass pass,
+                         const vector<CMColumnSink*>& sinks, int repeats, int& nrows)
+{
+   double best = -1;
+   for (int r = 0; r < repeats; r++)
+   {
+      CMTimer t;
+      t.start();
+      nrows = cmRunPass(filename, hasHeader, delim, pass, sinks);
+      t.stop();
+      if (best < 0 || t.wall() < best) best = t.wall();
+   }
+   return best;
+}
+
+static void cmPrintStage(const char* name, double wall, double bytes, int nrows)
+{
+   printf("%-8s %10.4f %10.1f %14.0f\n", name, wall,
+          wall > 0 ? bytes / 1048576.0 / wall : 0.0, wall > 0 ? nrows / wall : 0.0);
+}
+
+//-----------------------------------------------------------------------------
+
+int main(int argc, char** argv)
+{
+   if (argc < 3)
+   {
+      fprintf(stderr, "Usage: %s <file> <types> [header] [delimiter] [repeats]\n", argv[0]);
+      return 2;
+   }
+   const char* filename = argv[1];
+   bool hasHeader = argc > 3 ? atoi(argv[3]) != 0 : true;
+   string delim = argc > 4 ? argv[4] : ",";
+   int repeats = argc > 5 ? atoi(argv[5]) : 3;
+   if (repeats < 1) repeats = 1;
+
+   // The count pass also warms up the file system cache.
+
+   CMLineStream lstr;
+   if (!lstr.open(filename))
+   {
+      fprintf(stderr, "Can't open file %s.\n", filename);
+      return 1;
+   }
+   CMTimer tcount;
+   tcount.start();
+   int nlines = 0;
+   while (lstr.getline()) nlines++;
+   tcount.stop();
+   double bytes = lstr.bytesRead();
+   int nrows = nlines - (hasHeader && nlines > 0);
+
+   vector<CMColumnSink*> sinks;
+   string types(argv[2]);
+   for (size_t start = 0; start <= types.size(); )
+   {
+      size_t end = types.find(',', start);
+      if (end == string::npos) end = types.size();
+      string type = types.substr(start, end - start);
+      CMColumnSink* sink = cmNativeSink(type.c_str(), nrows);
+      if (sink == 0)
+      {
+         fprintf(stderr, "Unsupported column type '%s'.\n", type.c_str());
+         return 1;
+      }
+      sinks.push_back(sink);
+      start = end + 1;
+   }
+
+   int n;
+   double tline = cmTimePass(filename, hasHeader, delim, CM_PASS_GETLINE, sinks, repeats, n);
+   double tsplit = cmTimePass(filename, hasHeader, delim, CM_PASS_SPLIT, sinks, repeats, n);
+   double tparse = cmTimePass(filename, hasHeader, delim, CM_PASS_PARSE, sinks, repeats, n);
+
+   printf("%s: %.0f bytes, %d rows, %d columns\n", filename, bytes, nrows, (int) sinks.size());
+   printf("%-8s %10s %10s %14s\n", "stage", "wall", "MB/s", "rows/s");
+   cmPrintStage("count", tcount.wall(), bytes, nrows);
+   cmPrintStage("getline", tline, bytes, nrows);
+   cmPrintStage("split", tsplit - tline, bytes, nrows);
+   cmPrintStage("convert", tparse - tsplit, bytes, nrows);
+   cmPrintStage("total", tparse, bytes, nrows);
+
+   for (size_t i = 0; i < sinks.size(); i++) delete sinks[i];
+   return 0;
+}
@@ -0,0 +1,226 @@
+//-------------------------------------------------------------------------------
+//
+// Package csvread
+//
+// Fuzz target for the line reader, the record splitter, the converters and the splitting of
+// files into ranges for parallel loads.
+//
+// Built with libFuzzer by "make fuzz"; "make fuzz-replay" builds a driver that runs the
+// target on the files given on the command line, for reproducing crashes without clang.
+//
+// Sergei Izrailev, 2011-2014
+//-------------------------------------------------------------------------------
+// Copyright 2011-2014 Collective, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//-------------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#include "SfiDelimitedRecordSTD.h"
+#include "CMLineStream.h"
+#include "CMLoader.h"
+#include "CMNativeSink.h"
+#include "CMFileSplit.h"
+
+using namespace cm;
+
+//-----------------------------------------------------------------------------
+
+// The first byte of the input selects the delimiter, the column types, the quoted mode and
+// whether the fields are selected in reverse order; the quoted mode with the ';' delimiter
+// selects fixed-width fields instead, and the empty delimiter stands for runs of blanks. The
+// rest of the input is written to a temporary file and loaded like csvread does, since
+// CMLineStream reads files. The buffer size of CMLineStream is 1 MB, so inputs longer than
+// that (-max_len) also test lines that span buffer reads. The file is then loaded as strings
+// once serially and once from small ranges, split as readCSVFiles splits files for threads,
+// and the two loads must have the same records.
+
+static const char* s_types[] = { "integer", "double", "long", "longhex", "string" };
+static const char* s_delims[] = { ",", "||", "", ";" };
+
+static const char* cmFuzzFile()
+{
+   static char name[] = "/tmp/csvread-fuzz-XXXXXX";
+   static bool created = false;
+   if (!created)
+   {
+      int fd = mkstemp(name);
+      if (fd < 0) abort();
+      close(fd);
+      created = true;
+   }
+   return name;
+}
+
+/// Sets up the record splitter and the line stream for the mode selected by sel.
+static void cmFuzzSetup(uint8_t sel, int ncols, SfiDelimitedRecordSTD& rec, CMLineStream& lstr)
+{
+   if ((sel & 0x43) == 0x43)
+   {
+      // fixed-width fields of widths 1, 2, 3, ...
+      vector<int> starts, widths;
+      int start = 0;
+      for (int i = 0; i < ncols; i++)
+      {
+         starts.push_back(start);
+         widths.push_back(i + 1);
+         start += i + 1;
+      }
+      rec.setFixedWidths(starts, widths);
+   }
+   else if (sel & 0x40)
+   {
+      lstr.setQuoted(true);
+      rec.setQuoted(true);
+   }
+   if (sel & 0x80)
+   {
+      // select the fields in reverse order, as named coltypes would
+      vector<int> columns;
+      for (int i = 0; i < ncols; i++) columns.push_back(ncols - 1 - i);
+      rec.setColumns(columns);
+   }
+}
+
+/// Loads the file of the given size as string columns, serially if rangeSize is 0, or from
+/// the ranges of about rangeSize bytes found as in readCSVFiles. Appends the fields of column
+/// i of all records to fields[i], with "NULL" for NA.
+static void cmFuzzLoad(const char* filename, size_t size, size_t rangeSize, uint8_t sel, int ncols,
+   vector<vector<string> >& fields)
+{
+   bool quoted = (sel & 0x40) && (sel & 0x43) != 0x43;
+   vector<CMFileRange> ranges;
+   cmSplitRange(0, 0, size, rangeSize, ranges);
+   if (ranges.size() > 1)
+   {
+      if (quoted)
+      {
+         vector<size_t> quotes(ranges.size());
+         for (size_t r = 0; r < ranges.size(); r++)
+         {
+            ifstream istr(filename, ios::binary);
+            quotes[r] = cmCountChars(istr, ranges[r].start, ranges[r].end, '"');
+         }
+         cmSetQuoteStates(ranges, quotes);
+      }
+      for (size_t r = 0; r < ranges.size(); r++)
+      {
+         if (ranges[r].start == 0) continue;
+         ifstream istr(filename, ios::binary);
+         ranges[r].start = cmRecordStart(istr, ranges[r].start, size, quoted, ranges[r].inQuotes);
+      }
+      cmJoinRanges(ranges);
+   }
+
+   for (size_t r = 0; r < ranges.size(); r++)
+   {
+      ifstream istr(filename, ios::binary);
+      int nlines = cmCountRangeLines(istr, ranges[r].start, ranges[r].end);
+      vector<CMColumnSink*> sinks;
+      for (int i = 0; i < ncols; i++) sinks.push_back(new CMNativeSinkStr(nlines));
+      CMLineStream lstr;
+      if (rangeSize == 0) lstr.open(filename);
+      else lstr.open(filename, ranges[r].start, ranges[r].end);
+      SfiDelimitedRecordSTD rec(0, s_delims[sel & 3]);
+      cmFuzzSetup(sel, ncols, rec, lstr);
+      int n = cmParseLines(lstr, rec, sinks);
+      if (n > nlines) abort();
+      for (int i = 0; i < ncols; i++)
+      {
+         const CMNativeSinkStr& col = *(CMNativeSinkStr*) sinks[i];
+         for (int k = 0; k < n; k++) fields[i].push_back(col[k] ? col[k] : "NULL");
+         delete sinks[i];
+      }
+   }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+   if (size == 0) return 0;
+   uint8_t sel = data[0];
+   string delim = s_delims[sel & 3];
+   int ncols = 1 + ((sel >> 2) & 7);
+   data++;
+   size--;
+
+   const char* filename = cmFuzzFile();
+   FILE* f = fopen(filename, "wb");
+   if (f == 0) abort();
+   if (size > 0 && fwrite(data, 1, size, f) != size) abort();
+   fclose(f);
+
+   // Expected number of lines, counted as in readCSV.
+   int nlines = 0;
+   for (size_t i = 0; i < size; i++) nlines += data[i] == '\n';
+   if (size > 0 && data[size - 1] != '\n') nlines++;
+
+   vector<CMColumnSink*> sinks;
+   for (int i = 0; i < ncols; i++)
+   {
+      sinks.push_back(cmNativeSink(s_types[(sel + i) % 5], nlines));
+   }
+
+   CMLineStream lstr(filename);
+   SfiDelimitedRecordSTD rec(0, delim);
+   cmFuzzSetup(sel, ncols, rec, lstr);
+   int n = cmParseLines(lstr, rec, sinks);
+   if (n > nlines) abort();
+   for (int i = 0; i < ncols; i++)
+   {
+      if (sinks[i]->size() != n) abort();
+      delete sinks[i];
+   }
+
+   // The ranges are small, but not so many that long inputs are slow.
+   size_t rangeSize = 1 + size % 61;
+   if (rangeSize < size / 64) rangeSize = size / 64;
+   vector<vector<string> > serial(ncols), split(ncols);
+   cmFuzzLoad(filename, size, 0, sel, ncols, serial);
+   cmFuzzLoad(filename, size, rangeSize, sel, ncols, split);
+   if ((int) serial[0].size() != n || serial != split) abort();
+   return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+#ifdef CM_FUZZ_STANDALONE
+int main(int argc, char** argv)
+{
+   for (int k = 1; k < argc; k++)
+   {
+      FILE* f = fopen(argv[k], "rb");
+      if (f == 0)
+      {
+         fprintf(stderr, "Can't open file %s.\n", argv[k]);
+         return 1;
+      }
+      vector<uint8_t> buf;
+      int c;
+      while ((c = fgetc(f)) != EOF) buf.push_back((uint8_t) c);
+      fclose(f);
+      LLVMFuzzerTestOneInput(buf.empty() ? 0 : &buf[0], buf.size());
+      printf("%s: ok\n", argv[k]);
+   }
+   return 0;
+}
+#endif
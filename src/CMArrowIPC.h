@@ -0,0 +1,662 @@
+//-------------------------------------------------------------------------------
+//
+// Package csvread
+//
+// Minimal Arrow IPC (Feather v2) file format support: a flatbuffer builder and
+// reader sufficient for the Arrow metadata, and the message framing.
+//
+// Sergei Izrailev, 2011-2014
+//-------------------------------------------------------------------------------
+// Copyright 2011-2014 Collective, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//-------------------------------------------------------------------------------
+
+#ifndef CMArrowIPC_INCLUDED
+#define CMArrowIPC_INCLUDED
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <fstream>
+using namespace std;
+
+namespace cm
+{
+
+//-----------------------------------------------------------------------------
+//
+// Arrow metadata constants (Schema.fbs, Message.fbs, File.fbs)
+//
+//-----------------------------------------------------------------------------
+
+/// Constants from the Arrow flatbuffer schemas. Field ids are the zero-based
+/// positions of the fields in the corresponding flatbuffer tables.
+struct CMArrow
+{
+   enum MetadataVersion { V5 = 4 };
+   enum MessageHeader { HeaderSchema = 1, HeaderDictionaryBatch = 2, HeaderRecordBatch = 3 };
+   enum Type { TypeInt = 2, TypeFloatingPoint = 3, TypeUtf8 = 5 };
+   enum Precision { PrecisionDouble = 2 };
+
+   enum MessageField { MessageVersion = 0, MessageHeaderType = 1, MessageHeaderValue = 2, MessageBodyLength = 3 };
+   enum SchemaField { SchemaEndianness = 0, SchemaFields = 1 };
+   enum FieldField { FieldName = 0, FieldNullable = 1, FieldTypeType = 2, FieldType = 3,
+                     FieldDictionary = 4, FieldChildren = 5, FieldCustomMetadata = 6 };
+   enum KeyValueField { KeyValueKey = 0, KeyValueValue = 1 };
+   enum IntField { IntBitWidth = 0, IntIsSigned = 1 };
+   enum FloatingPointField { FloatingPointPrecision = 0 };
+   enum DictionaryEncodingField { DictionaryId = 0, DictionaryIndexType = 1, DictionaryIsOrdered = 2 };
+   enum RecordBatchField { RecordBatchLength = 0, RecordBatchNodes = 1, RecordBatchBuffers = 2,
+                           RecordBatchCompression = 3 };
+   enum DictionaryBatchField { DictionaryBatchId = 0, DictionaryBatchData = 1, DictionaryBatchIsDelta = 2 };
+   enum FooterField { FooterVersion = 0, FooterSchema = 1, FooterDictionaries = 2, FooterRecordBatches = 3 };
+
+   /// Sizes of the flatbuffer structs FieldNode, Buffer and Block.
+   enum StructSize { FieldNodeSize = 16, BufferSize = 16, BlockSize = 24 };
+};
+
+/// Arrow file magic, padded to 8 bytes at the beginning of the file.
+static const char CM_ARROW_MAGIC[8] = { 'A', 'R', 'R', 'O', 'W', '1', 0, 0 };
+
+/// Returns n rounded up to a multiple of 8, the alignment of Arrow buffers and messages.
+inline int64_t cmArrowPad8(int64_t n)
+{
+   return (n + 7) & ~((int64_t) 7);
+}
+
+//-----------------------------------------------------------------------------
+//
+// CMFlatBuilder - builds a flatbuffer front to back from a tree of nodes.
+//
+//-----------------------------------------------------------------------------
+/// A node of a flatbuffer under construction: a table, a string, a vector of tables
+/// or a vector of structs. Nodes are owned by the CMFlatBuilder that created them.
+struct CMFlatNode
+{
+   enum Kind { Table, String, TableVector, StructVector };
+
+   /// A table field: either a scalar of the given size or a reference to a child node.
+   struct Field
+   {
+      int id;
+      int size;
+      uint64_t scalar;
+      CMFlatNode* child;
+   };
+
+   Kind kind;
+   vector<Field> fields;          ///< Table fields.
+   string bytes;                  ///< String contents or raw struct vector elements.
+   int count;                     ///< Number of structs in a struct vector.
+   int align;                     ///< Alignment of the structs in a struct vector.
+   vector<CMFlatNode*> children;  ///< Elements of a vector of tables.
+};
+
+/// Flatbuffers are normally built back to front. Here the whole tree is described
+/// first and then serialized front to back: a parent precedes its children, so all
+/// offsets are positive as the format requires, and vtables precede their tables.
+/// The metadata messages are small, so the simplicity is worth more than the extra
+/// bookkeeping.
+///
+/// Usage:
+/// \code
+/// CMFlatBuilder fb;
+/// CMFlatNode* t = fb.table();
+/// fb.addInt32(t, 0, 64);
+/// fb.addChild(t, 1, fb.str("name"));
+/// string buf = fb.finish(t);
+/// \endcode
+class CMFlatBuilder
+{
+protected:
+   vector<CMFlatNode*> m_nodes;   ///< All nodes created by the builder.
+   string m_buf;                  ///< Output buffer.
+
+   CMFlatNode* newNode(CMFlatNode::Kind kind)
+   {
+      CMFlatNode* node = new CMFlatNode();
+      node->kind = kind;
+      node->count = 0;
+      node->align = 4;
+      m_nodes.push_back(node);
+      return node;
+   }
+
+   void addField(CMFlatNode* t, int id, int size, uint64_t value, CMFlatNode* child)
+   {
+      CMFlatNode::Field f;
+      f.id = id;
+      f.size = size;
+      f.scalar = value;
+      f.child = child;
+      t->fields.push_back(f);
+   }
+
+   /// Pads the output with zeros to a multiple of n, optionally leaving room for
+   /// \c reserve bytes before the aligned position.
+   void pad(size_t n, size_t reserve = 0)
+   {
+      while ((m_buf.size() + reserve) % n) m_buf.push_back('\0');
+   }
+
+   void put(const void* p, size_t n)
+   {
+      m_buf.append((const char*) p, n);
+   }
+
+   void patch(size_t pos, const void* p, size_t n)
+   {
+      memcpy(&m_buf[pos], p, n);
+   }
+
+   /// Writes the uoffset at \c slot pointing to \c target.
+   void patchOffset(size_t slot, size_t target)
+   {
+      uint32_t off = (uint32_t) (target - slot);
+      patch(slot, &off, 4);
+   }
+
+   /// Serializes a node and its children; returns the position the node's offsets refer to.
+   size_t write(CMFlatNode* node)
+   {
+      size_t pos = 0;
+      switch (node->kind)
+      {
+      case CMFlatNode::String:
+      {
+         pad(4);
+         pos = m_buf.size();
+         uint32_t len = (uint32_t) node->bytes.size();
+         put(&len, 4);
+         m_buf.append(node->bytes);
+         m_buf.push_back('\0');
+         break;
+      }
+      case CMFlatNode::StructVector:
+      {
+         pad(node->align > 4 ? node->align : 4, 4);
+         pos = m_buf.size();
+         uint32_t len = (uint32_t) node->count;
+         put(&len, 4);
+         m_buf.append(node->bytes);
+         break;
+      }
+      case CMFlatNode::TableVector:
+      {
+         pad(4);
+         pos = m_buf.size();
+         uint32_t len = (uint32_t) node->children.size();
+         put(&len, 4);
+         size_t slots = m_buf.size();
+         m_buf.append(4 * node->children.size(), '\0');
+         for (size_t i = 0; i < node->children.size(); i++)
+         {
+            patchOffset(slots + 4 * i, write(node->children[i]));
+         }
+         break;
+      }
+      case CMFlatNode::Table:
+      {
+         // The vtable: its size, the table size and one 16-bit offset per field id.
+         int nids = 0;
+         for (size_t i = 0; i < node->fields.size(); i++)
+         {
+            if (node->fields[i].id + 1 > nids) nids = node->fields[i].id + 1;
+         }
+         pad(2);
+         size_t vtpos = m_buf.size();
+         vector<uint16_t> vt(2 + nids, 0);
+         m_buf.append(2 * vt.size(), '\0');
+
+         // The table starts with a signed offset to the vtable. Fields are laid out
+         // largest first, each aligned to its size relative to the buffer start.
+         pad(8, 4);
+         pos = m_buf.size();
+         int32_t soff = (int32_t) (pos - vtpos);
+         put(&soff, 4);
+         vector<size_t> slots(node->fields.size(), 0);
+         for (int size = 8; size >= 1; size /= 2)
+         {
+            for (size_t i = 0; i < node->fields.size(); i++)
+            {
+               const CMFlatNode::Field& f = node->fields[i];
+               if (f.size != size) continue;
+               pad(size);
+               slots[i] = m_buf.size();
+               vt[2 + f.id] = (uint16_t) (slots[i] - pos);
+               if (f.child) m_buf.append(4, '\0');
+               else put(&f.scalar, size); // little-endian: the low bytes come first
+            }
+         }
+         vt[0] = (uint16_t) (2 * vt.size());
+         vt[1] = (uint16_t) (m_buf.size() - pos);
+         patch(vtpos, &vt[0], 2 * vt.size());
+
+         for (size_t i = 0; i < node->fields.size(); i++)
+         {
+            if (node->fields[i].child) patchOffset(slots[i], write(node->fields[i].child));
+         }
+         break;
+      }
+      }
+      return pos;
+   }
+
+public:
+   CMFlatBuilder() {}
+   ~CMFlatBuilder()
+   {
+      for (size_t i = 0; i < m_nodes.size(); i++) delete m_nodes[i];
+   }
+
+   /// Creates an empty table.
+   CMFlatNode* table()
+   {
+      return newNode(CMFlatNode::Table);
+   }
+   /// Creates a string.
+   CMFlatNode* str(const std::string& s)
+   {
+      CMFlatNode* node = newNode(CMFlatNode::String);
+      node->bytes = s;
+      return node;
+   }
+   /// Creates a vector of tables.
+   CMFlatNode* tableVector(const vector<CMFlatNode*>& tables)
+   {
+      CMFlatNode* node = newNode(CMFlatNode::TableVector);
+      node->children = tables;
+      return node;
+   }
+   /// Creates a vector of \c count structs stored contiguously in \c bytes.
+   CMFlatNode* structVector(const std::string& bytes, int count, int align = 8)
+   {
+      CMFlatNode* node = newNode(CMFlatNode::StructVector);
+      node->bytes = bytes;
+      node->count = count;
+      node->align = align;
+      return node;
+   }
+
+   void addBool(CMFlatNode* t, int id, bool v)   { addField(t, id, 1, v ? 1 : 0, 0); }
+   void addUInt8(CMFlatNode* t, int id, int v)   { addField(t, id, 1, (uint8_t) v, 0); }
+   void addInt16(CMFlatNode* t, int id, int v)   { addField(t, id, 2, (uint16_t) v, 0); }
+   void addInt32(CMFlatNode* t, int id, int v)   { addField(t, id, 4, (uint32_t) v, 0); }
+   void addInt64(CMFlatNode* t, int id, int64_t v) { addField(t, id, 8, (uint64_t) v, 0); }
+   void addChild(CMFlatNode* t, int id, CMFlatNode* child) { addField(t, id, 4, 0, child); }
+
+   /// Serializes the tree rooted at \c root and returns the flatbuffer.
+   std::string finish(CMFlatNode* root)
+   {
+      m_buf.assign(4, '\0');
+      patchOffset(0, write(root));
+      return m_buf;
+   }
+};
+
+//-----------------------------------------------------------------------------
+//
+// CMFlatTable - read access to a table of a flatbuffer.
+//
+//-----------------------------------------------------------------------------
+/// A view of a flatbuffer table. All accesses are bounds-checked against the
+/// buffer; a failed check marks the shared \c bad flag and yields a default value,
+/// so a reader can walk the metadata and test for corruption once at the end.
+class CMFlatTable
+{
+protected:
+   const char* m_buf;
+   size_t m_size;
+   size_t m_pos;
+   bool* m_bad;
+
+   bool check(size_t pos, size_t n) const
+   {
+      if (m_buf == 0 || pos > m_size || n > m_size - pos)
+      {
+         if (m_bad) *m_bad = true;
+         return false;
+      }
+      return true;
+   }
+
+   template <typename T> T read(size_t pos) const
+   {
+      T v = 0;
+      if (check(pos, sizeof(T))) memcpy(&v, m_buf + pos, sizeof(T));
+      return v;
+   }
+
+   /// Returns the position of the field \c id or 0 if the field is absent.
+   size_t field(int id) const
+   {
+      if (m_buf == 0) return 0;
+      int64_t vt = (int64_t) m_pos - read<int32_t>(m_pos);
+      if (vt < 0 || !check((size_t) vt, 4)) return 0;
+      uint16_t vtsize = read<uint16_t>((size_t) vt);
+      if ((size_t) (4 + 2 * id + 2) > vtsize) return 0;
+      uint16_t off = read<uint16_t>((size_t) vt + 4 + 2 * id);
+      return off ? m_pos + off : 0;
+   }
+
+   /// Follows the uoffset stored at \c pos.
+   size_t deref(size_t pos) const
+   {
+      return pos ? pos + read<uint32_t>(pos) : 0;
+   }
+
+public:
+   CMFlatTable(const char* buf = 0, size_t size = 0, size_t pos = 0, bool* bad = 0)
+      : m_buf(buf), m_size(size), m_pos(pos), m_bad(bad)
+   {
+      if (m_buf && !check(m_pos, 4)) m_buf = 0;
+   }
+
+   /// Returns the root table of the flatbuffer in buf.
+   static CMFlatTable root(const char* buf, size_t size, bool* bad)
+   {
+      CMFlatTable t(buf, size, 0, bad);
+      return t.valid() ? CMFlatTable(buf, size, t.read<uint32_t>(0), bad) : t;
+   }
+
+   /// Returns true if the table exists.
+   bool valid() const
+   {
+      return m_buf != 0;
+   }
+
+   /// Returns true if the field is present.
+   bool has(int id) const
+   {
+      return field(id) != 0;
+   }
+
+   template <typename T> T scalar(int id, T def = 0) const
+   {
+      size_t p = field(id);
+      return p ? read<T>(p) : def;
+   }
+
+   /// Returns the table referenced by the field or an invalid table.
+   CMFlatTable table(int id) const
+   {
+      size_t p = deref(field(id));
+      return p ? CMFlatTable(m_buf, m_size, p, m_bad) : CMFlatTable();
+   }
+
+   /// Returns the string referenced by the field or an empty string.
+   std::string str(int id) const
+   {
+      size_t p = deref(field(id));
+      if (!p) return std::string();
+      uint32_t len = read<uint32_t>(p);
+      if (!check(p + 4, len)) return std::string();
+      return std::string(m_buf + p + 4, len);
+   }
+
+   /// Returns the number of elements of the vector referenced by the field, or 0 if the
+   /// elements, at least a byte each, don't fit the buffer.
+   int vectorSize(int id) const
+   {
+      size_t p = deref(field(id));
+      if (!p) return 0;
+      uint32_t n = read<uint32_t>(p);
+      return check(p + 4, n) ? (int) n : 0;
+   }
+
+   /// Returns the i-th table of the vector of tables referenced by the field.
+   CMFlatTable vectorTable(int id, int i) const
+   {
+      size_t p = deref(field(id));
+      if (!p || i < 0 || (uint32_t) i >= read<uint32_t>(p)) return CMFlatTable();
+      size_t q = deref(p + 4 + 4 * (size_t) i);
+      return q ? CMFlatTable(m_buf, m_size, q, m_bad) : CMFlatTable();
+   }
+
+   /// Returns a scalar member at byte \c offset of the i-th struct of \c structSize
+   /// bytes in the vector of structs referenced by the field.
+   template <typename T> T vectorStruct(int id, int i, int structSize, int offset) const
+   {
+      size_t p = deref(field(id));
+      if (!p || i < 0 || (uint32_t) i >= read<uint32_t>(p)) return 0;
+      return read<T>(p + 4 + (size_t) i * structSize + offset);
+   }
+};
+
+//-----------------------------------------------------------------------------
+//
+// CMArrowWriter - writes framed messages to an Arrow IPC file.
+//
+//-----------------------------------------------------------------------------
+/// A block of a message body: a pointer to existing memory and its size. The
+/// writer streams the blocks to the file as is, adding the padding required
+/// between Arrow buffers, so column data never has to be copied.
+struct CMArrowBodyPart
+{
+   const void* data;
+   int64_t size;
+};
+
+/// Location of a message in the file, as recorded in the footer.
+struct CMArrowBlock
+{
+   int64_t offset;
+   int32_t metaDataLength;
+   int64_t bodyLength;
+};
+
+/// Writes the file magic, encapsulated messages and the footer of an Arrow IPC file.
+class CMArrowWriter
+{
+protected:
+   ofstream m_ostr;
+   int64_t m_pos;    ///< Current position in the file.
+
+   void put(const void* p, int64_t n)
+   {
+      if (n > 0) m_ostr.write((const char*) p, (streamsize) n);
+      m_pos += n;
+   }
+
+   void padTo8()
+   {
+      static const char zeros[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+      put(zeros, cmArrowPad8(m_pos) - m_pos);
+   }
+
+public:
+   CMArrowWriter() : m_pos(0) {}
+   ~CMArrowWriter() {}
+
+   /// Opens the file and writes the magic. Returns false if the file can't be opened.
+   bool open(const char* filename)
+   {
+      m_ostr.open(filename, ios::out | ios::binary | ios::trunc);
+      if (m_ostr.fail()) return false;
+      m_pos = 0;
+      put(CM_ARROW_MAGIC, 8);
+      return true;
+   }
+
+   /// Returns false if any write has failed.
+   bool good() const
+   {
+      return !m_ostr.fail();
+   }
+
+   /// Returns the Arrow body layout of the parts: the offset and length of each
+   /// buffer, packed as a vector of Buffer structs, and the total body length.
+   static std::string bufferLayout(const vector<CMArrowBodyPart>& parts, int64_t* bodyLength)
+   {
+      std::string bytes;
+      int64_t off = 0;
+      for (size_t i = 0; i < parts.size(); i++)
+      {
+         int64_t b[2] = { off, parts[i].size };
+         bytes.append((const char*) b, sizeof(b));
+         off += cmArrowPad8(parts[i].size);
+      }
+      *bodyLength = off;
+      return bytes;
+   }
+
+   /// Writes a message with the flatbuffer metadata and body parts; returns its block.
+   CMArrowBlock writeMessage(const std::string& metadata, const vector<CMArrowBodyPart>& parts)
+   {
+      CMArrowBlock block;
+      block.offset = m_pos;
+      uint32_t cont = 0xFFFFFFFF;
+      int32_t len = (int32_t) cmArrowPad8(8 + metadata.size()) - 8;
+      put(&cont, 4);
+      put(&len, 4);
+      put(metadata.data(), metadata.size());
+      padTo8();
+      block.metaDataLength = 8 + len;
+      int64_t start = m_pos;
+      for (size_t i = 0; i < parts.size(); i++)
+      {
+         put(parts[i].data, parts[i].size);
+         padTo8();
+      }
+      block.bodyLength = m_pos - start;
+      return block;
+   }
+
+   /// Writes the footer and the trailing magic and closes the file.
+   void writeFooter(const std::string& footer)
+   {
+      int32_t len = (int32_t) footer.size();
+      put(footer.data(), footer.size());
+      put(&len, 4);
+      put(CM_ARROW_MAGIC, 6);
+      m_ostr.close();
+   }
+
+   /// Packs blocks as a vector of Block structs.
+   static std::string blockLayout(const vector<CMArrowBlock>& blocks)
+   {
+      std::string bytes;
+      for (size_t i = 0; i < blocks.size(); i++)
+      {
+         char b[CMArrow::BlockSize];
+         memset(b, 0, sizeof(b));
+         memcpy(b, &blocks[i].offset, 8);
+         memcpy(b + 8, &blocks[i].metaDataLength, 4);
+         memcpy(b + 16, &blocks[i].bodyLength, 8);
+         bytes.append(b, sizeof(b));
+      }
+      return bytes;
+   }
+};
+
+//-----------------------------------------------------------------------------
+//
+// CMArrowReader - reads the footer and messages of an Arrow IPC file.
+//
+//-----------------------------------------------------------------------------
+/// Reads an Arrow IPC file. The metadata is loaded into memory, while message bodies
+/// are read on demand straight into the caller's storage.
+class CMArrowReader
+{
+protected:
+   ifstream m_istr;
+   int64_t m_size;          ///< File size.
+   std::string m_footer;    ///< Footer flatbuffer.
+   bool m_bad;              ///< Set when the metadata fails a bounds check.
+
+public:
+   CMArrowReader() : m_size(0), m_bad(false) {}
+   ~CMArrowReader() {}
+
+   /// Opens the file, checks the magic and loads the footer. Returns false on failure.
+   bool open(const char* filename)
+   {
+      m_istr.open(filename, ios::in | ios::binary);
+      if (m_istr.fail()) return false;
+      m_istr.seekg(0, ios::end);
+      m_size = (int64_t) m_istr.tellg();
+      if (m_size < 8 + 10) return false;
+
+      char magic[8];
+      m_istr.seekg(0, ios::beg);
+      m_istr.read(magic, 8);
+      if (m_istr.fail() || memcmp(magic, CM_ARROW_MAGIC, 6) != 0) return false;
+
+      char tail[10];
+      m_istr.seekg(m_size - 10, ios::beg);
+      m_istr.read(tail, 10);
+      if (m_istr.fail() || memcmp(tail + 4, CM_ARROW_MAGIC, 6) != 0) return false;
+      int32_t len;
+      memcpy(&len, tail, 4);
+      if (len <= 0 || len > m_size - 18) return false;
+      m_footer.resize(len);
+      return read(m_size - 10 - len, &m_footer[0], len);
+   }
+
+   /// Returns the footer table.
+   CMFlatTable footer()
+   {
+      return CMFlatTable::root(m_footer.data(), m_footer.size(), &m_bad);
+   }
+
+   /// Returns the file size.
+   int64_t size() const
+   {
+      return m_size;
+   }
+
+   /// Returns true if any metadata access went out of bounds.
+   bool bad() const
+   {
+      return m_bad;
+   }
+
+   /// Reads n bytes at the file offset into dest. Returns false on failure.
+   bool read(int64_t offset, void* dest, int64_t n)
+   {
+      if (offset < 0 || n < 0 || offset > m_size || n > m_size - offset) return false;
+      if (n == 0) return true;
+      m_istr.clear();
+      m_istr.seekg((streamoff) offset, ios::beg);
+      m_istr.read((char*) dest, (streamsize) n);
+      return !m_istr.fail();
+   }
+
+   /// Loads the metadata flatbuffer of the message at \c block into \c metadata.
+   bool readMessage(const CMArrowBlock& block, std::string& metadata)
+   {
+      if (block.metaDataLength < 8) return false;
+      char prefix[8];
+      if (!read(block.offset, prefix, 8)) return false;
+      uint32_t cont;
+      int32_t len;
+      memcpy(&cont, prefix, 4);
+      memcpy(&len, prefix + 4, 4);
+      int64_t start = block.offset + 8;
+      if (cont != 0xFFFFFFFF)
+      {
+         // pre-0.15 format without the continuation marker
+         len = (int32_t) cont;
+         start = block.offset + 4;
+      }
+      if (len <= 0 || len > block.metaDataLength) return false;
+      metadata.resize(len);
+      return read(start, &metadata[0], len);
+   }
+};
+
+} // namespace cm
+
+#endif // CMArrowIPC_INCLUDED
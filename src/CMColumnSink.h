@@ -0,0 +1,104 @@
+//-------------------------------------------------------------------------------
+//
+// Package csvread
+//
+// class CMColumnSink - the destination of parsed fields, independent of R.
+//
+// Sergei Izrailev, 2011-2014
+//-------------------------------------------------------------------------------
+// Copyright 2011-2014 Collective, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//-------------------------------------------------------------------------------
+
+#ifndef CMColumnSink_INCLUDED
+#define CMColumnSink_INCLUDED
+
+#include "CMTimer.h"
+
+namespace cm
+{
+
+//-----------------------------------------------------------------------------
+//
+// CMColumnSink - A column that the loader appends fields to.
+//
+//-----------------------------------------------------------------------------
+/// The loader passes every field of a column to a sink, which converts it and stores the
+/// value. The R collectors in CMRDataCollector.h are sinks that write into R vectors, and
+/// the native programs in the native directory use sinks that own their storage, so that
+/// the tokenizer and the converters can be built and measured without R.
+class CMColumnSink
+{
+public:
+   CMColumnSink() {}
+   virtual ~CMColumnSink() {}
+
+   /// Parse and append an element to the collection. Returns false if there was a parse error,
+   /// which includes a field that is not only a number, although its value is appended.
+   virtual bool append(const char* s) = 0;
+   /// Returns the size of the collection.
+   virtual int size() const = 0;
+   /// Returns the storage capacity of the collection.
+   virtual int capacity() const = 0;
+   /// Clears the collection.
+   virtual void clear() = 0;
+   /// Sets the size of the vector to the smaller of n and its capacity.
+   virtual void resize(int n) = 0;
+};
+
+//-----------------------------------------------------------------------------
+
+/// A sink that measures the wall-clock time spent in append() of another sink.
+/// Does not own the other sink.
+class CMTimedSink : public CMColumnSink
+{
+protected:
+   CMColumnSink* m_sink;
+   CMTimer* m_timer;
+
+public:
+   /// The timer can be shared by several sinks; its CPU time is best left unmeasured.
+   CMTimedSink(CMColumnSink* sink, CMTimer* timer) : m_sink(sink), m_timer(timer) {}
+   virtual ~CMTimedSink() {}
+
+   virtual bool append(const char* s)
+   {
+      m_timer->start();
+      bool ok = m_sink->append(s);
+      m_timer->stop();
+      return ok;
+   }
+   virtual int size() const
+   {
+      return m_sink->size();
+   }
+   virtual int capacity() const
+   {
+      return m_sink->capacity();
+   }
+   virtual void clear()
+   {
+      m_sink->clear();
+   }
+   virtual void resize(int n)
+   {
+      m_sink->resize(n);
+   }
+};
+
+//-----------------------------------------------------------------------------
+
+}
+
+#endif // CMColumnSink_INCLUDED
@@ -0,0 +1,222 @@
+//-------------------------------------------------------------------------------
+//
+// Package csvread
+//
+// Column statistics gathered while loading, including a HyperLogLog distinct count.
+//
+// Sergei Izrailev, 2011-2014
+//-------------------------------------------------------------------------------
+// Copyright 2011-2014 Collective, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//-------------------------------------------------------------------------------
+
+#ifndef CMColumnStats_INCLUDED
+#define CMColumnStats_INCLUDED
+
+#include <math.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#include "int64.h"
+
+namespace cm
+{
+
+//-----------------------------------------------------------------------------
+
+/// Mixes the bits of a 64-bit value (the finalizer of splitmix64), so that similar values
+/// such as consecutive IDs have unrelated hashes.
+inline uint64_t cmMix64(uint64_t x)
+{
+   x ^= x >> 30;
+   x *= 0xbf58476d1ce4e5b9ULL;
+   x ^= x >> 27;
+   x *= 0x94d049bb133111ebULL;
+   x ^= x >> 31;
+   return x;
+}
+
+/// Returns the 64-bit hash of a string of n bytes: FNV-1a followed by cmMix64.
+inline uint64_t cmHashString(const char* s, size_t n)
+{
+   uint64_t h = 14695981039346656037ULL;
+   for (size_t i = 0; i < n; i++)
+   {
+      h ^= (unsigned char) s[i];
+      h *= 1099511628211ULL;
+   }
+   return cmMix64(h);
+}
+
+//-----------------------------------------------------------------------------
+//
+// CMHyperLogLog - Approximate count of distinct values.
+//
+//-----------------------------------------------------------------------------
+/// A HyperLogLog sketch (Flajolet et al., 2007) with 2^14 one-byte registers. Each register
+/// keeps the largest number of leading zeros plus one seen in the hashes that fall into it.
+/// The relative standard error of the estimate is about 1.04 / sqrt(2^14), i.e., 0.8%, and
+/// small counts are estimated exactly enough by linear counting of the empty registers.
+class CMHyperLogLog
+{
+   static const int s_bits = 14;
+protected:
+   vector<unsigned char> m_registers;
+
+public:
+   CMHyperLogLog() : m_registers(1 << s_bits, 0) {}
+
+   /// Adds a 64-bit hash of a value.
+   void add(uint64_t h)
+   {
+      size_t j = (size_t) (h >> (64 - s_bits));
+      uint64_t w = h << s_bits;
+      unsigned char rho = 1;
+      while (rho <= 64 - s_bits && (w & 0x8000000000000000ULL) == 0)
+      {
+         rho++;
+         w <<= 1;
+      }
+      if (rho > m_registers[j]) m_registers[j] = rho;
+   }
+
+   /// Returns the estimated number of distinct hashes added.
+   double estimate() const
+   {
+      double m = m_registers.size();
+      double sum = 0;
+      int zeros = 0;
+      for (size_t j = 0; j < m_registers.size(); j++)
+      {
+         sum += ldexp(1.0, -m_registers[j]);
+         if (m_registers[j] == 0) zeros++;
+      }
+      double e = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+      if (e <= 2.5 * m && zeros > 0) e = m * log(m / zeros);
+      return floor(e + 0.5);
+   }
+};
+
+//-----------------------------------------------------------------------------
+//
+// CMColumnStats - Statistics of the values appended to a column.
+//
+//-----------------------------------------------------------------------------
+/// Counts of values and NAs, the smallest and the largest value, and the approximate number
+/// of distinct values of a column. A collector calls one of the add() functions for each value
+/// that it stores, of the kind that matches its type, so the statistics cost no extra pass.
+/// Strings are compared byte by byte.
+class CMColumnStats
+{
+protected:
+   int m_count;               ///< Number of non-NA values.
+   int m_na;                  ///< Number of NAs.
+   double m_min, m_max;       ///< Range of integer and double values.
+   CMInt64 m_lmin, m_lmax;    ///< Range of 64-bit integer values.
+   string m_smin, m_smax;     ///< Range of string values.
+   CMHyperLogLog m_distinct;  ///< Sketch of the distinct values.
+
+public:
+   CMColumnStats() : m_count(0), m_na(0), m_min(0), m_max(0), m_lmin(0), m_lmax(0) {}
+
+   /// Counts an NA.
+   void addNA()
+   {
+      m_na++;
+   }
+
+   /// Adds a double or integer value; NaN counts as NA.
+   void add(double x)
+   {
+      if (x != x)
+      {
+         m_na++;
+         return;
+      }
+      if (x == 0) x = 0; // -0 and 0 are the same value
+      if (m_count == 0 || x < m_min) m_min = x;
+      if (m_count == 0 || x > m_max) m_max = x;
+      m_count++;
+      uint64_t u;
+      memcpy(&u, &x, sizeof(u));
+      m_distinct.add(cmMix64(u));
+   }
+
+   /// Adds a 64-bit integer value.
+   void addInt64(CMInt64 x)
+   {
+      if (m_count == 0 || x < m_lmin) m_lmin = x;
+      if (m_count == 0 || x > m_lmax) m_lmax = x;
+      m_count++;
+      m_distinct.add(cmMix64((uint64_t) x));
+   }
+
+   /// Adds a null-terminated string.
+   void addString(const char* s)
+   {
+      if (m_count == 0 || strcmp(s, m_smin.c_str()) < 0) m_smin = s;
+      if (m_count == 0 || strcmp(s, m_smax.c_str()) > 0) m_smax = s;
+      m_count++;
+      m_distinct.add(cmHashString(s, strlen(s)));
+   }
+
+   /// Returns the number of non-NA values.
+   int count() const
+   {
+      return m_count;
+   }
+   /// Returns the number of NAs.
+   int na() const
+   {
+      return m_na;
+   }
+   /// Returns the estimated number of distinct non-NA values.
+   double distinct() const
+   {
+      return m_count == 0 ? 0 : m_distinct.estimate();
+   }
+   double min() const
+   {
+      return m_min;
+   }
+   double max() const
+   {
+      return m_max;
+   }
+   CMInt64 minInt64() const
+   {
+      return m_lmin;
+   }
+   CMInt64 maxInt64() const
+   {
+      return m_lmax;
+   }
+   const string& minString() const
+   {
+      return m_smin;
+   }
+   const string& maxString() const
+   {
+      return m_smax;
+   }
+};
+
+//-----------------------------------------------------------------------------
+
+}
+
+#endif // CMColumnStats_INCLUDED
@@ -0,0 +1,95 @@
+//-------------------------------------------------------------------------------
+//
+// Package csvread
+//
+// Conversion of text fields to numbers, independent of R.
+//
+// Sergei Izrailev, 2011-2014
+//-------------------------------------------------------------------------------
+// Copyright 2011-2014 Collective, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//-------------------------------------------------------------------------------
+
+#ifndef CMConverters_INCLUDED
+#define CMConverters_INCLUDED
+
+#include "int64.h"
+
+#include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+
+namespace cm
+{
+
+//-----------------------------------------------------------------------------
+
+// The converters return false for an empty field or a parse error, and leave the output
+// unchanged in that case. The caller decides which value stands for NA. Like strtod and strtol,
+// they accept a number followed by other characters, such as "12x", as the number, and a field
+// without a number, such as "N/A", as 0. If exact is given, it tells whether the field was a
+// number only, so that the loads can count the other fields as failures, and the predicates
+// can refuse to match them.
+
+/// Returns true if strtod or strtol parsed all of the field s, which ends at p: there is a number,
+/// followed at most by blanks, such as the carriage return of a CRLF line.
+inline bool cmParsedAll(const char* s, const char* p)
+{
+   if (p == s) return false;
+   while (*p == ' ' || *p == '\t' || *p == '\r') p++;
+   return *p == '\0';
+}
+
+/// Parses a double.
+inline bool cmParseDouble(const char* s, double& x, bool* exact = 0)
+{
+   if (s == 0 || *s == '\0') return false;
+   char* p;
+   errno = 0;
+   double d = strtod(s, &p);
+   if (errno == EINVAL || errno == ERANGE) return false;
+   x = d;
+   if (exact) *exact = cmParsedAll(s, p);
+   return true;
+}
+
+/// Parses a 64-bit integer in the given base.
+inline bool cmParseInt64(const char* s, int base, CMInt64& x, bool* exact = 0)
+{
+   if (s == 0 || *s == '\0') return false;
+   char* p;
+   errno = 0;
+   CMInt64 u = strtoll(s, &p, base);
+   if (errno == EINVAL || errno == ERANGE) return false;
+   x = u;
+   if (exact) *exact = cmParsedAll(s, p);
+   return true;
+}
+
+/// Parses a decimal 32-bit integer. A value outside of the range of int is an error, rather
+/// than being truncated, since long may have 64 bits. INT_MIN is NA_INTEGER in R and is out
+/// of range as well.
+inline bool cmParseInt(const char* s, int& x, bool* exact = 0)
+{
+   CMInt64 n;
+   if (!cmParseInt64(s, 10, n, exact) || n <= INT_MIN || n > INT_MAX) return false;
+   x = (int) n;
+   return true;
+}
+
+//-----------------------------------------------------------------------------
+
+}
+
+#endif // CMConverters_INCLUDED
@@ -0,0 +1,152 @@
+//-------------------------------------------------------------------------------
+//
+// Package csvread
+//
+// Splitting delimited files into byte ranges of whole records for parallel loading.
+//
+// Sergei Izrailev, 2011-2014
+//-------------------------------------------------------------------------------
+// Copyright 2011-2014 Collective, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//-------------------------------------------------------------------------------
+
+#ifndef CMFileSplit_INCLUDED
+#define CMFileSplit_INCLUDED
+
+#include <fstream>
+#include <vector>
+
+using namespace std;
+
+#include "CMTail.h"
+
+namespace cm
+{
+
+//-----------------------------------------------------------------------------
+
+// A file is loaded on several threads by splitting it into byte ranges that start at the
+// beginning of a record. Without quotes, a range starts after the first newline at or after
+// its nominal offset. With quoted fields, a newline may be inside quotes, which can only be
+// told by the number of quotes before it. The ranges are therefore found in two passes: the
+// quotes of the nominal ranges are counted in parallel, and a prefix sum of the counts gives
+// the quote state at the beginning of each range, after which each range is moved to the
+// first newline outside quotes, also in parallel. Doubled quotes inside quoted fields don't
+// change the state, so the state is correct for files quoted as in RFC 4180.
+
+/// Smallest byte range of a file that is loaded by a thread of its own.
+const size_t CM_MIN_RANGE = 4 * 1024 * 1024;
+
+/// A byte range of a file that holds whole records.
+struct CMFileRange
+{
+   int file;         ///< Index of the file.
+   size_t start;     ///< Offset of the first byte.
+   size_t end;       ///< Offset past the last byte.
+   bool inQuotes;    ///< Flag indicating that the nominal start is inside quotes.
+
+   CMFileRange(int f, size_t s, size_t e) : file(f), start(s), end(e), inQuotes(false) {}
+};
+
+/// Appends the ranges of the bytes from offset start to end of file f to ranges: one range if
+/// rangeSize is 0, or ranges of rangeSize bytes, the last of which can be up to twice as long.
+/// The ranges start at nominal offsets until they are moved by cmRecordStart.
+inline void cmSplitRange(int f, size_t start, size_t end, size_t rangeSize, vector<CMFileRange>& ranges)
+{
+   size_t s = start;
+   while (rangeSize > 0 && end > s && end - s >= 2 * rangeSize)
+   {
+      ranges.push_back(CMFileRange(f, s, s + rangeSize));
+      s += rangeSize;
+   }
+   ranges.push_back(CMFileRange(f, s, end));
+}
+
+/// Sets the quote state at the nominal start of each range from the numbers of quotes in each
+/// range: the start of a range is inside quotes if there is an odd number of quotes in the
+/// preceding ranges of the same file.
+inline void cmSetQuoteStates(vector<CMFileRange>& ranges, const vector<size_t>& quotes)
+{
+   size_t parity = 0;
+   for (size_t r = 0; r < ranges.size(); r++)
+   {
+      if (r == 0 || ranges[r].file != ranges[r - 1].file) parity = 0;
+      ranges[r].inQuotes = parity != 0;
+      parity ^= quotes[r] & 1;
+   }
+}
+
+/// Returns the offset of the first record of the file at or after offset from, i.e., the offset
+/// just past the first newline at or after offset from - 1 that is not inside quotes, or size
+/// if there's none. inQuotes tells whether offset from is inside quotes; the quotes after it
+/// are only counted if quoted is true.
+inline size_t cmRecordStart(ifstream& istr, size_t from, size_t size, bool quoted, bool inQuotes)
+{
+   if (from == 0) return 0;
+   const size_t SZ = 64 * 1024;
+   vector<char> buff(SZ);
+   istr.clear();
+   istr.seekg(from - 1);
+   size_t pos = from - 1;
+   while (pos < size)
+   {
+      size_t n = size - pos < SZ ? size - pos : SZ;
+      istr.read(&buff[0], n);
+      size_t got = istr.gcount();
+      if (got == 0) break;
+      for (size_t i = 0; i < got; i++)
+      {
+         if (buff[i] == '\n' && !inQuotes) return pos + i + 1;
+         if (quoted && buff[i] == '"' && pos + i >= from) inQuotes = !inQuotes;
+      }
+      pos += got;
+   }
+   return size;
+}
+
+/// Ends each range at the start of the next range of the same file, after the starts have been
+/// moved by cmRecordStart. A range that is covered by a record that starts before it is empty.
+inline void cmJoinRanges(vector<CMFileRange>& ranges)
+{
+   for (size_t r = 0; r < ranges.size(); r++)
+   {
+      if (r > 0 && ranges[r].file == ranges[r - 1].file && ranges[r].start < ranges[r - 1].end)
+      {
+         ranges[r].start = ranges[r - 1].end;
+      }
+      if (r + 1 < ranges.size() && ranges[r + 1].file == ranges[r].file)
+      {
+         ranges[r].end = ranges[r + 1].start > ranges[r].start ? ranges[r + 1].start : ranges[r].start;
+      }
+   }
+}
+
+/// Returns the number of lines between offsets from and to of the file: the newlines, plus one
+/// if the range doesn't end with a newline.
+inline int cmCountRangeLines(ifstream& istr, size_t from, size_t to)
+{
+   if (to <= from) return 0;
+   int nn = cmCountNewlines(istr, from, to);
+   char last = '\n';
+   istr.clear();
+   istr.seekg(to - 1);
+   istr.get(last);
+   return last == '\n' ? nn : nn + 1;
+}
+
+//-----------------------------------------------------------------------------
+
+}
+
+#endif // CMFileSplit_INCLUDED
@@ -24,6 +24,7 @@
 #ifndef CMLineStream_INCLUDED
 #define CMLineStream_INCLUDED
 
+#include <string.h>
 #include <string>
 #include <iostream>
 #include <fstream>
@@ -44,6 +45,10 @@ namespace cm
 ///
 /// When end of input is reached, the file is automatically closed.
 ///
+/// In quoted mode (see \c setQuoted()), a newline between double quotes doesn't end the line,
+/// so that a line returned by \c getline() is a whole record of a CSV file with quoted fields
+/// spanning several lines.
+///
 /// Usage:
 /// \code
 /// // To count lines:
@@ -73,6 +78,12 @@ protected:
    bool m_bufferEmpty;        ///< Flag indicating that the buffer is empty or exhausted, so another read is needed.
    bool m_linePending;        ///< Flag indicating that there is a line pending from previous buffer.
    int m_len;                 ///< Length of the most recently returned line.
+   size_t m_bytes;            ///< Number of bytes read from the file.
+   int m_spanned;             ///< Number of lines that spanned buffer reads.
+   size_t m_lineCapacity;     ///< Largest capacity of m_line.
+   size_t m_remaining;        ///< Number of bytes left to read before the end set by open().
+   bool m_quoted;             ///< Flag indicating that newlines inside double quotes are skipped.
+   bool m_inQuotes;           ///< Flag indicating that the line read so far has an open quote.
 
    /// Clears everything.
    void clear()
@@ -85,12 +96,50 @@ protected:
       m_bufferEmpty = true;
       m_linePending = false;
       m_len = 0;
+      m_remaining = (size_t) -1;
+      m_inQuotes = false;
+   }
+   /// Clears the statistics, which are kept after the end of input.
+   void clearStats()
+   {
+      m_bytes = 0;
+      m_spanned = 0;
+      m_lineCapacity = 0;
+   }
+   /// Counts a line that was assembled in m_line from more than one buffer.
+   void countSpanned()
+   {
+      m_spanned++;
+      if (m_line.capacity() > m_lineCapacity) m_lineCapacity = m_line.capacity();
+   }
+   /// Returns the position in the buffer of the newline that ends the line starting at from,
+   /// or m_gcount if there's none. In quoted mode, the newlines inside quotes are skipped, and
+   /// the quotes are counted with m_inQuotes, which is carried over to the next buffer read.
+   int findNewline(int from)
+   {
+      const char* end = m_buffer + m_gcount;
+      const char* p = m_buffer + from;
+      while (true)
+      {
+         const char* nl = (const char*) memchr(p, '\n', end - p);
+         if (!m_quoted) return nl ? (int) (nl - m_buffer) : m_gcount;
+         const char* e = nl ? nl : end;
+         while ((p = (const char*) memchr(p, '"', e - p)))
+         {
+            m_inQuotes = !m_inQuotes;
+            p++;
+         }
+         if (nl == 0) return m_gcount;
+         if (!m_inQuotes) return (int) (nl - m_buffer);
+         p = nl + 1;
+      }
    }
 public:
    /// Creates the object and attaches is to the file if provided.
-   CMLineStream(const char* filename = 0) 
+   CMLineStream(const char* filename = 0) : m_quoted(false)
    {
       clear();
+      clearStats();
       if (filename) 
       {
          m_filename = filename;
@@ -104,10 +153,20 @@ public:
    {
       if (m_istr.is_open()) m_istr.close();
       clear();
+      clearStats();
       m_istr.open(filename);
       m_filename = filename;
       return !m_istr.fail();
    }
+   /// Opens a file to read the bytes from offset start up to offset end, which should be the
+   /// beginning of a line and the end of a line or of the file. Returns FALSE if failed.
+   bool open(const char* filename, size_t start, size_t end)
+   {
+      if (!open(filename)) return false;
+      m_istr.seekg(start);
+      m_remaining = end > start ? end - start : 0;
+      return !m_istr.fail();
+   }
    /// Closes the open file.
    void close()
    {
@@ -115,12 +174,38 @@ public:
       clear();
    }
 
+   /// Sets whether newlines inside double quotes are part of the line. Should be called before
+   /// the first getline().
+   void setQuoted(bool quoted)
+   {
+      m_quoted = quoted;
+   }
+
    /// Returns the length of the most recently returned line.
    int len() const
    {
       return m_len;
    }
 
+   /// Returns the number of bytes read from the file so far.
+   size_t bytesRead() const
+   {
+      return m_bytes;
+   }
+
+   /// Returns the number of lines so far that did not fit in one buffer read.
+   int spannedLines() const
+   {
+      return m_spanned;
+   }
+
+   /// Returns the largest amount of memory used so far by the read buffer and the
+   /// storage for lines that span buffer reads.
+   size_t bufferBytes() const
+   {
+      return s_bufsz + m_lineCapacity;
+   }
+
    /// Returns a non-const pointer to the next line or NULL if end of input.
    char* getline()
    {
@@ -132,13 +217,17 @@ public:
       if (m_bufferEmpty)
       {
          // beginning of the file or have read previous buffer
-         m_istr.read(m_buffer, s_bufsz);
+         // a read shorter than the buffer is the last one
+         m_istr.read(m_buffer, m_remaining < (size_t) s_bufsz ? (int) m_remaining : s_bufsz);
          m_gcount = m_istr.gcount();
+         m_bytes += m_gcount;
+         m_remaining -= m_gcount;
          if (m_gcount == 0)
          {
             // nothing was read
             if (m_linePending)
             {
+               countSpanned();
                m_done = true;
                m_linePending = false;
                m_len = m_line.size();
@@ -157,47 +246,45 @@ public:
       }
 
       // Find the next newline
-      int k;
       char* sret = m_buffer + m_start;
-      for (k = m_start; k < m_gcount; k++)
+      int k = findNewline(m_start);
+      if (k < m_gcount)
       {
-         if (m_buffer[k] == '\n')
-         {
-            // found a newline character
-            m_buffer[k] = '\0';
+         // found a newline character
+         m_buffer[k] = '\0';
 
-            if (m_linePending)
-            {
-               // append the current string to the pending line
-               m_linePending = false;
-               m_line += m_buffer + m_start;
-               sret = (char*) m_line.c_str();
-               m_len = m_line.size();
-            }
-            else
-            {
-               m_len = k - m_start;
-            }
-            if (k == m_gcount - 1)
+         if (m_linePending)
+         {
+            // append the current string to the pending line
+            m_linePending = false;
+            m_line += m_buffer + m_start;
+            countSpanned();
+            sret = (char*) m_line.c_str();
+            m_len = m_line.size();
+         }
+         else
+         {
+            m_len = k - m_start;
+         }
+         if (k == m_gcount - 1)
+         {
+            // the newline is the last char of the buffer
+            if (m_gcount < s_bufsz)
             {
-               // the newline is the last char of the buffer
-               if (m_gcount < s_bufsz)
-               {
-                  // the current buffer is incomplete, so there's nothing more to read
-                  m_done = true;
-               }
-               else
-               {
-                  // set up the next buffer read
-                  m_bufferEmpty = true;
-               }
+               // the current buffer is incomplete, so there's nothing more to read
+               m_done = true;
             }
             else
             {
-               m_start = k + 1;
+               // set up the next buffer read
+               m_bufferEmpty = true;
             }
-            return sret;
          }
+         else
+         {
+            m_start = k + 1;
+         }
+         return sret;
       }
 
       // No newline found to the end of the buffer.
@@ -214,6 +301,7 @@ public:
          {
             // append to the existing line and return
             m_line += sret;
+            countSpanned();
             m_len = m_line.size();
             return (char*) m_line.c_str();
          }
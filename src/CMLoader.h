@@ -0,0 +1,164 @@
+//-------------------------------------------------------------------------------
+//
+// Package csvread
+//
+// The parse loop of the delimited file loader, independent of R.
+//
+// Sergei Izrailev, 2011-2014
+//-------------------------------------------------------------------------------
+// Copyright 2011-2014 Collective, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//-------------------------------------------------------------------------------
+
+#ifndef CMLoader_INCLUDED
+#define CMLoader_INCLUDED
+
+#include <vector>
+
+using namespace std;
+
+#include "SfiDelimitedRecordSTD.h"
+#include "CMLineStream.h"
+#include "CMColumnSink.h"
+#include "CMRowFilter.h"
+
+namespace cm
+{
+
+//-----------------------------------------------------------------------------
+
+/// Receives progress updates from cmParseLines and can stop the load. Updates come every
+/// CMLoadMonitor::s_rows lines, so that a monitor may do work such as checking for user
+/// interrupts or printing without slowing down the load.
+class CMLoadMonitor
+{
+public:
+   static const int s_rows = 16384;
+
+   CMLoadMonitor() {}
+   virtual ~CMLoadMonitor() {}
+
+   /// Called with the number of lines and bytes read so far. Returns false to stop the load.
+   virtual bool update(int lines, size_t bytes) = 0;
+};
+
+//-----------------------------------------------------------------------------
+
+/// Returns true if the field is empty or only has blanks, such as the carriage return of an
+/// empty last field of a CRLF line.
+inline bool cmBlankField(const char* f)
+{
+   while (*f == ' ' || *f == '\t' || *f == '\r') f++;
+   return *f == '\0';
+}
+
+/// Appends field i of the split record rec to sinks[i]. Missing fields are appended as empty
+/// strings and extra fields are ignored. If failures is not NULL, (*failures)[i] is incremented
+/// if sinks[i] fails to parse a non-blank field while it still has capacity; row is the number
+/// of records appended before this one.
+inline void cmAppendRecord(const SfiDelimitedRecordSTD& rec, const vector<CMColumnSink*>& sinks,
+                           vector<int>* failures, int row)
+{
+   int ncols = sinks.size();
+   int nr = rec.size();
+   if (failures == 0)
+   {
+      for (int i = 0; i < ncols; i++)
+      {
+         if (i >= nr) sinks[i]->append("");
+         else sinks[i]->append(rec.get(i));
+      }
+   }
+   else
+   {
+      for (int i = 0; i < ncols; i++)
+      {
+         const char* f = i >= nr ? "" : rec.get(i);
+         if (!sinks[i]->append(f) && !cmBlankField(f) && row < sinks[i]->capacity()) (*failures)[i]++;
+      }
+   }
+}
+
+//-----------------------------------------------------------------------------
+
+/// Optional settings of cmParseLines.
+struct CMParseOptions
+{
+   vector<int>* failures;        ///< Parse failure counts per column, or NULL.
+   CMLoadMonitor* monitor;       ///< Progress monitor, or NULL.
+   const CMRowFilter* filter;    ///< Records to keep, or NULL to keep all.
+   int maxRows;                  ///< Number of records after which to stop, or -1.
+
+   CMParseOptions() : failures(0), monitor(0), filter(0), maxRows(-1) {}
+};
+
+/// Splits the remaining lines of lstr with rec and appends their fields to the sinks with
+/// cmAppendRecord. See CMParseOptions for the settings:
+/// - failures are counted by cmAppendRecord unless NULL;
+/// - if monitor is not NULL, it is updated periodically, and the load stops when it
+///   returns false;
+/// - if filter is not NULL, only the records that it matches are appended;
+/// - reading stops after maxRows records have been appended, unless maxRows is negative.
+/// Returns the number of records appended.
+inline int cmParseLines(CMLineStream& lstr, SfiDelimitedRecordSTD& rec,
+                        const vector<CMColumnSink*>& sinks, const CMParseOptions& opt = CMParseOptions())
+{
+   int n = 0;
+   int lines = 0;
+   int next = opt.monitor ? CMLoadMonitor::s_rows : -1;
+   char* s;
+   while (n != opt.maxRows && (s = lstr.getline()))
+   {
+      rec.split(s, lstr.len());
+      if (++lines == next)
+      {
+         if (!opt.monitor->update(lines, lstr.bytesRead())) break;
+         next += CMLoadMonitor::s_rows;
+      }
+      if (opt.filter && !opt.filter->match(rec)) continue;
+      cmAppendRecord(rec, sinks, opt.failures, n);
+      n++;
+   }
+   return n;
+}
+
+//-----------------------------------------------------------------------------
+
+/// Counts the remaining lines of lstr that filter matches. The monitor is updated as in
+/// cmParseLines; returns -1 if it stopped the count.
+inline int cmCountMatches(CMLineStream& lstr, SfiDelimitedRecordSTD& rec, const CMRowFilter& filter,
+                          CMLoadMonitor* monitor = 0)
+{
+   int n = 0;
+   int lines = 0;
+   int next = monitor ? CMLoadMonitor::s_rows : -1;
+   char* s;
+   while ((s = lstr.getline()))
+   {
+      rec.split(s, lstr.len());
+      if (filter.match(rec)) n++;
+      if (++lines == next)
+      {
+         if (!monitor->update(lines, lstr.bytesRead())) return -1;
+         next += CMLoadMonitor::s_rows;
+      }
+   }
+   return n;
+}
+
+//-----------------------------------------------------------------------------
+
+}
+
+#endif // CMLoader_INCLUDED
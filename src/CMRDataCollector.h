@@ -26,12 +26,16 @@
 
 using namespace std;
 
+#include <vector>
+
 #include "CMVectorWrapper.h"
+#include "CMColumnSink.h"
+#include "CMConverters.h"
+#include "CMColumnStats.h"
 #include "int64.h"
 
 #include <R.h>
 #include <Rinternals.h>
-#include <errno.h>
 
 namespace cm
 {
@@ -41,26 +45,28 @@ namespace cm
 // CMRDataCollector - A base class for parsing and collecting vectors of data in R
 //
 //-----------------------------------------------------------------------------
-/// Base class
-class CMRDataCollector
+/// Base class: a column sink that stores the values in an R vector.
+class CMRDataCollector : public CMColumnSink
 {
 protected:
+   /// Statistics of the stored values, or NULL if not collected.
+   CMColumnStats* m_stats;
 public:
-   CMRDataCollector() {}
+   CMRDataCollector() : m_stats(0) {}
    virtual ~CMRDataCollector() {}
 
-   /// Parse and append an element to the collection. Returns false if there was a parse error.
-   virtual bool append(const char* s) = 0;
-   /// Returns the size of the collection.
-   virtual int size() const = 0;
-   /// Returns the storage capacity of the external storage.
-   virtual int capacity() const = 0;
-   /// Clears the collection.
-   virtual void clear() = 0;
+   /// Sets the statistics object that is updated with each stored value, or NULL to stop
+   /// collecting statistics. The object is owned by the caller.
+   void setStats(CMColumnStats* stats)
+   {
+      m_stats = stats;
+   }
+
    /// Attaches to storage allocated in rvec.
    virtual void attach(SEXP rvec) = 0;
-   /// Sets the size of the vector to the smaller of n and its capacity.
-   virtual void resize(int n) = 0;
+   /// Attaches to n elements of rvec starting at offset, so that several collectors can fill
+   /// disjoint slices of one vector.
+   virtual void attach(SEXP rvec, int offset, int n) = 0;
 };
 
 //-----------------------------------------------------------------------------
@@ -71,6 +77,8 @@ class CMRDataCollectorStr : public CMRDataCollector
 protected:
    /// A STRSXP vector pre-allocated by the class user.
    SEXP m_data;
+   /// Index of the first element of the slice in m_data.
+   int m_offset;
    /// Cached capacity of the vector.
    int m_capacity;
    /// Number of inserted elements.
@@ -83,7 +91,13 @@ public:
    /// Attaches to STRSXP vector. Note that a \b pointer to \c SEXP must be passed.
    virtual void attach(SEXP rvec)
    {
-      m_capacity = length(rvec);
+      attach(rvec, 0, length(rvec));
+   }
+   /// Attaches to a slice of STRSXP vector.
+   virtual void attach(SEXP rvec, int offset, int n)
+   {
+      m_capacity = n;
+      m_offset = offset;
       m_count = 0;
       m_data = rvec;
    }
@@ -93,9 +107,15 @@ public:
    {
       if (s == 0 || m_count >= m_capacity) return false;
       if (strcmp(s, "NULL") == 0)
-         SET_STRING_ELT(m_data, m_count++, NA_STRING);
+      {
+         SET_STRING_ELT(m_data, m_offset + m_count++, NA_STRING);
+         if (m_stats) m_stats->addNA();
+      }
       else
-         SET_STRING_ELT(m_data, m_count++, mkChar(s));
+      {
+         SET_STRING_ELT(m_data, m_offset + m_count++, mkChar(s));
+         if (m_stats) m_stats->addString(s);
+      }
       return true;
    }
    /// Returns the size of the collection.
@@ -127,42 +147,209 @@ public:
 
 //-----------------------------------------------------------------------------
 
+/// String data collector that keeps the strings in its own memory until flush() stores them
+/// in the R vector. Since append() does not call the R API, collectors of this kind can be
+/// filled by several threads; flush() must be called from the main thread.
+class CMRDataCollectorStrBuffer : public CMRDataCollectorStr
+{
+protected:
+   /// The appended strings, each terminated by a null character.
+   vector<char> m_chars;
+   /// Offsets of the strings in m_chars, or (size_t) -1 for NA.
+   vector<size_t> m_starts;
+
+public:
+   CMRDataCollectorStrBuffer() {}
+   virtual ~CMRDataCollectorStrBuffer() {}
+
+   /// Attaches to a slice of STRSXP vector.
+   virtual void attach(SEXP rvec, int offset, int n)
+   {
+      CMRDataCollectorStr::attach(rvec, offset, n);
+      clear();
+   }
+   using CMRDataCollectorStr::attach;
+
+   /// Parse and append an element to the collection. Returns false if there was a parse error.
+   virtual bool append(const char* s)
+   {
+      if (s == 0 || m_count >= m_capacity) return false;
+      if (strcmp(s, "NULL") == 0)
+      {
+         m_starts.push_back((size_t) -1);
+         if (m_stats) m_stats->addNA();
+      }
+      else
+      {
+         m_starts.push_back(m_chars.size());
+         m_chars.insert(m_chars.end(), s, s + strlen(s) + 1);
+         if (m_stats) m_stats->addString(s);
+      }
+      m_count++;
+      return true;
+   }
+   /// Clears the collection.
+   virtual void clear()
+   {
+      m_count = 0;
+      m_chars.clear();
+      m_starts.clear();
+   }
+   /// Sets the vector size to the smaller of n and m_capacity.
+   virtual void resize(int n)
+   {
+      CMRDataCollectorStr::resize(n);
+      if (m_count < (int) m_starts.size()) m_starts.resize(m_count);
+   }
+
+   /// Stores the strings in the R vector and releases the memory.
+   void flush()
+   {
+      for (int i = 0, n = m_starts.size(); i < n; i++)
+      {
+         SET_STRING_ELT(m_data, m_offset + i, m_starts[i] == (size_t) -1 ? NA_STRING : mkChar(&m_chars[m_starts[i]]));
+      }
+      vector<char>().swap(m_chars);
+      vector<size_t>().swap(m_starts);
+   }
+};
+
+//-----------------------------------------------------------------------------
+
+/// Type that an integer column is promoted to when it has a value outside of the int range.
+enum CMPromotion
+{
+   CM_PROMOTE_NONE,     ///< No promotion: such values are NA.
+   CM_PROMOTE_DOUBLE,   ///< A double column.
+   CM_PROMOTE_LONG      ///< A 64-bit integer column, stored in doubles as by CMRDataCollectorLong.
+};
+
 /// Int32 data collector.
+///
+/// With a promotion other than CM_PROMOTE_NONE, the first value that doesn't fit in an int
+/// switches the collector to a side buffer of doubles or 64-bit integers, into which the values
+/// appended so far are converted. The R vector can't grow its type in place and can't be
+/// allocated by the threads that fill the collectors, so it's left as it is, and the loader
+/// replaces it after the load with a vector filled by \c storeWide().
 class CMRDataCollectorInt : public CMRDataCollector
 {
 protected:
    CMVectorWrapper<int> m_data;
+   /// Type of the promotion.
+   CMPromotion m_promotion;
+   /// Values after the promotion, as doubles or as the bits of 64-bit integers.
+   vector<double> m_wide;
+   /// Flag indicating that the values are in m_wide.
+   bool m_promoted;
+
+   /// Parses s as a value of the promoted type into x, which is set to NA on a parse error.
+   /// exact is set as by the converters.
+   bool parseWide(const char* s, double& x, bool* exact = 0) const
+   {
+      if (m_promotion == CM_PROMOTE_DOUBLE)
+      {
+         if (cmParseDouble(s, x, exact)) return true;
+         x = NA_REAL;
+         return false;
+      }
+      CMInt64 u = NA_LONG.L;
+      bool ok = cmParseInt64(s, 10, u, exact);
+      memcpy(&x, &u, sizeof(u));
+      return ok;
+   }
+   /// Returns an int as a value of the promoted type.
+   double wide(int n) const
+   {
+      if (m_promotion == CM_PROMOTE_DOUBLE) return n == NA_INTEGER ? NA_REAL : n;
+      CMInt64 u = n == NA_INTEGER ? NA_LONG.L : n;
+      double x;
+      memcpy(&x, &u, sizeof(u));
+      return x;
+   }
+   /// Adds a value of the promoted type to the statistics.
+   void addWideStats(double x)
+   {
+      if (m_promotion == CM_PROMOTE_DOUBLE)
+      {
+         m_stats->add(x);
+         return;
+      }
+      CMInt64 u;
+      memcpy(&u, &x, sizeof(u));
+      if (u == NA_LONG.L) m_stats->addNA();
+      else m_stats->addInt64(u);
+   }
+   /// Moves the values appended so far to m_wide. The statistics of a 64-bit integer column
+   /// are kept apart from those of doubles and ints, so they are collected again.
+   void promote()
+   {
+      m_wide.reserve(m_data.capacity());
+      if (m_stats && m_promotion == CM_PROMOTE_LONG) *m_stats = CMColumnStats();
+      for (int i = 0, n = m_data.size(); i < n; i++)
+      {
+         m_wide.push_back(wide(m_data[i]));
+         if (m_stats && m_promotion == CM_PROMOTE_LONG) addWideStats(m_wide.back());
+      }
+      m_promoted = true;
+   }
+   /// Appends an element after the promotion.
+   bool appendWide(const char* s)
+   {
+      if ((int) m_wide.size() >= m_data.capacity()) return false;
+      double x;
+      bool exact = true;
+      bool ok = parseWide(s, x, &exact);
+      m_wide.push_back(x);
+      if (m_stats) addWideStats(x);
+      return ok && exact;
+   }
+
 public:
-   CMRDataCollectorInt() {}
+   CMRDataCollectorInt(CMPromotion promotion = CM_PROMOTE_NONE)
+      : m_promotion(promotion), m_promoted(false) {}
    virtual ~CMRDataCollectorInt() {}
 
    /// Attaches to INTSXP vector. Note that a \b pointer to \c SEXP must be passed.
    virtual void attach(SEXP rvec)
    {
-      m_data.attach(length(rvec), INTEGER(rvec));
+      attach(rvec, 0, length(rvec));
+   }
+   /// Attaches to a slice of INTSXP vector.
+   virtual void attach(SEXP rvec, int offset, int n)
+   {
+      m_data.attach(n, INTEGER(rvec) + offset);
+      vector<double>().swap(m_wide);
+      m_promoted = false;
    }
    /// Parse and append an element to the collection. Returns false if there was a parse error.
    virtual bool append(const char* s)
    {
-      if (s == 0 || *s == '\0')
+      if (m_promoted) return appendWide(s);
+      int n;
+      bool exact = true;
+      if (!cmParseInt(s, n, &exact))
       {
-         m_data.push_back(NA_INTEGER);
+         double x;
+         if (m_promotion != CM_PROMOTE_NONE && m_data.size() < m_data.capacity() && parseWide(s, x))
+         {
+            promote();
+            return appendWide(s);
+         }
+         if (m_data.push_back(NA_INTEGER) && m_stats) m_stats->addNA();
          return false;
       }
-
-      char* p;
-      int n = (int) strtol(s, &p, 10);
-      if (errno == EINVAL || errno == ERANGE)
+      bool ok = m_data.push_back(n);
+      if (ok && m_stats)
       {
-         m_data.push_back(NA_INTEGER);
-         return false;
+         if (n == NA_INTEGER) m_stats->addNA();
+         else m_stats->add(n);
       }
-      return m_data.push_back(n);
+      return ok && exact;
    }
    /// Returns the size of the collection.
    virtual int size() const
    {
-      return m_data.size();
+      return m_promoted ? (int) m_wide.size() : m_data.size();
    }
    /// Returns the size of the collection.
    virtual int capacity() const
@@ -173,11 +360,35 @@ public:
    virtual void clear()
    {
       m_data.clear();
+      m_wide.clear();
    }
    /// Sets the vector size to the smaller of n and m_capacity.
    virtual void resize(int n)
    {
       m_data.resize(n);
+      if (m_promoted) m_wide.resize(m_data.size());
+   }
+
+   /// Returns true if the values don't fit in the int vector and are kept in the collector.
+   bool promoted() const
+   {
+      return m_promoted;
+   }
+
+   /// Returns the type of the promotion.
+   CMPromotion promotion() const
+   {
+      return m_promotion;
+   }
+
+   /// Writes the values to out as values of the promoted type, whether or not the collector
+   /// has been promoted.
+   void storeWide(double* out) const
+   {
+      for (int i = 0, n = size(); i < n; i++)
+      {
+         out[i] = m_promoted ? m_wide[i] : wide(m_data[i]);
+      }
    }
 
    /// Returns a pointer to the contiguous data store.
@@ -203,23 +414,24 @@ public:
    {
       m_data.attach(length(rvec), REAL(rvec));
    }
+   /// Attaches to a slice of REALXP vector.
+   virtual void attach(SEXP rvec, int offset, int n)
+   {
+      m_data.attach(n, REAL(rvec) + offset);
+   }
    /// Parse and append an element to the collection. Returns false if there was a parse error.
    virtual bool append(const char* s)
    {
-      if (s == 0 || *s == '\0')
-      {
-         m_data.push_back(NA_REAL);
-         return false;
-      }
-
-      char* p;
-      double x = strtod(s, &p);
-      if (errno == EINVAL || errno == ERANGE)
+      double x;
+      bool exact = true;
+      if (!cmParseDouble(s, x, &exact))
       {
-         m_data.push_back(NA_REAL);
+         if (m_data.push_back(NA_REAL) && m_stats) m_stats->addNA();
          return false;
       }
-      return m_data.push_back(x);
+      bool ok = m_data.push_back(x);
+      if (ok && m_stats) m_stats->add(x);
+      return ok && exact;
    }
    /// Returns the size of the collection.
    virtual int size() const
@@ -276,24 +488,24 @@ public:
    /// Parse and append an element to the collection. Returns false if there was a parse error.
    virtual bool append(const char* s)
    {
-      if (s == 0 || *s == '\0')
+      CMInt64 u;
+      bool exact = true;
+      if (!cmParseInt64(s, m_base, u, &exact))
       {
-         m_data.push_back(NA_LONG.D);
-         return false;
-      }
-
-      char* p;
-      CMInt64 u = strtoll(s, &p, m_base);
-      if (errno == EINVAL || errno == ERANGE)
-      {
-         m_data.push_back(NA_LONG.D);
+         if (m_data.push_back(NA_LONG.D) && m_stats) m_stats->addNA();
          return false;
       }
 //      return m_data.push_back(*((double*) &u));
       // assume sizeof(double) >= sizeof(CMInt64)
       double d;
       memcpy(&d, &u, sizeof(u));
-      return m_data.push_back(d);
+      bool ok = m_data.push_back(d);
+      if (ok && m_stats)
+      {
+         if (u == NA_LONG.L) m_stats->addNA();
+         else m_stats->addInt64(u);
+      }
+      return ok && exact;
    }
 };
 
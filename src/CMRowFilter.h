@@ -0,0 +1,242 @@
+//-------------------------------------------------------------------------------
+//
+// Package csvread
+//
+// Row predicates evaluated on the text fields of a record, independent of R.
+//
+// Sergei Izrailev, 2011-2014
+//-------------------------------------------------------------------------------
+// Copyright 2011-2014 Collective, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//-------------------------------------------------------------------------------
+
+#ifndef CMRowFilter_INCLUDED
+#define CMRowFilter_INCLUDED
+
+#include <math.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+#include "SfiDelimitedRecordSTD.h"
+#include "CMConverters.h"
+
+namespace cm
+{
+
+//-----------------------------------------------------------------------------
+//
+// Field keys - conversion of a field to the value compared by a predicate.
+//
+//-----------------------------------------------------------------------------
+
+// A key converts a field to a value of type field_type that can be compared with values
+// of type value_type. Empty fields, parse errors and NAs never match a predicate, and neither
+// do fields that are not only a number, such as "12x" or "N/A", which the loads keep as the
+// number they start with or as 0.
+
+/// 64-bit integer key in the base of the column (10 or 16); also used for integer columns.
+struct CMKeyInt64
+{
+   typedef CMInt64 value_type;
+   typedef CMInt64 field_type;
+   int base;
+
+   explicit CMKeyInt64(int b = 10) : base(b) {}
+   bool parse(const char* s, CMInt64& x) const
+   {
+      bool exact;
+      return cmParseInt64(s, base, x, &exact) && exact && x != NA_LONG.L;
+   }
+};
+
+/// Double key.
+struct CMKeyDouble
+{
+   typedef double value_type;
+   typedef double field_type;
+
+   bool parse(const char* s, double& x) const
+   {
+      bool exact;
+      return cmParseDouble(s, x, &exact) && exact && !isnan(x);
+   }
+};
+
+/// String key; the field is compared as is, and "NULL" is NA as in CMRDataCollectorStr.
+struct CMKeyString
+{
+   typedef string value_type;
+   typedef const char* field_type;
+
+   bool parse(const char* s, const char*& x) const
+   {
+      x = s;
+      return strcmp(s, "NULL") != 0;
+   }
+};
+
+//-----------------------------------------------------------------------------
+//
+// CMPredicate - A condition on one field of a record.
+//
+//-----------------------------------------------------------------------------
+/// Base class of predicates on the field in a given (zero-based) column.
+class CMPredicate
+{
+protected:
+   int m_column;
+
+public:
+   explicit CMPredicate(int column) : m_column(column) {}
+   virtual ~CMPredicate() {}
+
+   /// Returns true if the field s satisfies the predicate.
+   virtual bool match(const char* s) const = 0;
+
+   /// Returns the column of the field.
+   int column() const
+   {
+      return m_column;
+   }
+};
+
+//-----------------------------------------------------------------------------
+
+/// The field is one of a set of values, which is looked up by binary search.
+template <class K>
+class CMPredicateIn : public CMPredicate
+{
+protected:
+   K m_key;
+   vector<typename K::value_type> m_values;
+
+public:
+   CMPredicateIn(int column, const K& key, const vector<typename K::value_type>& values)
+      : CMPredicate(column), m_key(key), m_values(values)
+   {
+      sort(m_values.begin(), m_values.end());
+   }
+   virtual bool match(const char* s) const
+   {
+      typename K::field_type x;
+      return m_key.parse(s, x) && binary_search(m_values.begin(), m_values.end(), x);
+   }
+};
+
+//-----------------------------------------------------------------------------
+
+/// The field is within a closed range; either end can be open.
+template <class K>
+class CMPredicateRange : public CMPredicate
+{
+protected:
+   K m_key;
+   typename K::value_type m_from;
+   typename K::value_type m_to;
+   bool m_hasFrom;
+   bool m_hasTo;
+
+public:
+   CMPredicateRange(int column, const K& key, const typename K::value_type& from, bool hasFrom,
+                    const typename K::value_type& to, bool hasTo)
+      : CMPredicate(column), m_key(key), m_from(from), m_to(to), m_hasFrom(hasFrom), m_hasTo(hasTo) {}
+
+   virtual bool match(const char* s) const
+   {
+      typename K::field_type x;
+      if (!m_key.parse(s, x)) return false;
+      return (!m_hasFrom || !(x < m_from)) && (!m_hasTo || !(m_to < x));
+   }
+};
+
+//-----------------------------------------------------------------------------
+
+/// The field starts with a given string.
+class CMPredicatePrefix : public CMPredicate
+{
+protected:
+   string m_prefix;
+
+public:
+   CMPredicatePrefix(int column, const string& prefix) : CMPredicate(column), m_prefix(prefix) {}
+
+   virtual bool match(const char* s) const
+   {
+      return strncmp(s, m_prefix.c_str(), m_prefix.size()) == 0;
+   }
+};
+
+//-----------------------------------------------------------------------------
+//
+// CMRowFilter - A conjunction of predicates.
+//
+//-----------------------------------------------------------------------------
+/// Selects the records that satisfy all of its predicates. The predicates are evaluated
+/// on the split record before any of its fields is converted, so that the loader only
+/// converts and stores the records that are kept. Owns the predicates.
+class CMRowFilter
+{
+protected:
+   vector<CMPredicate*> m_predicates;
+
+private:
+   CMRowFilter(const CMRowFilter&);
+   CMRowFilter& operator=(const CMRowFilter&);
+
+public:
+   CMRowFilter() {}
+   ~CMRowFilter()
+   {
+      clear();
+   }
+
+   /// Adds a predicate; the filter takes ownership of it.
+   void add(CMPredicate* p)
+   {
+      m_predicates.push_back(p);
+   }
+
+   /// Deletes all predicates.
+   void clear()
+   {
+      for (size_t i = 0; i < m_predicates.size(); i++) delete m_predicates[i];
+      m_predicates.clear();
+   }
+
+   /// Returns true if there are no predicates.
+   bool empty() const
+   {
+      return m_predicates.empty();
+   }
+
+   /// Returns true if the split record satisfies all predicates.
+   bool match(const SfiDelimitedRecordSTD& rec) const
+   {
+      for (size_t i = 0, n = m_predicates.size(); i < n; i++)
+      {
+         if (!m_predicates[i]->match(rec.get(m_predicates[i]->column()))) return false;
+      }
+      return true;
+   }
+};
+
+//-----------------------------------------------------------------------------
+
+}
+
+#endif // CMRowFilter_INCLUDED
@@ -0,0 +1,214 @@
+//-------------------------------------------------------------------------------
+//
+// Package csvread
+//
+// Random samples of the lines of a file, independent of R.
+//
+// Sergei Izrailev, 2011-2014
+//-------------------------------------------------------------------------------
+// Copyright 2011-2014 Collective, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//-------------------------------------------------------------------------------
+
+#ifndef CMSampler_INCLUDED
+#define CMSampler_INCLUDED
+
+#include <math.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+
+using namespace std;
+
+#include "SfiDelimitedRecordSTD.h"
+#include "CMLineStream.h"
+#include "CMRowFilter.h"
+#include "CMLoader.h"
+
+namespace cm
+{
+
+//-----------------------------------------------------------------------------
+
+/// Source of uniform random numbers in [0, 1), so that the R binding can use R's generator.
+class CMRandom
+{
+public:
+   CMRandom() {}
+   virtual ~CMRandom() {}
+   virtual double uniform() = 0;
+};
+
+/// A sampled line and its position: the line number for reservoir sampling, or the byte
+/// offset of the line for offset sampling. Sorting by position restores the file order.
+struct CMSampledLine
+{
+   size_t pos;
+   string line;
+
+   bool operator<(const CMSampledLine& other) const
+   {
+      return pos < other.pos;
+   }
+};
+
+//-----------------------------------------------------------------------------
+
+/// Returns true if filter is NULL or matches the line s of length n. The line is split in a
+/// copy, since the caller may keep it.
+inline bool cmMatchLine(const CMRowFilter* filter, SfiDelimitedRecordSTD& rec, vector<char>& tmp,
+                        const char* s, int n)
+{
+   if (filter == 0) return true;
+   tmp.assign(s, s + n + 1);
+   rec.split(&tmp[0], n);
+   return filter->match(rec);
+}
+
+//-----------------------------------------------------------------------------
+
+/// Draws a uniform sample of k of the remaining lines of lstr (of those that filter matches,
+/// unless it's NULL) in one pass, using reservoir sampling with geometric skips (algorithm L
+/// of Li, 1994), so that the random numbers are only drawn for the lines that enter the
+/// sample. Only the k sampled lines are kept in memory. The lines are returned in file order.
+/// The monitor is updated as in cmParseLines; returns false if it stopped the pass.
+inline bool cmSampleReservoir(CMLineStream& lstr, SfiDelimitedRecordSTD& rec, const CMRowFilter* filter,
+                              int k, CMRandom& rng, vector<CMSampledLine>& sample, CMLoadMonitor* monitor = 0)
+{
+   sample.clear();
+   if (k <= 0) return true;
+   sample.reserve(k);
+   vector<char> tmp;
+   size_t n = 0;                  // matching lines so far
+   size_t skipTo = 0;             // the next matching line to enter the sample
+   double w = exp(log(rng.uniform()) / k);
+   int lines = 0;
+   int next = monitor ? CMLoadMonitor::s_rows : -1;
+   char* s;
+   while ((s = lstr.getline()))
+   {
+      if (++lines == next)
+      {
+         if (!monitor->update(lines, lstr.bytesRead())) return false;
+         next += CMLoadMonitor::s_rows;
+      }
+      if (n >= (size_t) k && n < skipTo)
+      {
+         // the line is skipped unless the filter rejects it, in which case it doesn't count
+         if (filter == 0 || cmMatchLine(filter, rec, tmp, s, lstr.len())) n++;
+         continue;
+      }
+      if (!cmMatchLine(filter, rec, tmp, s, lstr.len())) continue;
+      if (n < (size_t) k)
+      {
+         CMSampledLine sl;
+         sl.pos = n;
+         sample.push_back(sl);
+         sample.back().line.assign(s, lstr.len());
+      }
+      else
+      {
+         CMSampledLine& sl = sample[(size_t) (rng.uniform() * k) % k];
+         sl.pos = n;
+         sl.line.assign(s, lstr.len());
+         w *= exp(log(rng.uniform()) / k);
+      }
+      n++;
+      if (n >= (size_t) k)
+      {
+         // number of matching lines to skip before the next one enters the sample
+         double skip = floor(log(rng.uniform()) / log(1 - w));
+         skipTo = skip < 1e15 ? n + (size_t) skip : (size_t) -1;
+      }
+   }
+   sort(sample.begin(), sample.end());
+   return true;
+}
+
+//-----------------------------------------------------------------------------
+
+/// Draws k random byte offsets between start (the beginning of the first data line) and the
+/// end of the file and returns the lines that follow them, in file order: the line starting
+/// right after the first newline at or after offset - 1, or the first line for the offsets in
+/// the last line. This takes one seek and a short read per line instead of a pass over the
+/// file, but the sample is approximate: a line is picked with a probability proportional to
+/// the length of the line before it, and a line picked twice is returned once, so the sample
+/// can have fewer than k lines. If filter is not NULL, only the lines that it matches are
+/// returned.
+inline void cmSampleOffsets(const char* filename, size_t start, SfiDelimitedRecordSTD& rec,
+                            const CMRowFilter* filter, int k, CMRandom& rng, vector<CMSampledLine>& sample)
+{
+   sample.clear();
+   ifstream istr(filename, ios::binary);
+   if (istr.fail() || k <= 0) return;
+   istr.seekg(0, ios::end);
+   size_t size = (size_t) istr.tellg();
+   if (size <= start) return;
+
+   vector<size_t> offsets(k);
+   for (int i = 0; i < k; i++)
+   {
+      offsets[i] = start + (size_t) (rng.uniform() * (size - start));
+      if (offsets[i] >= size) offsets[i] = size - 1;
+   }
+   sort(offsets.begin(), offsets.end());
+
+   vector<char> tmp;
+   string line;
+   size_t last = (size_t) -1;
+   bool wrap = false;
+   for (int i = 0; i < k && !wrap; i++)
+   {
+      istr.clear();
+      size_t pos = offsets[i];
+      if (pos > start)
+      {
+         // skip to the beginning of the next line
+         istr.seekg(pos - 1);
+         getline(istr, line);
+         pos = (size_t) istr.tellg();
+         wrap = istr.fail() || pos >= size;
+         if (wrap) break;
+      }
+      else istr.seekg(pos);
+      if (pos == last) continue;
+      last = pos;
+      getline(istr, line);
+      if (!cmMatchLine(filter, rec, tmp, line.c_str(), line.size())) continue;
+      CMSampledLine sl;
+      sl.pos = pos;
+      sample.push_back(sl);
+      sample.back().line.swap(line);
+   }
+   if (wrap && last != start)
+   {
+      // the offsets in the last line pick the first line
+      istr.clear();
+      istr.seekg(start);
+      getline(istr, line);
+      if (!cmMatchLine(filter, rec, tmp, line.c_str(), line.size())) return;
+      CMSampledLine sl;
+      sl.pos = start;
+      sample.insert(sample.begin(), sl);
+      sample.front().line.swap(line);
+   }
+}
+
+//-----------------------------------------------------------------------------
+
+}
+
+#endif // CMSampler_INCLUDED
@@ -0,0 +1,133 @@
+//-------------------------------------------------------------------------------
+//
+// Package csvread
+//
+// Helpers for loading the lines appended to a file since the previous load.
+//
+// Sergei Izrailev, 2011-2014
+//-------------------------------------------------------------------------------
+// Copyright 2011-2014 Collective, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//-------------------------------------------------------------------------------
+
+#ifndef CMTail_INCLUDED
+#define CMTail_INCLUDED
+
+#include <string.h>
+#include <fstream>
+#include <vector>
+
+using namespace std;
+
+namespace cm
+{
+
+//-----------------------------------------------------------------------------
+
+// A file that is being appended to is loaded up to the end of its last complete line, since
+// the last line may still be in the middle of being written. The next load starts at that
+// offset. To detect a file that was truncated or replaced in the meantime, the load keeps a
+// checksum of the last bytes before the offset, which must be unchanged on the next load.
+
+/// Number of bytes before the offset that are checksummed.
+const size_t CM_TAIL_WINDOW = 256;
+
+/// Returns the size of an open file and leaves the stream at an undefined position.
+inline size_t cmStreamSize(ifstream& istr)
+{
+   istr.clear();
+   istr.seekg(0, ios::end);
+   return istr ? (size_t) istr.tellg() : 0;
+}
+
+/// Returns the offset just past the last newline between offsets from and size of the file,
+/// or from if there is no newline. The file is searched backwards from the end.
+inline size_t cmLastLineEnd(ifstream& istr, size_t from, size_t size)
+{
+   const size_t SZ = 64 * 1024;
+   vector<char> buff(SZ);
+   size_t end = size;
+   while (end > from)
+   {
+      size_t n = end - from < SZ ? end - from : SZ;
+      istr.clear();
+      istr.seekg(end - n);
+      istr.read(&buff[0], n);
+      if ((size_t) istr.gcount() != n) return from;
+      for (size_t i = n; i > 0; i--)
+      {
+         if (buff[i - 1] == '\n') return end - n + i;
+      }
+      end -= n;
+   }
+   return from;
+}
+
+/// Returns the number of characters c between offsets from and to of the file.
+inline size_t cmCountChars(ifstream& istr, size_t from, size_t to, char c)
+{
+   const size_t SZ = 1024 * 1024;
+   vector<char> buff(SZ);
+   size_t nn = 0;
+   istr.clear();
+   istr.seekg(from);
+   while (from < to)
+   {
+      size_t n = to - from < SZ ? to - from : SZ;
+      istr.read(&buff[0], n);
+      size_t got = istr.gcount();
+      if (got == 0) break;
+      const char* p = &buff[0];
+      const char* e = p + got;
+      while ((p = (const char*) memchr(p, c, e - p)))
+      {
+         nn++;
+         p++;
+      }
+      from += got;
+   }
+   return nn;
+}
+
+/// Returns the number of newlines between offsets from and to of the file.
+inline int cmCountNewlines(ifstream& istr, size_t from, size_t to)
+{
+   return (int) cmCountChars(istr, from, to, '\n');
+}
+
+/// Returns the 32-bit FNV-1a checksum of the len bytes of the file before offset end, or of
+/// all bytes before end if there are fewer.
+inline unsigned int cmTailChecksum(ifstream& istr, size_t end, size_t len)
+{
+   if (len > end) len = end;
+   unsigned int h = 2166136261u;
+   if (len == 0) return h;
+   vector<char> buff(len);
+   istr.clear();
+   istr.seekg(end - len);
+   istr.read(&buff[0], len);
+   size_t got = istr.gcount();
+   for (size_t i = 0; i < got; i++)
+   {
+      h ^= (unsigned char) buff[i];
+      h *= 16777619u;
+   }
+   return h;
+}
+
+//-----------------------------------------------------------------------------
+
+}
+
+#endif // CMTail_INCLUDED
@@ -0,0 +1,123 @@
+//-------------------------------------------------------------------------------
+//
+// Package csvread
+//
+// Wall-clock and CPU timer.
+//
+// Sergei Izrailev, 2011-2014
+//-------------------------------------------------------------------------------
+// Copyright 2011-2014 Collective, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//-------------------------------------------------------------------------------
+
+#ifndef CMTimer_INCLUDED
+#define CMTimer_INCLUDED
+
+#include <ctime>
+#include <sys/time.h>
+
+namespace cm
+{
+
+//-----------------------------------------------------------------------------
+//
+// CMTimer - Accumulates wall-clock and CPU time over start/stop intervals.
+//
+//-----------------------------------------------------------------------------
+/// A stopwatch that measures both the elapsed (wall-clock) time and the CPU time of
+/// the process in seconds. Repeated start() / stop() calls add up, so one timer can
+/// measure a phase that is interleaved with others.
+///
+/// Usage:
+/// \code
+/// CMTimer t;
+/// t.start();
+/// ...
+/// t.stop();
+/// Rprintf("%.3f s elapsed, %.3f s CPU\n", t.wall(), t.cpu());
+/// \endcode
+///
+class CMTimer
+{
+protected:
+   double m_wall;       ///< Accumulated wall-clock time.
+   double m_cpu;        ///< Accumulated CPU time.
+   double m_wallStart;  ///< Wall-clock time at the last start().
+   double m_cpuStart;   ///< CPU time at the last start().
+   bool m_running;      ///< Flag indicating that the timer has been started and not stopped.
+   bool m_useCpu;       ///< Flag indicating that the CPU time is measured.
+
+public:
+   /// Creates a stopped timer. Reading the CPU time costs more than reading the clock, so
+   /// a timer for many short intervals can be created with useCpu = false.
+   CMTimer(bool useCpu = true) : m_wall(0), m_cpu(0), m_wallStart(0), m_cpuStart(0),
+      m_running(false), m_useCpu(useCpu) {}
+
+   /// Returns the current wall-clock time in seconds.
+   static double wallNow()
+   {
+      struct timeval tv;
+      gettimeofday(&tv, 0);
+      return tv.tv_sec + 1e-6 * tv.tv_usec;
+   }
+
+   /// Returns the CPU time used by the process in seconds.
+   static double cpuNow()
+   {
+      return (double) clock() / CLOCKS_PER_SEC;
+   }
+
+   /// Starts or resumes the timer.
+   void start()
+   {
+      if (m_running) return;
+      m_running = true;
+      m_wallStart = wallNow();
+      if (m_useCpu) m_cpuStart = cpuNow();
+   }
+
+   /// Stops the timer and adds the time since start() to the totals.
+   void stop()
+   {
+      if (!m_running) return;
+      m_running = false;
+      m_wall += wallNow() - m_wallStart;
+      if (m_useCpu) m_cpu += cpuNow() - m_cpuStart;
+   }
+
+   /// Stops the timer and sets the totals to zero.
+   void reset()
+   {
+      m_running = false;
+      m_wall = m_cpu = 0;
+   }
+
+   /// Returns the accumulated wall-clock time, including the current interval if running.
+   double wall() const
+   {
+      return m_wall + (m_running ? wallNow() - m_wallStart : 0);
+   }
+
+   /// Returns the accumulated CPU time, including the current interval if running.
+   double cpu() const
+   {
+      return m_cpu + (m_running && m_useCpu ? cpuNow() - m_cpuStart : 0);
+   }
+};
+
+//-----------------------------------------------------------------------------
+
+}
+
+#endif // CMTimer_INCLUDED
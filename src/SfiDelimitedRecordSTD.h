@@ -1,227 +1,567 @@
-// Copyright (c) 2007-2011 Jabiru Ventures LLC
-// Licensing questions should be addressed to jvlicense@jabiruventures.com
-// 
-// Permission is hereby granted, free of charge, to any person
-// obtaining a copy of this software and associated documentation
-// files (the "Software"), to deal in the Software without
-// restriction, including without limitation the rights to use,
-// copy, modify, merge, publish, distribute, sublicense, and/or sell
-// copies of the Software, and to permit persons to whom the
-// Software is furnished to do so, subject to the following
-// conditions:
-// 
-// The above copyright notice and this permission notice shall be
-// included in all copies or substantial portions of the Software.
-// 
-// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
-// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
-// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
-// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
-// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
-// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
-// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
-// OTHER DEALINGS IN THE SOFTWARE.
-//-----------------------------------------------------------------------------
-//
-// SfiDelimitedRecordSTD.h - A record consisting of string fields separated by a delimiter.
-//
-//-----------------------------------------------------------------------------
-#ifndef SfiDelimitedRecordSTD_INCLUDED
-#define SfiDelimitedRecordSTD_INCLUDED
-
-#include "SfiVectorLite.h"
-#include <string>
-
-
-//------------------------------------------------------------------------------
-//
-//   SfiDelimitedRecordSTD
-//
-//------------------------------------------------------------------------------
-/// A record consisting of string fields separated by a delimiter. The functionality
-/// is similar to the split() function in Perl or the way awk treats lines.
-
-/// There are two ways of using this class. The first makes a copy of the string.
-/// In this case, the class should be initialized with a string and the
-/// resulting fields should be accessed by the \c operator[]. The second way is to
-/// pass the line to the class as a writable buffer in the \c split function and
-/// access the resulting fields via the \c get() method. In this case, the split
-/// occurs in-place, i.e., without a copy or memory allocation, but the delimiters
-/// in the buffer are overwritten with null characters. The \c get() method
-/// should not be called after the buffer was subsequently changed by the caller.
-class SfiDelimitedRecordSTD
-{
-protected:
-   /// Buffer with a modified string for fast retrieval.
-   string m_buffer;
-   char m_delimiter;
-   SfiVectorLite<int> m_offsets;
-   SfiVectorLite<int> m_lengths;
-   char* m_sptr;
-   const char m_nullChar;
-
-public:
-   explicit SfiDelimitedRecordSTD(const char* str = 0, char delimiter = ',') : m_delimiter(delimiter), m_sptr(0), m_nullChar(0)
-   {
-      m_offsets.reserve(6);
-      m_lengths.reserve(6);
-      *this = str;
-   }
-   SfiDelimitedRecordSTD(const SfiDelimitedRecordSTD& rec) : m_nullChar(0)
-   {
-      *this = rec;
-   }
-   ~SfiDelimitedRecordSTD() {}
-
-   /// Copies all data from rec.
-   SfiDelimitedRecordSTD& operator=(const SfiDelimitedRecordSTD& rec)
-   {
-      m_buffer = rec.m_buffer;
-      m_delimiter = rec.m_delimiter;
-      m_offsets = rec.m_offsets;
-      m_lengths = rec.m_lengths;
-      m_sptr = rec.m_sptr;
-      return *this;
-   }
-
-   /// Sets the record to a new string (makes a copy).
-   /// Access to the resulting split string is via the \c operator[].
-   SfiDelimitedRecordSTD& operator=(const char* str)
-   {
-      if (str)
-      {
-         m_buffer = str;
-         split();
-      }
-      else
-      {
-         clear();
-      }
-      return *this;
-   }
-
-   /// Returns the number of fields in the record.
-   int size() const
-   {
-      return m_offsets.size();
-   }
-
-   /// Returns a pointer to the i-th field or an empty string if there are fewer than i fields.
-   const char* operator[](int i) const
-   {
-      int size = m_offsets.size();
-      if (size == 0 || i < 0 || i >= size)
-      {
-         return &m_nullChar; //m_buffer.c_str() + m_offsets[size - 1] + m_lengths[size - 1];
-      }
-      return m_buffer.c_str() + m_offsets[i];
-   }
-
-   /// Returns the length of the n-th field (zero-based) or -1 if there is no such field.
-   int length(int n) const
-   {
-      return n < m_offsets.size() ? m_lengths[n] : -1;
-   }
-
-   /// Sets the delimiter character and re-splits the string.
-   void setDelimiter(char delim)
-   {
-      m_delimiter = delim;
-   }
-
-   /// Returns the offset of the n-th field (zero-based) in the original string or -1 if there is no such field.
-   int offset(int n) const
-   {
-      return n < m_offsets.size() ? m_offsets[n] : -1;
-   }
-
-   /// Splits the \c buf in-place, overwriting delimiters with null characters.
-   /// Returns the number of fields in the \c buf. Delimiters inside double quotes are ignored.
-   /// \c n is the size of string in \c buf, excluding the terminating null.
-   /// Access to fields is provided by \c get(int).
-   int split(char* buf, int n)
-   {
-      if (!buf)
-      {
-         clear();
-         return 0;
-      }
-      // The code here is identical with that in split() except here we
-      // operate on a char* buffer, and split() operates on a std::string.
-      m_sptr = buf;
-      int start = 0;
-      int i;
-      m_offsets.clear();
-      m_lengths.clear();
-      bool insideQuotes = false;
-      for (i = 0; i < n; i++)
-      {
-         if (buf[i] == '"')
-         {
-            insideQuotes = !insideQuotes;
-         }
-         if (!insideQuotes && buf[i] == m_delimiter)
-         {
-            buf[i] = '\0';
-            m_offsets.push_back(start);
-            m_lengths.push_back(i - start);
-            start = i + 1;
-         }
-      }
-      m_offsets.push_back(start);
-      m_lengths.push_back(i - start);
-      return i ? m_offsets.size() : 0;
-   }
-
-   /// Returns a pointer to the i-th field of a split string - for use with split(char*, int) only!!!
-   /// If the index i is outside the range of valid fields, a pointer to an empty string is returned.
-   const char* get(int i) const
-   {
-      int size = m_offsets.size();
-      if (size == 0 || i < 0 || i >= size)
-      {
-         return &m_nullChar; //m_sptr + m_offsets[size - 1] + m_lengths[size - 1];
-      }
-      return m_sptr + m_offsets[i];
-   }
-
-protected:
-
-   /// Returns the number of fields in the record. Delimiters inside double quotes are ignored.
-   int split()
-   {
-      int start = 0;
-      int i, n;
-      m_offsets.clear();
-      m_lengths.clear();
-      bool insideQuotes = false;
-      for (i = 0, n = m_buffer.length(); i < n; i++)
-      {
-         if (m_buffer[i] == '"')
-         {
-            insideQuotes = !insideQuotes;
-         }
-         if (!insideQuotes && m_buffer[i] == m_delimiter)
-         {
-            m_buffer[i] = '\0';
-            m_offsets.push_back(start);
-            m_lengths.push_back(i - start);
-            start = i + 1;
-         }
-      }
-      m_offsets.push_back(start);
-      m_lengths.push_back(i - start);
-      return i ? m_offsets.size() : 0;
-   }
-
-   /// Clears the record.
-   void clear()
-   {
-      m_buffer.clear();
-      m_offsets.clear();
-      m_lengths.clear();
-      m_sptr = 0;
-   }
-};
-
-#endif
+// Copyright (c) 2007-2011 Jabiru Ventures LLC
+// Licensing questions should be addressed to jvlicense@jabiruventures.com
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+//-----------------------------------------------------------------------------
+//
+// SfiDelimitedRecordSTD.h - A record consisting of string fields separated by a delimiter.
+//
+//-----------------------------------------------------------------------------
+#ifndef SfiDelimitedRecordSTD_INCLUDED
+#define SfiDelimitedRecordSTD_INCLUDED
+
+#include "SfiVectorLite.h"
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+
+//------------------------------------------------------------------------------
+//
+//   SfiDelimitedRecordSTD
+//
+//------------------------------------------------------------------------------
+/// A record consisting of string fields separated by a delimiter. The functionality
+/// is similar to the split() function in Perl or the way awk treats lines.
+
+/// There are two ways of using this class. The first makes a copy of the string.
+/// In this case, the class should be initialized with a string and the
+/// resulting fields should be accessed by the \c operator[]. The second way is to
+/// pass the line to the class as a writable buffer in the \c split function and
+/// access the resulting fields via the \c get() method. In this case, the split
+/// occurs in-place, i.e., without a copy or memory allocation, but the delimiters
+/// in the buffer are overwritten with null characters. The \c get() method
+/// should not be called after the buffer was subsequently changed by the caller.
+///
+/// The second way can also select and reorder the fields: after \c setColumns(), field
+/// \c i of a split line is the field \c columns[i] of the line, and the line is split
+/// only up to the last selected field, so that the fields that follow are not scanned.
+///
+/// By default, a double quote only hides the delimiters that follow it up to the next quote
+/// and stays in the field. After \c setQuoted(true), \c split(char*, int) follows RFC 4180
+/// instead: see \c splitQuoted().
+///
+/// After \c setFixedWidths(), \c split(char*, int) slices the fields of a fixed-width line at
+/// the given offsets instead of looking for delimiters: see \c splitFixed().
+///
+/// \c setDelimiter(const string&) also accepts a delimiter of several characters, or an empty
+/// string for runs of spaces and tabs, which are handled by \c split(char*, int) only: see
+/// \c splitMulti().
+class SfiDelimitedRecordSTD
+{
+protected:
+   /// Buffer with a modified string for fast retrieval.
+   string m_buffer;
+   char m_delimiter;
+   /// Delimiter of more than one character, or empty.
+   string m_delimiterString;
+   /// Length of the delimiter: 1 for m_delimiter, the length of m_delimiterString, or 0 for
+   /// runs of spaces and tabs.
+   int m_delimiterLength;
+   SfiVectorLite<int> m_offsets;
+   SfiVectorLite<int> m_lengths;
+   char* m_sptr;
+   const char m_nullChar;
+   /// Flag indicating that the quoted fields are unquoted by split(char*, int).
+   bool m_quoted;
+   /// Fields of a line selected by setColumns(), empty for all fields.
+   SfiVectorLite<int> m_columns;
+   /// Number of fields of a line up to the last selected one, or 0 for all fields.
+   int m_fieldLimit;
+   /// Offsets and lengths of the fields of a line before the selection.
+   SfiVectorLite<int> m_fieldOffsets;
+   SfiVectorLite<int> m_fieldLengths;
+   /// Offsets and widths of the fixed-width fields set by setFixedWidths(), empty if delimited.
+   SfiVectorLite<int> m_fixedStarts;
+   SfiVectorLite<int> m_fixedWidths;
+   /// The null-terminated fixed-width fields of the last line split.
+   string m_fixedBuffer;
+
+public:
+   explicit SfiDelimitedRecordSTD(const char* str = 0, char delimiter = ',')
+      : m_delimiter(delimiter), m_delimiterLength(1), m_sptr(0), m_nullChar(0), m_quoted(false),
+        m_fieldLimit(0)
+   {
+      m_offsets.reserve(6);
+      m_lengths.reserve(6);
+      *this = str;
+   }
+   /// Creates a record with a delimiter as for setDelimiter(const string&).
+   SfiDelimitedRecordSTD(const char* str, const string& delimiter)
+      : m_delimiter(','), m_delimiterLength(1), m_sptr(0), m_nullChar(0), m_quoted(false),
+        m_fieldLimit(0)
+   {
+      m_offsets.reserve(6);
+      m_lengths.reserve(6);
+      setDelimiter(delimiter);
+      *this = str;
+   }
+   SfiDelimitedRecordSTD(const SfiDelimitedRecordSTD& rec)
+      : m_delimiterLength(1), m_nullChar(0), m_quoted(false), m_fieldLimit(0)
+   {
+      *this = rec;
+   }
+   ~SfiDelimitedRecordSTD() {}
+
+   /// Copies all data from rec.
+   SfiDelimitedRecordSTD& operator=(const SfiDelimitedRecordSTD& rec)
+   {
+      m_buffer = rec.m_buffer;
+      m_delimiter = rec.m_delimiter;
+      m_delimiterString = rec.m_delimiterString;
+      m_delimiterLength = rec.m_delimiterLength;
+      m_offsets = rec.m_offsets;
+      m_lengths = rec.m_lengths;
+      m_sptr = rec.m_sptr;
+      m_quoted = rec.m_quoted;
+      m_columns = rec.m_columns;
+      m_fieldLimit = rec.m_fieldLimit;
+      m_fixedStarts = rec.m_fixedStarts;
+      m_fixedWidths = rec.m_fixedWidths;
+      m_fixedBuffer = rec.m_fixedBuffer;
+      return *this;
+   }
+
+   /// Sets the record to a new string (makes a copy).
+   /// Access to the resulting split string is via the \c operator[].
+   SfiDelimitedRecordSTD& operator=(const char* str)
+   {
+      if (str)
+      {
+         m_buffer = str;
+         split();
+      }
+      else
+      {
+         clear();
+      }
+      return *this;
+   }
+
+   /// Returns the number of fields in the record.
+   int size() const
+   {
+      return m_offsets.size();
+   }
+
+   /// Returns a pointer to the i-th field or an empty string if there are fewer than i fields.
+   const char* operator[](int i) const
+   {
+      int size = m_offsets.size();
+      if (size == 0 || i < 0 || i >= size)
+      {
+         return &m_nullChar; //m_buffer.c_str() + m_offsets[size - 1] + m_lengths[size - 1];
+      }
+      return m_buffer.c_str() + m_offsets[i];
+   }
+
+   /// Returns the length of the n-th field (zero-based) or -1 if there is no such field.
+   int length(int n) const
+   {
+      return n < m_offsets.size() ? m_lengths[n] : -1;
+   }
+
+   /// Sets the delimiter character and re-splits the string.
+   void setDelimiter(char delim)
+   {
+      m_delimiter = delim;
+      m_delimiterString.clear();
+      m_delimiterLength = 1;
+   }
+
+   /// Sets the delimiter to a string of one or more characters, or to runs of spaces and tabs
+   /// if delim is empty.
+   void setDelimiter(const string& delim)
+   {
+      m_delimiter = delim.empty() ? ' ' : delim[0];
+      m_delimiterString = delim.size() > 1 ? delim : string();
+      m_delimiterLength = delim.size();
+   }
+
+   /// Returns the offset of the n-th field (zero-based) in the original string or -1 if there is no such field.
+   int offset(int n) const
+   {
+      return n < m_offsets.size() ? m_offsets[n] : -1;
+   }
+
+   /// Sets whether split(char*, int) removes the quotes of the fields as in RFC 4180.
+   void setQuoted(bool quoted)
+   {
+      m_quoted = quoted;
+   }
+
+   /// Selects the fields returned by \c get() after \c split(char*, int): field \c i of the
+   /// record is the field \c columns[i] (zero-based) of the line, or an empty string if the
+   /// line has fewer fields. An empty vector selects all fields in order.
+   void setColumns(const vector<int>& columns)
+   {
+      m_columns.clear();
+      m_fieldLimit = 0;
+      for (size_t i = 0; i < columns.size(); i++)
+      {
+         m_columns.push_back(columns[i]);
+         if (columns[i] + 1 > m_fieldLimit) m_fieldLimit = columns[i] + 1;
+      }
+   }
+
+   /// Sets fixed-width fields: field \c i of a line split by \c split(char*, int) is the
+   /// \c widths[i] bytes at offset \c starts[i] (zero-based) of the line. Empty vectors
+   /// restore the delimited fields.
+   void setFixedWidths(const vector<int>& starts, const vector<int>& widths)
+   {
+      m_fixedStarts.clear();
+      m_fixedWidths.clear();
+      size_t size = 1;
+      for (size_t i = 0; i < starts.size() && i < widths.size(); i++)
+      {
+         m_fixedStarts.push_back(starts[i]);
+         m_fixedWidths.push_back(widths[i]);
+         size += widths[i] + 1;
+      }
+      m_fixedBuffer.assign(m_fixedStarts.size() ? size : 0, '\0');
+   }
+
+   /// Splits the \c buf in-place, overwriting delimiters with null characters.
+   /// Returns the number of fields in the \c buf. Delimiters inside double quotes are ignored.
+   /// \c n is the size of string in \c buf, excluding the terminating null.
+   /// Access to fields is provided by \c get(int). If fields are selected by \c setColumns(),
+   /// returns the number of selected fields.
+   int split(char* buf, int n)
+   {
+      if (!buf)
+      {
+         clear();
+         return 0;
+      }
+      if (m_fixedStarts.size()) return splitFixed(buf, n);
+      // A line without quotes is split the same way in both modes.
+      if (m_quoted && memchr(buf, '"', n))
+      {
+         m_sptr = buf;
+         return splitQuoted(buf, n);
+      }
+      if (m_delimiterLength != 1)
+      {
+         m_sptr = buf;
+         return splitMulti(buf, n);
+      }
+      // The code here is identical with that in split() except here we
+      // operate on a char* buffer, and split() operates on a std::string.
+      m_sptr = buf;
+      int start = 0;
+      int i;
+      SfiVectorLite<int>& offsets = m_fieldLimit ? m_fieldOffsets : m_offsets;
+      SfiVectorLite<int>& lengths = m_fieldLimit ? m_fieldLengths : m_lengths;
+      offsets.clear();
+      lengths.clear();
+      bool insideQuotes = false;
+      for (i = 0; i < n; i++)
+      {
+         if (buf[i] == '"')
+         {
+            insideQuotes = !insideQuotes;
+         }
+         if (!insideQuotes && buf[i] == m_delimiter)
+         {
+            buf[i] = '\0';
+            offsets.push_back(start);
+            lengths.push_back(i - start);
+            start = i + 1;
+            if (offsets.size() == m_fieldLimit) break;
+         }
+      }
+      if (i == n)
+      {
+         offsets.push_back(start);
+         lengths.push_back(i - start);
+      }
+      if (m_fieldLimit) return select(n);
+      return i ? m_offsets.size() : 0;
+   }
+
+   /// Returns a pointer to the i-th field of a split string - for use with split(char*, int) only!!!
+   /// If the index i is outside the range of valid fields, a pointer to an empty string is returned.
+   const char* get(int i) const
+   {
+      int size = m_offsets.size();
+      if (size == 0 || i < 0 || i >= size)
+      {
+         return &m_nullChar; //m_sptr + m_offsets[size - 1] + m_lengths[size - 1];
+      }
+      return m_sptr + m_offsets[i];
+   }
+
+protected:
+
+   /// Splits buf in-place following RFC 4180: a field that starts with a double quote ends at
+   /// the next single double quote, a doubled double quote inside it stands for one, and the
+   /// delimiters and newlines inside it belong to the field. Any characters between the closing
+   /// quote and the delimiter are kept. The quotes are removed by moving the rest of the line
+   /// left within buf, and the fields that don't start with a quote are not modified until
+   /// something has been removed before them.
+   int splitQuoted(char* buf, int n)
+   {
+      SfiVectorLite<int>& offsets = m_fieldLimit ? m_fieldOffsets : m_offsets;
+      SfiVectorLite<int>& lengths = m_fieldLimit ? m_fieldLengths : m_lengths;
+      offsets.clear();
+      lengths.clear();
+      int r = m_delimiterLength ? 0 : trimBlanks(buf, n); // read position
+      int w = r; // write position, w <= r
+      while (true)
+      {
+         int start = w;
+         if (r < n && buf[r] == '"')
+         {
+            for (r++; r < n; )
+            {
+               if (buf[r] != '"') buf[w++] = buf[r++];
+               else if (r + 1 < n && buf[r + 1] == '"')
+               {
+                  buf[w++] = '"';
+                  r += 2;
+               }
+               else
+               {
+                  r++;
+                  break;
+               }
+            }
+         }
+         if (w == r)
+         {
+            r = w = findDelimiter(buf, r, n);
+         }
+         else
+         {
+            while (r < n && !delimiterAt(buf, r, n)) buf[w++] = buf[r++];
+         }
+         int dlen = r < n ? delimiterAt(buf, r, n) : 0;
+         offsets.push_back(start);
+         lengths.push_back(w - start);
+         buf[w++] = '\0';
+         if (r >= n || offsets.size() == m_fieldLimit) break;
+         r += dlen;
+      }
+      if (m_fieldLimit) return select(n);
+      return m_offsets.size();
+   }
+
+   /// Splits buf in-place like split(char*, int) for a delimiter other than a single character.
+   /// The first character of the delimiter is searched for with findDelimiter(), and the rest
+   /// is only compared where it is found, so that the line is scanned about as fast as for a
+   /// single character. A double quote hides the delimiters up to the next one, as in split(),
+   /// but only the lines that have quotes are scanned a character at a time. With runs of
+   /// spaces and tabs, those at the beginning and the end of the line don't delimit fields.
+   int splitMulti(char* buf, int n)
+   {
+      SfiVectorLite<int>& offsets = m_fieldLimit ? m_fieldOffsets : m_offsets;
+      SfiVectorLite<int>& lengths = m_fieldLimit ? m_fieldLengths : m_lengths;
+      offsets.clear();
+      lengths.clear();
+      int start = m_delimiterLength ? 0 : trimBlanks(buf, n);
+      bool quotes = memchr(buf + start, '"', n - start) != 0;
+      bool insideQuotes = false;
+      int i = start;
+      while (true)
+      {
+         if (!quotes) i = findDelimiter(buf, i, n);
+         else
+         {
+            for (; i < n; i++)
+            {
+               if (buf[i] == '"') insideQuotes = !insideQuotes;
+               else if (!insideQuotes && delimiterAt(buf, i, n)) break;
+            }
+         }
+         offsets.push_back(start);
+         lengths.push_back(i - start);
+         if (i >= n || offsets.size() == m_fieldLimit) break;
+         start = i + delimiterAt(buf, i, n);
+         buf[i] = '\0';
+         i = start;
+      }
+      if (m_fieldLimit) return select(n);
+      return n ? m_offsets.size() : 0;
+   }
+
+   /// Returns true for the characters of the runs of blanks delimiter.
+   static bool isBlank(char c)
+   {
+      return c == ' ' || c == '\t';
+   }
+
+   /// Removes the spaces and tabs at the end of buf of length n, which is updated, and returns
+   /// the offset of the first character that is not a space or a tab.
+   static int trimBlanks(char* buf, int& n)
+   {
+      while (n > 0 && isBlank(buf[n - 1])) buf[--n] = '\0';
+      int start = 0;
+      while (start < n && isBlank(buf[start])) start++;
+      return start;
+   }
+
+   /// Returns the length of the delimiter at offset i of buf of length n, or 0 if there's none.
+   int delimiterAt(const char* buf, int i, int n) const
+   {
+      if (m_delimiterLength == 1) return buf[i] == m_delimiter;
+      if (m_delimiterLength == 0)
+      {
+         int j = i;
+         while (j < n && isBlank(buf[j])) j++;
+         return j - i;
+      }
+      return i + m_delimiterLength <= n &&
+         memcmp(buf + i, m_delimiterString.data(), m_delimiterLength) == 0 ? m_delimiterLength : 0;
+   }
+
+   /// Returns the offset of the first delimiter at or after offset i of buf of length n, or n,
+   /// regardless of quotes. The first character of the delimiter is found by memchr, which is
+   /// vectorized by the C library, and runs of blanks by findBlank().
+   int findDelimiter(const char* buf, int i, int n) const
+   {
+      if (m_delimiterLength == 0) return findBlank(buf, i, n);
+      while (i < n)
+      {
+         const char* d = (const char*) memchr(buf + i, m_delimiter, n - i);
+         if (d == 0) return n;
+         i = d - buf;
+         if (m_delimiterLength == 1 || delimiterAt(buf, i, n)) return i;
+         i++;
+      }
+      return n;
+   }
+
+   /// Returns the offset of the first space or tab at or after offset i of buf of length n, or n.
+   /// Eight characters at a time are tested for any character below '!' with a few integer
+   /// operations, and only the words that have one are searched a character at a time.
+   static int findBlank(const char* buf, int i, int n)
+   {
+      const uint64_t ones = 0x0101010101010101ULL;
+      const uint64_t highs = ones * 0x80;
+      while (i + 8 <= n)
+      {
+         uint64_t x;
+         memcpy(&x, buf + i, 8);
+         if (((x - ones * '!') & ~x & highs) == 0)
+         {
+            i += 8;
+            continue;
+         }
+         for (int e = i + 8; i < e; i++)
+         {
+            if (isBlank(buf[i])) return i;
+         }
+      }
+      for (; i < n; i++)
+      {
+         if (isBlank(buf[i])) return i;
+      }
+      return n;
+   }
+
+   /// Splits the fixed-width line buf of length n. A field is the bytes at its offset and
+   /// width, without the leading and trailing spaces, and is empty if the line is too short.
+   /// As there are no delimiters to overwrite, the fields are copied into m_fixedBuffer, each
+   /// followed by a null; the offsets are the same for every line, so no characters are
+   /// scanned other than the padding.
+   int splitFixed(const char* buf, int n)
+   {
+      SfiVectorLite<int>& offsets = m_fieldLimit ? m_fieldOffsets : m_offsets;
+      SfiVectorLite<int>& lengths = m_fieldLimit ? m_fieldLengths : m_lengths;
+      offsets.clear();
+      lengths.clear();
+      char* out = &m_fixedBuffer[0];
+      int w = 0;
+      for (int i = 0, nf = m_fixedStarts.size(); i < nf; i++)
+      {
+         int start = m_fixedStarts[i];
+         int end = start + m_fixedWidths[i];
+         if (end > n) end = n;
+         while (start < end && buf[start] == ' ') start++;
+         while (end > start && buf[end - 1] == ' ') end--;
+         int len = end > start ? end - start : 0;
+         memcpy(out + w, buf + start, len);
+         offsets.push_back(w);
+         lengths.push_back(len);
+         w += len;
+         out[w++] = '\0';
+         if (offsets.size() == m_fieldLimit) break;
+      }
+      out[w] = '\0';
+      m_sptr = out;
+      if (m_fieldLimit) return select(w);
+      return m_offsets.size();
+   }
+
+   /// Stores the offsets and lengths of the fields selected by setColumns() from those of the
+   /// split line of length n. A missing field points to the terminating null of the line.
+   int select(int n)
+   {
+      m_offsets.clear();
+      m_lengths.clear();
+      for (int i = 0, nsel = m_columns.size(), nf = m_fieldOffsets.size(); i < nsel; i++)
+      {
+         int j = m_columns[i];
+         m_offsets.push_back(j < nf ? m_fieldOffsets[j] : n);
+         m_lengths.push_back(j < nf ? m_fieldLengths[j] : 0);
+      }
+      return m_offsets.size();
+   }
+
+   /// Returns the number of fields in the record. Delimiters inside double quotes are ignored.
+   int split()
+   {
+      int start = 0;
+      int i, n;
+      m_offsets.clear();
+      m_lengths.clear();
+      bool insideQuotes = false;
+      for (i = 0, n = m_buffer.length(); i < n; i++)
+      {
+         if (m_buffer[i] == '"')
+         {
+            insideQuotes = !insideQuotes;
+         }
+         if (!insideQuotes && m_buffer[i] == m_delimiter)
+         {
+            m_buffer[i] = '\0';
+            m_offsets.push_back(start);
+            m_lengths.push_back(i - start);
+            start = i + 1;
+         }
+      }
+      m_offsets.push_back(start);
+      m_lengths.push_back(i - start);
+      return i ? m_offsets.size() : 0;
+   }
+
+   /// Clears the record.
+   void clear()
+   {
+      m_buffer.clear();
+      m_offsets.clear();
+      m_lengths.clear();
+      m_sptr = 0;
+   }
+};
+
+#endif
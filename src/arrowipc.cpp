@@ -0,0 +1,942 @@
+//-------------------------------------------------------------------------------
+//
+// Package csvread
+//
+// R interface for writing and reading data frames as Arrow IPC (Feather v2) files.
+//
+// Sergei Izrailev, 2011-2014
+//-------------------------------------------------------------------------------
+// Copyright 2011-2014 Collective, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//-------------------------------------------------------------------------------
+
+#include <string>
+#include <vector>
+#include <map>
+#include <sstream>
+
+using namespace std;
+
+#include "CMArrowIPC.h"
+#include "int64.h"
+
+#include <R.h>
+#include <Rinternals.h>
+
+//-----------------------------------------------------------------------------
+
+using namespace cm;
+
+namespace
+{
+
+//-----------------------------------------------------------------------------
+
+/// Key of the field metadata recording the R class of a 64-bit integer column.
+const char* const CM_ARROW_CLASS_KEY = "csvread.class";
+/// Key of the field metadata recording the \c base attribute of an int64 column.
+const char* const CM_ARROW_BASE_KEY = "csvread.base";
+
+/// Layout of a column in the Arrow file.
+enum CMArrowColumnKind { ArrowInt32, ArrowDouble, ArrowInt64, ArrowDictionary, ArrowUtf8 };
+
+/// A column of the data frame being written and the buffers that make up its data.
+struct CMArrowColumn
+{
+   string name;
+   CMArrowColumnKind kind;
+   bool ordered;                      ///< Ordered factor.
+   vector<pair<string, string> > metadata;
+   int nullCount;
+   vector<uint8_t> validity;          ///< Empty if there are no nulls.
+   const void* values;                ///< Column values, usually the R vector itself.
+   int64_t valuesSize;
+   vector<int32_t> indices;           ///< Dictionary indices, if they can't come from R directly.
+   vector<int32_t> dictOffsets;       ///< Dictionary string offsets.
+   string dictData;                   ///< Dictionary string bytes.
+};
+
+//-----------------------------------------------------------------------------
+
+/// Marks element i as null in a validity bitmap, allocating the bitmap on first use.
+inline void cmArrowSetNull(CMArrowColumn& col, int n, int i)
+{
+   if (col.validity.empty()) col.validity.assign((n + 7) / 8, 0xFF);
+   col.validity[i >> 3] &= (uint8_t) ~(1 << (i & 7));
+   col.nullCount++;
+}
+
+/// Appends a dictionary entry.
+inline void cmArrowAddDictEntry(CMArrowColumn& col, const char* s)
+{
+   if (col.dictOffsets.empty()) col.dictOffsets.push_back(0);
+   col.dictData.append(s);
+   col.dictOffsets.push_back((int32_t) col.dictData.size());
+}
+
+/// Dictionary-encodes a character vector. CHARSXPs are cached by R, so equal strings
+/// are (almost always) the same pointer and can be hashed by address.
+void cmArrowEncodeStrings(SEXP x, int n, CMArrowColumn& col)
+{
+   col.indices.resize(n);
+   size_t cap = 1024;
+   while (cap < 2 * (size_t) n && cap < ((size_t) 1 << 30)) cap *= 2;
+   vector<SEXP> keys(cap, (SEXP) 0);
+   vector<int32_t> vals(cap, 0);
+   size_t mask = cap - 1;
+   int ndict = 0;
+   for (int i = 0; i < n; i++)
+   {
+      SEXP s = STRING_ELT(x, i);
+      if (s == NA_STRING)
+      {
+         col.indices[i] = 0;
+         cmArrowSetNull(col, n, i);
+         continue;
+      }
+      size_t h = (((size_t) s) >> 4) * (size_t) 0x9E3779B97F4A7C15ULL;
+      size_t k = (h >> 7) & mask;
+      while (keys[k] != 0 && keys[k] != s) k = (k + 1) & mask;
+      if (keys[k] == 0)
+      {
+         keys[k] = s;
+         vals[k] = ndict++;
+         cmArrowAddDictEntry(col, translateCharUTF8(s));
+      }
+      col.indices[i] = vals[k];
+   }
+   col.values = col.indices.empty() ? 0 : &col.indices[0];
+   col.valuesSize = 4 * (int64_t) n;
+}
+
+/// Describes column j of the frame for writing. Returns false if the type is unsupported.
+bool cmArrowDescribeColumn(SEXP x, int n, CMArrowColumn& col)
+{
+   col.nullCount = 0;
+   col.ordered = false;
+   col.values = 0;
+   col.valuesSize = 0;
+   if (isFactor(x))
+   {
+      col.kind = ArrowDictionary;
+      col.ordered = inherits(x, "ordered");
+      SEXP levels = getAttrib(x, R_LevelsSymbol);
+      for (int k = 0, nl = length(levels); k < nl; k++)
+      {
+         cmArrowAddDictEntry(col, translateCharUTF8(STRING_ELT(levels, k)));
+      }
+      const int* codes = INTEGER(x);
+      col.indices.resize(n);
+      for (int i = 0; i < n; i++)
+      {
+         if (codes[i] == NA_INTEGER)
+         {
+            col.indices[i] = 0;
+            cmArrowSetNull(col, n, i);
+         }
+         else
+         {
+            col.indices[i] = codes[i] - 1;
+         }
+      }
+      col.values = col.indices.empty() ? 0 : &col.indices[0];
+      col.valuesSize = 4 * (int64_t) n;
+      return true;
+   }
+   switch (TYPEOF(x))
+   {
+   case INTSXP:
+   {
+      col.kind = ArrowInt32;
+      const int* v = INTEGER(x);
+      for (int i = 0; i < n; i++)
+      {
+         if (v[i] == NA_INTEGER) cmArrowSetNull(col, n, i);
+      }
+      // values are streamed from the R vector
+      col.values = v;
+      col.valuesSize = 4 * (int64_t) n;
+      return true;
+   }
+   case REALSXP:
+   {
+      const double* v = REAL(x);
+      if (inherits(x, "int64") || inherits(x, "integer64"))
+      {
+         col.kind = ArrowInt64;
+         col.metadata.push_back(make_pair(string(CM_ARROW_CLASS_KEY),
+            string(inherits(x, "int64") ? "int64" : "integer64")));
+         SEXP rb = getAttrib(x, install("base"));
+         if (rb != R_NilValue)
+         {
+            stringstream ss;
+            ss << (int) *(INTEGER(coerceVector(rb, INTSXP)));
+            col.metadata.push_back(make_pair(string(CM_ARROW_BASE_KEY), ss.str()));
+         }
+         for (int i = 0; i < n; i++)
+         {
+            CMInt64 xi;
+            memcpy(&xi, &(v[i]), sizeof(CMInt64));
+            if (xi == NA_LONG.L) cmArrowSetNull(col, n, i);
+         }
+      }
+      else
+      {
+         col.kind = ArrowDouble;
+         for (int i = 0; i < n; i++)
+         {
+            if (ISNA(v[i])) cmArrowSetNull(col, n, i);
+         }
+      }
+      col.values = v;
+      col.valuesSize = 8 * (int64_t) n;
+      return true;
+   }
+   case STRSXP:
+      col.kind = ArrowDictionary;
+      cmArrowEncodeStrings(x, n, col);
+      return true;
+   default:
+      return false;
+   }
+}
+
+//-----------------------------------------------------------------------------
+
+/// Builds an Int type table.
+CMFlatNode* cmArrowIntType(CMFlatBuilder& fb, int bitWidth)
+{
+   CMFlatNode* t = fb.table();
+   fb.addInt32(t, CMArrow::IntBitWidth, bitWidth);
+   fb.addBool(t, CMArrow::IntIsSigned, true);
+   return t;
+}
+
+/// Builds the Schema table for the columns.
+CMFlatNode* cmArrowSchema(CMFlatBuilder& fb, const vector<CMArrowColumn>& cols)
+{
+   vector<CMFlatNode*> fields;
+   for (size_t j = 0; j < cols.size(); j++)
+   {
+      const CMArrowColumn& col = cols[j];
+      CMFlatNode* f = fb.table();
+      fb.addChild(f, CMArrow::FieldName, fb.str(col.name));
+      fb.addBool(f, CMArrow::FieldNullable, true);
+      switch (col.kind)
+      {
+      case ArrowInt32:
+         fb.addUInt8(f, CMArrow::FieldTypeType, CMArrow::TypeInt);
+         fb.addChild(f, CMArrow::FieldType, cmArrowIntType(fb, 32));
+         break;
+      case ArrowInt64:
+         fb.addUInt8(f, CMArrow::FieldTypeType, CMArrow::TypeInt);
+         fb.addChild(f, CMArrow::FieldType, cmArrowIntType(fb, 64));
+         break;
+      case ArrowDouble:
+      {
+         CMFlatNode* t = fb.table();
+         fb.addInt16(t, CMArrow::FloatingPointPrecision, CMArrow::PrecisionDouble);
+         fb.addUInt8(f, CMArrow::FieldTypeType, CMArrow::TypeFloatingPoint);
+         fb.addChild(f, CMArrow::FieldType, t);
+         break;
+      }
+      case ArrowDictionary:
+      case ArrowUtf8:
+      {
+         fb.addUInt8(f, CMArrow::FieldTypeType, CMArrow::TypeUtf8);
+         fb.addChild(f, CMArrow::FieldType, fb.table());
+         CMFlatNode* d = fb.table();
+         fb.addInt64(d, CMArrow::DictionaryId, (int64_t) j);
+         fb.addChild(d, CMArrow::DictionaryIndexType, cmArrowIntType(fb, 32));
+         fb.addBool(d, CMArrow::DictionaryIsOrdered, col.ordered);
+         fb.addChild(f, CMArrow::FieldDictionary, d);
+         break;
+      }
+      }
+      // Arrow readers expect the children vector even for primitive types.
+      fb.addChild(f, CMArrow::FieldChildren, fb.tableVector(vector<CMFlatNode*>()));
+      if (!col.metadata.empty())
+      {
+         vector<CMFlatNode*> kvs;
+         for (size_t k = 0; k < col.metadata.size(); k++)
+         {
+            CMFlatNode* kv = fb.table();
+            fb.addChild(kv, CMArrow::KeyValueKey, fb.str(col.metadata[k].first));
+            fb.addChild(kv, CMArrow::KeyValueValue, fb.str(col.metadata[k].second));
+            kvs.push_back(kv);
+         }
+         fb.addChild(f, CMArrow::FieldCustomMetadata, fb.tableVector(kvs));
+      }
+      fields.push_back(f);
+   }
+   CMFlatNode* schema = fb.table();
+   fb.addInt16(schema, CMArrow::SchemaEndianness, 0);
+   fb.addChild(schema, CMArrow::SchemaFields, fb.tableVector(fields));
+   return schema;
+}
+
+/// Builds a RecordBatch table of \c length rows with the given field nodes and body parts.
+CMFlatNode* cmArrowRecordBatch(CMFlatBuilder& fb, int64_t length, const string& nodes, int nnodes,
+   const vector<CMArrowBodyPart>& parts, int64_t* bodyLength)
+{
+   CMFlatNode* rb = fb.table();
+   fb.addInt64(rb, CMArrow::RecordBatchLength, length);
+   fb.addChild(rb, CMArrow::RecordBatchNodes, fb.structVector(nodes, nnodes));
+   fb.addChild(rb, CMArrow::RecordBatchBuffers,
+      fb.structVector(CMArrowWriter::bufferLayout(parts, bodyLength), (int) parts.size()));
+   return rb;
+}
+
+/// Wraps a message header into a Message flatbuffer.
+string cmArrowMessage(CMFlatBuilder& fb, int headerType, CMFlatNode* header, int64_t bodyLength)
+{
+   CMFlatNode* msg = fb.table();
+   fb.addInt16(msg, CMArrow::MessageVersion, CMArrow::V5);
+   fb.addUInt8(msg, CMArrow::MessageHeaderType, headerType);
+   fb.addChild(msg, CMArrow::MessageHeaderValue, header);
+   fb.addInt64(msg, CMArrow::MessageBodyLength, bodyLength);
+   return fb.finish(msg);
+}
+
+/// Packs a FieldNode struct.
+void cmArrowAddFieldNode(string& nodes, int64_t length, int64_t nullCount)
+{
+   int64_t fn[2] = { length, nullCount };
+   nodes.append((const char*) fn, sizeof(fn));
+}
+
+/// Adds a body part.
+void cmArrowAddPart(vector<CMArrowBodyPart>& parts, const void* data, int64_t size)
+{
+   CMArrowBodyPart p;
+   p.data = data;
+   p.size = size;
+   parts.push_back(p);
+}
+
+//-----------------------------------------------------------------------------
+
+/// Writes the frame; returns false and fills err on failure.
+bool cmArrowWriteFrame(SEXP rframe, const char* filename, char* err, size_t errsz)
+{
+   int ncols = length(rframe);
+   int n = ncols > 0 ? length(VECTOR_ELT(rframe, 0)) : 0;
+   SEXP names = getAttrib(rframe, R_NamesSymbol);
+
+   vector<CMArrowColumn> cols(ncols);
+   for (int j = 0; j < ncols; j++)
+   {
+      SEXP x = VECTOR_ELT(rframe, j);
+      if (length(x) != n)
+      {
+         snprintf(err, errsz, "column %d has %d elements instead of %d", j + 1, length(x), n);
+         return false;
+      }
+      cols[j].name = names == R_NilValue ? string() : translateCharUTF8(STRING_ELT(names, j));
+      if (!cmArrowDescribeColumn(x, n, cols[j]))
+      {
+         snprintf(err, errsz, "unsupported type of column '%s'", cols[j].name.c_str());
+         return false;
+      }
+      if (cols[j].dictData.size() > (size_t) INT_MAX)
+      {
+         snprintf(err, errsz, "dictionary of column '%s' exceeds 2GB", cols[j].name.c_str());
+         return false;
+      }
+   }
+
+   CMArrowWriter writer;
+   if (!writer.open(filename))
+   {
+      snprintf(err, errsz, "can't open file %s", filename);
+      return false;
+   }
+
+   // Schema
+
+   {
+      CMFlatBuilder fb;
+      writer.writeMessage(cmArrowMessage(fb, CMArrow::HeaderSchema, cmArrowSchema(fb, cols), 0),
+         vector<CMArrowBodyPart>());
+   }
+
+   // Dictionaries, one per string or factor column, with the column index as the id.
+
+   vector<CMArrowBlock> dictBlocks;
+   for (int j = 0; j < ncols; j++)
+   {
+      if (cols[j].kind != ArrowDictionary) continue;
+      if (cols[j].dictOffsets.empty()) cols[j].dictOffsets.push_back(0);
+      int ndict = (int) cols[j].dictOffsets.size() - 1;
+      string nodes;
+      cmArrowAddFieldNode(nodes, ndict, 0);
+      vector<CMArrowBodyPart> parts;
+      cmArrowAddPart(parts, 0, 0);
+      cmArrowAddPart(parts, &cols[j].dictOffsets[0], 4 * (int64_t) (ndict + 1));
+      cmArrowAddPart(parts, cols[j].dictData.data(), cols[j].dictData.size());
+
+      CMFlatBuilder fb;
+      int64_t bodyLength;
+      CMFlatNode* data = cmArrowRecordBatch(fb, ndict, nodes, 1, parts, &bodyLength);
+      CMFlatNode* db = fb.table();
+      fb.addInt64(db, CMArrow::DictionaryBatchId, (int64_t) j);
+      fb.addChild(db, CMArrow::DictionaryBatchData, data);
+      dictBlocks.push_back(writer.writeMessage(
+         cmArrowMessage(fb, CMArrow::HeaderDictionaryBatch, db, bodyLength), parts));
+   }
+
+   // A single record batch: a validity and a values buffer per column.
+
+   vector<CMArrowBlock> batchBlocks;
+   {
+      string nodes;
+      vector<CMArrowBodyPart> parts;
+      for (int j = 0; j < ncols; j++)
+      {
+         cmArrowAddFieldNode(nodes, n, cols[j].nullCount);
+         if (cols[j].nullCount > 0) cmArrowAddPart(parts, &cols[j].validity[0], cols[j].validity.size());
+         else cmArrowAddPart(parts, 0, 0);
+         cmArrowAddPart(parts, cols[j].values, cols[j].valuesSize);
+      }
+      CMFlatBuilder fb;
+      int64_t bodyLength;
+      CMFlatNode* rb = cmArrowRecordBatch(fb, n, nodes, ncols, parts, &bodyLength);
+      batchBlocks.push_back(writer.writeMessage(
+         cmArrowMessage(fb, CMArrow::HeaderRecordBatch, rb, bodyLength), parts));
+   }
+
+   // Footer
+
+   {
+      CMFlatBuilder fb;
+      CMFlatNode* footer = fb.table();
+      fb.addInt16(footer, CMArrow::FooterVersion, CMArrow::V5);
+      fb.addChild(footer, CMArrow::FooterSchema, cmArrowSchema(fb, cols));
+      fb.addChild(footer, CMArrow::FooterDictionaries,
+         fb.structVector(CMArrowWriter::blockLayout(dictBlocks), (int) dictBlocks.size()));
+      fb.addChild(footer, CMArrow::FooterRecordBatches,
+         fb.structVector(CMArrowWriter::blockLayout(batchBlocks), (int) batchBlocks.size()));
+      writer.writeFooter(fb.finish(footer));
+   }
+
+   if (!writer.good())
+   {
+      snprintf(err, errsz, "failed writing to file %s", filename);
+      return false;
+   }
+   return true;
+}
+
+//-----------------------------------------------------------------------------
+
+/// A field of the schema of a file being read.
+struct CMArrowField
+{
+   string name;
+   CMArrowColumnKind kind;
+   int64_t dictId;
+   int indexWidth;          ///< Dictionary index width in bytes.
+   string rclass;           ///< R class from the field metadata.
+   int base;                ///< Base from the field metadata or 0.
+};
+
+/// Returns the block of the i-th struct of the footer field.
+CMArrowBlock cmArrowFooterBlock(const CMFlatTable& footer, int field, int i)
+{
+   CMArrowBlock b;
+   b.offset = footer.vectorStruct<int64_t>(field, i, CMArrow::BlockSize, 0);
+   b.metaDataLength = footer.vectorStruct<int32_t>(field, i, CMArrow::BlockSize, 8);
+   b.bodyLength = footer.vectorStruct<int64_t>(field, i, CMArrow::BlockSize, 16);
+   return b;
+}
+
+/// Parses the schema fields; returns false and fills err if a type is unsupported.
+bool cmArrowReadSchema(const CMFlatTable& schema, vector<CMArrowField>& fields, char* err, size_t errsz)
+{
+   if (!schema.valid() || schema.scalar<int16_t>(CMArrow::SchemaEndianness) != 0)
+   {
+      snprintf(err, errsz, "missing schema or big-endian data");
+      return false;
+   }
+   int nf = schema.vectorSize(CMArrow::SchemaFields);
+   fields.resize(nf);
+   for (int j = 0; j < nf; j++)
+   {
+      CMFlatTable f = schema.vectorTable(CMArrow::SchemaFields, j);
+      CMArrowField& fld = fields[j];
+      fld.name = f.str(CMArrow::FieldName);
+      fld.dictId = -1;
+      fld.indexWidth = 0;
+      fld.base = 0;
+
+      int typeType = f.scalar<uint8_t>(CMArrow::FieldTypeType);
+      CMFlatTable type = f.table(CMArrow::FieldType);
+      bool ok = false;
+      if (typeType == CMArrow::TypeInt && type.scalar<uint8_t>(CMArrow::IntIsSigned))
+      {
+         int bw = type.scalar<int32_t>(CMArrow::IntBitWidth);
+         if (bw == 32) { fld.kind = ArrowInt32; ok = true; }
+         if (bw == 64) { fld.kind = ArrowInt64; ok = true; }
+      }
+      else if (typeType == CMArrow::TypeFloatingPoint)
+      {
+         fld.kind = ArrowDouble;
+         ok = type.scalar<int16_t>(CMArrow::FloatingPointPrecision) == CMArrow::PrecisionDouble;
+      }
+      else if (typeType == CMArrow::TypeUtf8)
+      {
+         fld.kind = ArrowUtf8;
+         ok = true;
+      }
+      CMFlatTable dict = f.table(CMArrow::FieldDictionary);
+      if (ok && dict.valid())
+      {
+         CMFlatTable it = dict.table(CMArrow::DictionaryIndexType);
+         int bw = it.valid() ? it.scalar<int32_t>(CMArrow::IntBitWidth) : 32;
+         ok = fld.kind == ArrowUtf8 && (bw == 8 || bw == 16 || bw == 32 || bw == 64);
+         fld.kind = ArrowDictionary;
+         fld.dictId = dict.scalar<int64_t>(CMArrow::DictionaryId);
+         fld.indexWidth = bw / 8;
+      }
+      if (!ok)
+      {
+         snprintf(err, errsz, "unsupported type of column '%s'", fld.name.c_str());
+         return false;
+      }
+      for (int k = 0, nk = f.vectorSize(CMArrow::FieldCustomMetadata); k < nk; k++)
+      {
+         CMFlatTable kv = f.vectorTable(CMArrow::FieldCustomMetadata, k);
+         string key = kv.str(CMArrow::KeyValueKey);
+         if (key == CM_ARROW_CLASS_KEY) fld.rclass = kv.str(CMArrow::KeyValueValue);
+         if (key == CM_ARROW_BASE_KEY) fld.base = atoi(kv.str(CMArrow::KeyValueValue).c_str());
+      }
+   }
+   return true;
+}
+
+/// State of a read that must be released if R raises an error. An R allocation failure
+/// longjmps over C++ destructors, so the state is owned by an external pointer whose
+/// finalizer deletes it, and the scratch buffers of the columns are kept here as well.
+struct CMArrowReadState
+{
+   CMArrowReader reader;
+   vector<CMArrowField> fields;
+   map<int64_t, int> dictSlot;        ///< Dictionary id to its slot in the list of dictionaries.
+   string dictMetadata;               ///< Metadata of the current dictionary batch.
+   vector<string> metadata;           ///< Metadata of the record batches.
+   vector<CMFlatTable> batches;
+   vector<CMArrowBlock> blocks;
+   vector<int32_t> offsets;           ///< String offsets of a column of a batch.
+   string data;                       ///< String bytes or dictionary indices of a column.
+   vector<uint8_t> bits;              ///< Validity bitmap of a column.
+};
+
+/// Finalizer of the external pointer to the read state; also called by readArrow.
+void cmArrowFinalizeState(SEXP rstate)
+{
+   CMArrowReadState* st = (CMArrowReadState*) R_ExternalPtrAddr(rstate);
+   if (st == 0) return;
+   delete st;
+   R_ClearExternalPtr(rstate);
+}
+
+/// Reads the message at the block and returns its header of the expected type.
+bool cmArrowReadHeader(CMArrowReader& reader, const CMArrowBlock& block, int headerType,
+   string& metadata, bool* bad, CMFlatTable& header)
+{
+   // the body must be within the file, which bounds the buffers allocated for it
+   if (block.offset < 0 || block.metaDataLength < 0 || block.bodyLength < 0 ||
+       block.offset > reader.size() - block.metaDataLength ||
+       block.bodyLength > reader.size() - block.offset - block.metaDataLength) return false;
+   if (!reader.readMessage(block, metadata)) return false;
+   CMFlatTable msg = CMFlatTable::root(metadata.data(), metadata.size(), bad);
+   if (msg.scalar<uint8_t>(CMArrow::MessageHeaderType) != headerType) return false;
+   header = msg.table(CMArrow::MessageHeaderValue);
+   return header.valid() && !header.has(CMArrow::RecordBatchCompression);
+}
+
+/// Returns true if buffer ibuf of the record batch has at least minSize bytes within the
+/// message body.
+bool cmArrowBufferFits(const CMArrowBlock& block, const CMFlatTable& rb, int ibuf, int64_t minSize)
+{
+   int64_t off = rb.vectorStruct<int64_t>(CMArrow::RecordBatchBuffers, ibuf, CMArrow::BufferSize, 0);
+   int64_t len = rb.vectorStruct<int64_t>(CMArrow::RecordBatchBuffers, ibuf, CMArrow::BufferSize, 8);
+   return ibuf < rb.vectorSize(CMArrow::RecordBatchBuffers) && minSize >= 0 && len >= minSize &&
+      off >= 0 && off <= block.bodyLength && minSize <= block.bodyLength - off;
+}
+
+/// Reads a buffer of the record batch; returns false if it does not fit the message body.
+bool cmArrowReadBuffer(CMArrowReader& reader, const CMArrowBlock& block, const CMFlatTable& rb,
+   int ibuf, int64_t minSize, void* dest)
+{
+   if (!cmArrowBufferFits(block, rb, ibuf, minSize)) return false;
+   int64_t off = rb.vectorStruct<int64_t>(CMArrow::RecordBatchBuffers, ibuf, CMArrow::BufferSize, 0);
+   return reader.read(block.offset + block.metaDataLength + off, dest, minSize);
+}
+
+/// Returns the length in bytes of buffer ibuf.
+int64_t cmArrowBufferLength(const CMFlatTable& rb, int ibuf)
+{
+   return rb.vectorStruct<int64_t>(CMArrow::RecordBatchBuffers, ibuf, CMArrow::BufferSize, 8);
+}
+
+/// Returns the i-th dictionary index of the given width.
+inline int64_t cmArrowIndex(const char* p, int width, int i)
+{
+   switch (width)
+   {
+   case 1: return *((const int8_t*) p + i);
+   case 2: { int16_t v; memcpy(&v, p + 2 * i, 2); return v; }
+   case 4: { int32_t v; memcpy(&v, p + 4 * i, 4); return v; }
+   default: { int64_t v; memcpy(&v, p + 8 * i, 8); return v; }
+   }
+}
+
+/// Reads the strings of a Utf8 array with buffers starting at ibuf into x[row0...].
+bool cmArrowReadStrings(CMArrowReadState& st, const CMArrowBlock& block, const CMFlatTable& rb,
+   int ibuf, int len, SEXP x, int row0)
+{
+   int64_t osize = 4 * ((int64_t) len + 1);
+   if (len < 0 || !cmArrowBufferFits(block, rb, ibuf, osize)) return false;
+   st.offsets.resize((size_t) len + 1);
+   if (!cmArrowReadBuffer(st.reader, block, rb, ibuf, osize, &st.offsets[0])) return false;
+   const vector<int32_t>& offsets = st.offsets;
+   int64_t dlen = cmArrowBufferLength(rb, ibuf + 1);
+   if (offsets[0] < 0 || offsets[len] > dlen || !cmArrowBufferFits(block, rb, ibuf + 1, dlen)) return false;
+   st.data.resize(dlen);
+   if (dlen > 0 && !cmArrowReadBuffer(st.reader, block, rb, ibuf + 1, dlen, &st.data[0])) return false;
+   for (int i = 0; i < len; i++)
+   {
+      if (offsets[i + 1] < offsets[i] || offsets[i + 1] > offsets[len]) return false;
+      SET_STRING_ELT(x, row0 + i,
+         mkCharLenCE(st.data.data() + offsets[i], offsets[i + 1] - offsets[i], CE_UTF8));
+   }
+   return true;
+}
+
+/// Sets the elements of x[row0...] that are null in the validity buffer ibuf to NA.
+bool cmArrowApplyValidity(CMArrowReadState& st, const CMArrowBlock& block, const CMFlatTable& rb,
+   int inode, int ibuf, int len, CMArrowColumnKind kind, SEXP x, int row0)
+{
+   int64_t nulls = rb.vectorStruct<int64_t>(CMArrow::RecordBatchNodes, inode, CMArrow::FieldNodeSize, 8);
+   if (nulls == 0 || cmArrowBufferLength(rb, ibuf) == 0) return true;
+   int64_t nbytes = ((int64_t) len + 7) / 8;
+   if (!cmArrowBufferFits(block, rb, ibuf, nbytes)) return false;
+   st.bits.resize(nbytes);
+   if (nbytes > 0 && !cmArrowReadBuffer(st.reader, block, rb, ibuf, nbytes, &st.bits[0])) return false;
+   for (int i = 0; i < len; i++)
+   {
+      if (st.bits[i >> 3] & (1 << (i & 7))) continue;
+      switch (kind)
+      {
+      case ArrowInt32: INTEGER(x)[row0 + i] = NA_INTEGER; break;
+      case ArrowDouble: REAL(x)[row0 + i] = NA_REAL; break;
+      case ArrowInt64: REAL(x)[row0 + i] = NA_LONG.D; break;
+      default: SET_STRING_ELT(x, row0 + i, NA_STRING); break;
+      }
+   }
+   return true;
+}
+
+/// Reads the file into a data frame; returns R_NilValue and fills err on failure. The
+/// C++ objects used for reading are kept in st.
+SEXP cmArrowReadFrame(CMArrowReadState& st, const char* filename, const char* int64class,
+   char* err, size_t errsz)
+{
+   CMArrowReader& reader = st.reader;
+   if (!reader.open(filename))
+   {
+      snprintf(err, errsz, "can't open file %s or it is not an Arrow IPC file", filename);
+      return R_NilValue;
+   }
+   bool bad = false;
+   CMFlatTable footer = reader.footer();
+   vector<CMArrowField>& fields = st.fields;
+   if (!cmArrowReadSchema(footer.table(CMArrow::FooterSchema), fields, err, errsz)) return R_NilValue;
+   int ncols = (int) fields.size();
+   int nprotect = 0;
+
+   // Dictionaries: a character vector per dictionary id, kept in a protected list.
+
+   map<int64_t, int>& dictSlot = st.dictSlot;
+   int ndicts = footer.vectorSize(CMArrow::FooterDictionaries);
+   SEXP rdicts;
+   PROTECT(rdicts = allocVector(VECSXP, ndicts));
+   nprotect++;
+   for (int k = 0; k < ndicts; k++)
+   {
+      CMArrowBlock block = cmArrowFooterBlock(footer, CMArrow::FooterDictionaries, k);
+      CMFlatTable db;
+      if (!cmArrowReadHeader(reader, block, CMArrow::HeaderDictionaryBatch, st.dictMetadata, &bad, db))
+      {
+         snprintf(err, errsz, "invalid dictionary batch %d", k + 1);
+         UNPROTECT(nprotect);
+         return R_NilValue;
+      }
+      int64_t id = db.scalar<int64_t>(CMArrow::DictionaryBatchId);
+      CMFlatTable data = db.table(CMArrow::DictionaryBatchData);
+      int64_t len = data.scalar<int64_t>(CMArrow::RecordBatchLength);
+      bool delta = dictSlot.count(id) && db.scalar<uint8_t>(CMArrow::DictionaryBatchIsDelta);
+      int np = delta ? length(VECTOR_ELT(rdicts, dictSlot[id])) : 0;
+      // each entry takes at least its offset in the body
+      if (len < 0 || len > INT_MAX - np || len > block.bodyLength)
+      {
+         snprintf(err, errsz, "invalid dictionary batch %d", k + 1);
+         UNPROTECT(nprotect);
+         return R_NilValue;
+      }
+      SEXP rdict;
+      PROTECT(rdict = allocVector(STRSXP, (int) len));
+      if (!cmArrowReadStrings(st, block, data, 1, (int) len, rdict, 0) ||
+          !cmArrowApplyValidity(st, block, data, 0, 0, (int) len, ArrowUtf8, rdict, 0))
+      {
+         snprintf(err, errsz, "invalid dictionary batch %d", k + 1);
+         UNPROTECT(nprotect + 1);
+         return R_NilValue;
+      }
+      if (delta)
+      {
+         // a delta batch extends the existing dictionary
+         SEXP prev = VECTOR_ELT(rdicts, dictSlot[id]);
+         SEXP merged;
+         PROTECT(merged = allocVector(STRSXP, np + (int) len));
+         for (int i = 0; i < np; i++) SET_STRING_ELT(merged, i, STRING_ELT(prev, i));
+         for (int i = 0; i < len; i++) SET_STRING_ELT(merged, np + i, STRING_ELT(rdict, i));
+         SET_VECTOR_ELT(rdicts, dictSlot[id], merged);
+         UNPROTECT(1);
+      }
+      else
+      {
+         dictSlot[id] = k;
+         SET_VECTOR_ELT(rdicts, k, rdict);
+      }
+      UNPROTECT(1);
+   }
+
+   // Record batches: load the metadata to find the total number of rows.
+
+   int nbatches = footer.vectorSize(CMArrow::FooterRecordBatches);
+   vector<string>& metadata = st.metadata;
+   vector<CMFlatTable>& batches = st.batches;
+   vector<CMArrowBlock>& blocks = st.blocks;
+   metadata.resize(nbatches);
+   batches.resize(nbatches);
+   blocks.resize(nbatches);
+   int64_t nrows = 0;
+   for (int b = 0; b < nbatches; b++)
+   {
+      blocks[b] = cmArrowFooterBlock(footer, CMArrow::FooterRecordBatches, b);
+      int64_t len = -1;
+      if (cmArrowReadHeader(reader, blocks[b], CMArrow::HeaderRecordBatch, metadata[b], &bad, batches[b]))
+      {
+         len = batches[b].scalar<int64_t>(CMArrow::RecordBatchLength);
+      }
+      // each row takes at least a byte of the body in every column
+      if (len < 0 || len > INT_MAX - nrows || (ncols > 0 && len > blocks[b].bodyLength))
+      {
+         snprintf(err, errsz, "invalid record batch %d", b + 1);
+         UNPROTECT(nprotect);
+         return R_NilValue;
+      }
+      nrows += len;
+   }
+   if (bad || reader.bad())
+   {
+      snprintf(err, errsz, "corrupt metadata");
+      UNPROTECT(nprotect);
+      return R_NilValue;
+   }
+
+   // Allocate the columns and read the buffers of each batch into them.
+
+   SEXP rframe;
+   PROTECT(rframe = allocVector(VECSXP, ncols));
+   nprotect++;
+   for (int j = 0; j < ncols; j++)
+   {
+      SEXPTYPE type = fields[j].kind == ArrowInt32 ? INTSXP :
+         (fields[j].kind == ArrowDouble || fields[j].kind == ArrowInt64 ? REALSXP : STRSXP);
+      SET_VECTOR_ELT(rframe, j, allocVector(type, (int) nrows));
+   }
+
+   int row0 = 0;
+   for (int b = 0; b < nbatches; b++)
+   {
+      const CMFlatTable& rb = batches[b];
+      int64_t len64 = rb.scalar<int64_t>(CMArrow::RecordBatchLength);
+      if (len64 < 0 || row0 + len64 > nrows)
+      {
+         snprintf(err, errsz, "invalid record batch %d", b + 1);
+         UNPROTECT(nprotect);
+         return R_NilValue;
+      }
+      int len = (int) len64;
+      int ibuf = 0;
+      for (int j = 0; j < ncols; j++)
+      {
+         SEXP x = VECTOR_ELT(rframe, j);
+         bool ok = rb.vectorStruct<int64_t>(CMArrow::RecordBatchNodes, j, CMArrow::FieldNodeSize, 0) == len;
+         switch (fields[j].kind)
+         {
+         case ArrowInt32:
+            ok = ok && cmArrowReadBuffer(reader, blocks[b], rb, ibuf + 1, 4 * (int64_t) len, INTEGER(x) + row0);
+            break;
+         case ArrowDouble:
+         case ArrowInt64:
+            ok = ok && cmArrowReadBuffer(reader, blocks[b], rb, ibuf + 1, 8 * (int64_t) len, REAL(x) + row0);
+            break;
+         case ArrowUtf8:
+            ok = ok && cmArrowReadStrings(st, blocks[b], rb, ibuf + 1, len, x, row0);
+            break;
+         case ArrowDictionary:
+         {
+            int w = fields[j].indexWidth;
+            SEXP rdict = dictSlot.count(fields[j].dictId) ?
+               VECTOR_ELT(rdicts, dictSlot[fields[j].dictId]) : R_NilValue;
+            ok = ok && rdict != R_NilValue && cmArrowBufferFits(blocks[b], rb, ibuf + 1, w * (int64_t) len);
+            if (ok) st.data.resize(w * (size_t) len);
+            ok = ok && (len == 0 ||
+               cmArrowReadBuffer(reader, blocks[b], rb, ibuf + 1, w * (int64_t) len, &st.data[0]));
+            int ndict = ok ? length(rdict) : 0;
+            for (int i = 0; ok && i < len; i++)
+            {
+               int64_t k = cmArrowIndex(st.data.data(), w, i);
+               // indices under nulls may be garbage
+               SET_STRING_ELT(x, row0 + i, k >= 0 && k < ndict ? STRING_ELT(rdict, (int) k) : NA_STRING);
+            }
+            break;
+         }
+         }
+         ok = ok && cmArrowApplyValidity(st, blocks[b], rb, j, ibuf, len, fields[j].kind, x, row0);
+         if (!ok)
+         {
+            snprintf(err, errsz, "invalid data for column '%s' in record batch %d", fields[j].name.c_str(), b + 1);
+            UNPROTECT(nprotect);
+            return R_NilValue;
+         }
+         ibuf += fields[j].kind == ArrowUtf8 ? 3 : 2;
+      }
+      row0 += len;
+   }
+
+   // Classes of the 64-bit integer columns.
+
+   for (int j = 0; j < ncols; j++)
+   {
+      if (fields[j].kind != ArrowInt64) continue;
+      SEXP cls;
+      PROTECT(cls = allocVector(STRSXP, 1));
+      SET_STRING_ELT(cls, 0, mkChar(fields[j].rclass.empty() ? int64class : fields[j].rclass.c_str()));
+      classgets(VECTOR_ELT(rframe, j), cls);
+      UNPROTECT(1);
+      if (fields[j].base == 16)
+      {
+         SEXP rb;
+         PROTECT(rb = allocVector(INTSXP, 1));
+         INTEGER(rb)[0] = 16;
+         setAttrib(VECTOR_ELT(rframe, j), install("base"), rb);
+         UNPROTECT(1);
+      }
+   }
+
+   // Make it a data frame: add names, class and rownames
+
+   SEXP rOutColNames;
+   PROTECT(rOutColNames = allocVector(STRSXP, ncols));
+   for (int j = 0; j < ncols; j++)
+   {
+      SET_STRING_ELT(rOutColNames, j, mkCharCE(fields[j].name.c_str(), CE_UTF8));
+   }
+   setAttrib(rframe, R_NamesSymbol, rOutColNames);
+
+   SEXP rOutRowNames;
+   PROTECT(rOutRowNames = allocVector(INTSXP, (int) nrows));
+   int* iptr = INTEGER(rOutRowNames);
+   for (int i = 0; i < nrows; i++)
+   {
+      iptr[i] = i + 1;
+   }
+   setAttrib(rframe, R_RowNamesSymbol, rOutRowNames);
+
+   SEXP cls;
+   PROTECT(cls = allocVector(STRSXP, 1));
+   SET_STRING_ELT(cls, 0, mkChar("data.frame"));
+   classgets(rframe, cls);
+
+   UNPROTECT(nprotect + 3);
+   return rframe;
+}
+
+//-----------------------------------------------------------------------------
+
+} // namespace
+
+extern "C"
+{
+//-----------------------------------------------------------------------------
+
+// write.arrow(frm, "frm.arrow")
+
+/// Writes a data frame to an Arrow IPC file. Integer, double, int64/integer64,
+/// character and factor columns are supported; character and factor columns are
+/// dictionary-encoded. Integer, double and 64-bit columns are streamed to the file
+/// directly from the R vectors.
+SEXP writeArrow(SEXP rframe, SEXP rfilename)
+{
+   if (!isNewList(rframe)) error("c_writeArrow: expecting a data frame");
+   char err[512] = "";
+   // The C++ objects are released before any call to error().
+   bool ok = cmArrowWriteFrame(rframe, CHAR(STRING_ELT(rfilename, 0)), err, sizeof(err));
+   if (!ok) error("c_writeArrow: %s", err);
+   return R_NilValue;
+}
+
+//-----------------------------------------------------------------------------
+
+// frm <- read.arrow("frm.arrow")
+
+/// Reads an Arrow IPC file with int32, int64, double and (optionally dictionary-encoded)
+/// utf8 columns into a data frame. Int64 columns get the class recorded in the file by
+/// writeArrow or, if there is none, \c rint64class.
+SEXP readArrow(SEXP rfilename, SEXP rint64class)
+{
+   char err[512] = "";
+   // The C++ objects are owned by an external pointer, whose finalizer releases them if
+   // an R allocation fails; otherwise they are released before any call to error().
+   SEXP rstate;
+   PROTECT(rstate = R_MakeExternalPtr(0, R_NilValue, R_NilValue));
+   R_RegisterCFinalizerEx(rstate, cmArrowFinalizeState, TRUE);
+   SEXP res = R_NilValue;
+   try
+   {
+      CMArrowReadState* st = new CMArrowReadState();
+      R_SetExternalPtrAddr(rstate, st);
+      res = cmArrowReadFrame(*st, CHAR(STRING_ELT(rfilename, 0)), CHAR(STRING_ELT(rint64class, 0)),
+         err, sizeof(err));
+   }
+   catch (std::exception& e)
+   {
+      // error() below also restores the protection stack left by cmArrowReadFrame
+      snprintf(err, sizeof(err), "%s", e.what());
+      res = R_NilValue;
+   }
+   cmArrowFinalizeState(rstate);
+   UNPROTECT(1);
+   if (res == R_NilValue) error("c_readArrow: %s", err);
+   return res;
+}
+
+//-----------------------------------------------------------------------------
+
+}
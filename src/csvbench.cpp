@@ -0,0 +1,322 @@
+//-------------------------------------------------------------------------------
+//
+// Package csvread
+//
+// Per-stage timing of the CSV loader for the benchmark scripts in inst/benchmark.
+//
+// Sergei Izrailev, 2011-2014
+//-------------------------------------------------------------------------------
+// Copyright 2011-2014 Collective, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//-------------------------------------------------------------------------------
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#include "SfiDelimitedRecordSTD.h"
+#include "CMLineStream.h"
+#include "CMRDataCollector.h"
+#include "CMTimer.h"
+
+#include <R.h>
+#include <Rinternals.h>
+
+using namespace cm;
+
+//-----------------------------------------------------------------------------
+
+// Timing every getline(), split() and append() call would cost about as much as the calls
+// themselves, so the stages are measured as passes over the file that each add one step to
+// the previous pass: getline() only, then getline() and split(), then the appends for the
+// columns of one type at a time. The time of a stage is the difference between its pass and
+// the pass it builds on. The file is read once before timing so that all passes find it in
+// the file system cache.
+
+/// Timing results of the benchmark passes.
+struct CMBenchStages
+{
+   vector<string> names;
+   vector<double> wall;
+   vector<double> cpu;
+
+   void add(const string& name, double w, double c)
+   {
+      names.push_back(name);
+      wall.push_back(w);
+      cpu.push_back(c);
+   }
+};
+
+/// Returns a collector for a column type or 0 if the type is not supported. The class
+/// attributes of readCSV are left out since only the parsing is timed.
+static CMRDataCollector* cmBenchCollector(const char* type)
+{
+   if (strcmp(type, "integer") == 0) return new CMRDataCollectorInt();
+   if (strcmp(type, "double") == 0) return new CMRDataCollectorDbl();
+   if (strcmp(type, "long") == 0 || strcmp(type, "integer64") == 0) return new CMRDataCollectorLong(10);
+   if (strcmp(type, "longhex") == 0) return new CMRDataCollectorLong(16);
+   if (strcmp(type, "string") == 0) return new CMRDataCollectorStr();
+   return 0;
+}
+
+/// Returns the R vector type for a column type supported by cmBenchCollector.
+static SEXPTYPE cmBenchSexpType(const char* type)
+{
+   if (strcmp(type, "integer") == 0) return INTSXP;
+   if (strcmp(type, "string") == 0) return STRSXP;
+   return REALSXP;
+}
+
+/// One pass over the file: reads the lines, splits them if split is true, and appends the
+/// fields of the columns with a non-zero collector. Returns the number of records.
+static int cmBenchPass(const string& filename, bool hasHeader, const string& delim, bool split,
+                       vector<CMRDataCollector*>& cols, CMTimer& timer)
+{
+   SfiDelimitedRecordSTD rec(0, delim);
+   int ncols = cols.size();
+   int n = 0;
+   for (int i = 0; i < ncols; i++)
+   {
+      if (cols[i]) cols[i]->clear();
+   }
+   timer.start();
+   CMLineStream lstr(filename.c_str());
+   char* s;
+   if (hasHeader) s = lstr.getline();
+   while ((s = lstr.getline()))
+   {
+      n++;
+      if (!split) continue;
+      rec.split(s, lstr.len());
+      for (int i = 0, nr = rec.size(); i < ncols; i++)
+      {
+         if (cols[i] == 0) continue;
+         if (i >= nr) cols[i]->append("");
+         else cols[i]->append(rec.get(i));
+      }
+   }
+   timer.stop();
+   return n;
+}
+
+//-----------------------------------------------------------------------------
+
+extern "C"
+{
+
+SEXP getListElement(SEXP list, const char* str);
+
+//-----------------------------------------------------------------------------
+
+/// Times the stages of loading a CSV file. The argument is a list with the elements filename,
+/// coltypes, header and delimiter as for readCSV. Returns a list with the stage names, the
+/// wall-clock and CPU seconds of each stage, the file size in bytes and the number of rows.
+/// The stages are "count" (counting the newlines as readCSV does when nrows is not given),
+/// "getline", "split", "append:<type>" for each column type present, "frame" (allocating
+/// the columns and assembling the data frame) and "total" (a full load without the count).
+SEXP benchCSV(SEXP rschema)
+{
+   if (!isNewList(rschema))
+   {
+      error("c_benchCSV: expecting a list with schema as the only argument");
+   }
+   SEXP rfilename = getListElement(rschema, "filename");
+   if (rfilename == R_NilValue) error("c_benchCSV: missing 'filename' in the argument list");
+   string filename(CHAR(STRING_ELT(rfilename, 0)));
+
+   SEXP rcoltypes = getListElement(rschema, "coltypes");
+   if (rcoltypes == R_NilValue || length(rcoltypes) == 0) error("c_benchCSV: missing 'coltypes' in the argument list");
+   int ncols = length(rcoltypes);
+   for (int i = 0; i < ncols; i++)
+   {
+      CMRDataCollector* c = cmBenchCollector(CHAR(STRING_ELT(rcoltypes, i)));
+      if (c == 0) error("c_benchCSV: unsupported column type '%s'", CHAR(STRING_ELT(rcoltypes, i)));
+      delete c;
+   }
+
+   SEXP rheader = getListElement(rschema, "header");
+   bool hasHeader = rheader != R_NilValue && *(LOGICAL(rheader));
+
+   string delim(",");
+   SEXP rdelim = getListElement(rschema, "delimiter");
+   if (rdelim != R_NilValue)
+   {
+      delim = CHAR(STRING_ELT(rdelim, 0));
+      if (delim.find('\n') != string::npos) error("c_benchCSV: delimiter can't contain a newline");
+   }
+
+   ifstream istr(filename.c_str());
+   if (istr.fail()) error("c_benchCSV: can't open file %s.", filename.c_str());
+
+   CMBenchStages stages;
+   CMTimer timer;
+
+   // Count pass, which also warms up the file system cache.
+
+   double bytes = 0;
+   int nn = 0;
+   {
+      const int SZ = 1024 * 1024;
+      vector<char> vbuff(SZ);
+      char* buff = &vbuff[0];
+      int gotsz = 0;
+      timer.start();
+      while (!istr.eof() && !istr.fail())
+      {
+         istr.read(buff, SZ);
+         gotsz = istr.gcount();
+         bytes += gotsz;
+         char* p = buff;
+         while ((p = (char*) memchr(p, '\n', (buff + gotsz) - p)))
+         {
+            nn++;
+            p++;
+         }
+      }
+      if (gotsz > 0 && buff[gotsz - 1] != '\n') nn++;
+      timer.stop();
+      istr.close();
+   }
+   stages.add("count", timer.wall(), timer.cpu());
+   int nrows = nn - (int) hasHeader;
+   if (nrows < 0) nrows = 0;
+
+   // Allocate the columns.
+
+   timer.reset();
+   timer.start();
+   SEXP rframe;
+   PROTECT(rframe = allocVector(VECSXP, ncols));
+   for (int i = 0; i < ncols; i++)
+   {
+      SET_VECTOR_ELT(rframe, i, allocVector(cmBenchSexpType(CHAR(STRING_ELT(rcoltypes, i))), nrows));
+   }
+   timer.stop();
+   double allocWall = timer.wall();
+   double allocCpu = timer.cpu();
+
+   vector<CMRDataCollector*> none(ncols, (CMRDataCollector*) 0);
+   vector<CMRDataCollector*> all(ncols);
+   for (int i = 0; i < ncols; i++)
+   {
+      all[i] = cmBenchCollector(CHAR(STRING_ELT(rcoltypes, i)));
+      all[i]->attach(VECTOR_ELT(rframe, i));
+   }
+
+   // getline and split passes
+
+   CMTimer tline, tsplit;
+   cmBenchPass(filename, hasHeader, delim, false, none, tline);
+   cmBenchPass(filename, hasHeader, delim, true, none, tsplit);
+   stages.add("getline", tline.wall(), tline.cpu());
+   stages.add("split", tsplit.wall() - tline.wall(), tsplit.cpu() - tline.cpu());
+
+   // one pass per column type
+
+   vector<string> types;
+   for (int i = 0; i < ncols; i++)
+   {
+      string type(CHAR(STRING_ELT(rcoltypes, i)));
+      bool seen = false;
+      for (int k = 0, nt = types.size(); k < nt; k++) seen = seen || types[k] == type;
+      if (!seen) types.push_back(type);
+   }
+   for (int k = 0, nt = types.size(); k < nt; k++)
+   {
+      vector<CMRDataCollector*> cols(none);
+      for (int i = 0; i < ncols; i++)
+      {
+         if (types[k] == CHAR(STRING_ELT(rcoltypes, i))) cols[i] = all[i];
+      }
+      CMTimer t;
+      cmBenchPass(filename, hasHeader, delim, true, cols, t);
+      stages.add("append:" + types[k], t.wall() - tsplit.wall(), t.cpu() - tsplit.cpu());
+   }
+
+   // full load and data frame assembly as in readCSV
+
+   CMTimer ttotal;
+   cmBenchPass(filename, hasHeader, delim, true, all, ttotal);
+
+   timer.reset();
+   timer.start();
+   SEXP rOutColNames;
+   PROTECT(rOutColNames = allocVector(STRSXP, ncols));
+   for (int i = 0; i < ncols; i++)
+   {
+      char s[32];
+      snprintf(s, sizeof(s), "COL%d", i + 1);
+      SET_STRING_ELT(rOutColNames, i, mkChar(s));
+   }
+   setAttrib(rframe, R_NamesSymbol, rOutColNames);
+   SEXP rOutRowNames;
+   PROTECT(rOutRowNames = allocVector(INTSXP, nrows));
+   int* iptr = INTEGER(rOutRowNames);
+   for (int i = 0; i < nrows; i++)
+   {
+      iptr[i] = i + 1;
+   }
+   setAttrib(rframe, R_RowNamesSymbol, rOutRowNames);
+   SEXP cls;
+   PROTECT(cls = allocVector(STRSXP, 1));
+   SET_STRING_ELT(cls, 0, mkChar("data.frame"));
+   classgets(rframe, cls);
+   timer.stop();
+   stages.add("frame", allocWall + timer.wall(), allocCpu + timer.cpu());
+   stages.add("total", allocWall + ttotal.wall() + timer.wall(), allocCpu + ttotal.cpu() + timer.cpu());
+
+   for (int i = 0; i < ncols; i++)
+   {
+      delete all[i];
+   }
+
+   // Assemble the result.
+
+   int nst = stages.names.size();
+   SEXP res;
+   PROTECT(res = allocVector(VECSXP, 5));
+   SEXP rnames = allocVector(STRSXP, nst);
+   SET_VECTOR_ELT(res, 0, rnames);
+   SEXP rwall = allocVector(REALSXP, nst);
+   SET_VECTOR_ELT(res, 1, rwall);
+   SEXP rcpu = allocVector(REALSXP, nst);
+   SET_VECTOR_ELT(res, 2, rcpu);
+   for (int k = 0; k < nst; k++)
+   {
+      SET_STRING_ELT(rnames, k, mkChar(stages.names[k].c_str()));
+      REAL(rwall)[k] = stages.wall[k];
+      REAL(rcpu)[k] = stages.cpu[k];
+   }
+   SET_VECTOR_ELT(res, 3, ScalarReal(bytes));
+   SET_VECTOR_ELT(res, 4, ScalarInteger(nrows));
+
+   SEXP rresnames;
+   PROTECT(rresnames = allocVector(STRSXP, 5));
+   SET_STRING_ELT(rresnames, 0, mkChar("stage"));
+   SET_STRING_ELT(rresnames, 1, mkChar("wall"));
+   SET_STRING_ELT(rresnames, 2, mkChar("cpu"));
+   SET_STRING_ELT(rresnames, 3, mkChar("bytes"));
+   SET_STRING_ELT(rresnames, 4, mkChar("rows"));
+   setAttrib(res, R_NamesSymbol, rresnames);
+
+   UNPROTECT(6);
+   return res;
+}
+
+//-----------------------------------------------------------------------------
+
+}
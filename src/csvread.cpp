@@ -32,12 +32,22 @@ using namespace std;
 #include "SfiDelimitedRecordSTD.h"
 #include "CMLineStream.h"
 #include "CMRDataCollector.h"
+#include "CMColumnStats.h"
+#include "CMLoader.h"
+#include "CMSampler.h"
+#include "CMTail.h"
+#include "CMFileSplit.h"
+#include "CMTimer.h"
 
 #include <R.h>
 #include <Rinternals.h>
 #include <Rmath.h>
 #include <errno.h>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 /*
 
 namespace cm
@@ -63,344 +73,651 @@ template<typename T> T cmMax(T a, T b) { return a > b ? a : b; }
 
 using namespace cm;
 
-extern "C"
-{
 //-----------------------------------------------------------------------------
 
-/// Get the list element named str or return NULL - from the manual.
-SEXP getListElement(SEXP list, const char* str)
+/// Calls R_CheckUserInterrupt through R_ToplevelExec, which returns FALSE instead of
+/// jumping out of the caller on an interrupt, so that the caller can clean up first.
+static void cmCheckInterrupt(void* /*data*/)
 {
-   SEXP elmt = R_NilValue;
-   SEXP names = getAttrib(list, R_NamesSymbol);
-   for (int i = 0, n = length(list); i < n; i++)
+   R_CheckUserInterrupt();
+}
+
+/// Returns false if the user has interrupted R.
+static bool cmNotInterrupted()
+{
+   return R_ToplevelExec(cmCheckInterrupt, NULL) == TRUE;
+}
+
+/// Load monitor of readCSV. Checks for user interrupts and, at most twice a second, reports
+/// the progress by printing a line to the console and/or by calling an R function with the
+/// number of rows read so far and the fraction of the file read.
+class CMRLoadMonitor : public CMLoadMonitor
+{
+protected:
+   SEXP m_callback;      ///< R function(rows, fraction) or R_NilValue.
+   bool m_print;         ///< Flag indicating that the progress is printed.
+   double m_size;        ///< File size in bytes, 0 if unknown.
+   double m_last;        ///< Wall-clock time of the last report.
+   bool m_printed;       ///< Flag indicating that a progress line was printed.
+   bool m_interrupted;   ///< Flag indicating that the user interrupted the load.
+   bool m_failed;        ///< Flag indicating that the callback signalled an error.
+
+   /// Reports the progress. Returns false if the callback failed.
+   bool report(int rows, double bytes)
    {
-      if (strcmp(CHAR(STRING_ELT(names, i)), str) == 0)
+      double fraction = m_size > 0 ? (bytes < m_size ? bytes / m_size : 1.0) : NA_REAL;
+      if (m_print)
       {
-         elmt = VECTOR_ELT(list, i);
-         break;
+         if (m_size > 0) Rprintf("\rRead %d rows (%.0f%%)", rows, 100 * fraction);
+         else Rprintf("\rRead %d rows", rows);
+         R_FlushConsole();
+         m_printed = true;
+      }
+      if (m_callback != R_NilValue)
+      {
+         SEXP rrows, rfraction, call;
+         PROTECT(rrows = ScalarInteger(rows));
+         PROTECT(rfraction = ScalarReal(fraction));
+         PROTECT(call = lang3(m_callback, rrows, rfraction));
+         int err = 0;
+         R_tryEval(call, R_GlobalEnv, &err);
+         UNPROTECT(3);
+         if (err) m_failed = true;
       }
+      return !m_failed;
    }
-   return elmt;
-}
 
-//-----------------------------------------------------------------------------
+public:
+   CMRLoadMonitor(SEXP callback, bool print, double size) : m_callback(callback), m_print(print),
+      m_size(size), m_last(CMTimer::wallNow()), m_printed(false), m_interrupted(false), m_failed(false) {}
+   virtual ~CMRLoadMonitor() {}
 
-SEXP numLines(SEXP filename)
-{
-   const char* fname = CHAR(STRING_ELT(filename, 0));
-   CMLineStream lstr(fname);
-   char* s;
-   int n = 0;
-   while ((s = lstr.getline()))
+   virtual bool update(int lines, size_t bytes)
    {
-      //Rprintf("--->%s\n", s);
-      n++;
+      if (!cmNotInterrupted())
+      {
+         m_interrupted = true;
+         return false;
+      }
+      if (m_callback == R_NilValue && !m_print) return true;
+      double now = CMTimer::wallNow();
+      if (now - m_last < 0.5) return true;
+      m_last = now;
+      return report(lines, bytes);
    }
-   SEXP ret;
-   PROTECT(ret = allocVector(INTSXP,1));
-   INTEGER(ret)[0] = n;
-   UNPROTECT(1);
-   return ret;
-}
 
-//-----------------------------------------------------------------------------
+   /// Reports the final count if the progress is reported, and ends the progress line.
+   void finish(int rows)
+   {
+      if (stopped()) return;
+      if (m_printed || m_callback != R_NilValue) report(rows, m_size);
+      if (m_printed) Rprintf("\n");
+   }
 
-// dyn.load("cmrlib.so")
-// lst <- .Call("readCSV", list(filename="blah.csv", coltypes=c("integer", "integer", "double", "string"), nrows=10))
+   /// Returns true if the load was stopped by an interrupt or a failed callback.
+   bool stopped() const
+   {
+      return m_interrupted || m_failed;
+   }
+   /// Returns true if the load was stopped by an interrupt.
+   bool interrupted() const
+   {
+      return m_interrupted;
+   }
+};
 
-/// Reads a CSV file according to provided schema.
-/// The argument is a list of the following structure:
-/// - filename - name of the CSV file
-/// - coltypes - (required) vector of column types; accepted types are integer, logical, string, double
-/// - nrows    - resulting number of rows, overriding actual number of rows in the file; saves time
-/// - header   - TRUE (default) or FALSE; source of column names if \c colnames is not provided
-/// - colnames - column names for all columns; overrides header names when present
-/// - verbose  - flag indicating if progress messages should be printed.
-/// - delimiter - one-character delimiter (default is comma).
-/// If number of columns, which is inferred from the number of provided coltypes, is greater than
-/// the actual number of columns, the extra columns are still created. If the number of columns is
-/// less than the actual number of columns in the file, the extra columns in the file are ignored.
-SEXP readCSV(SEXP rschema)
-{
-   // Check the arguments.
+//-----------------------------------------------------------------------------
 
-   if (!isNewList(rschema))
+/// Uniform random numbers from R's generator. The caller brackets the use with
+/// GetRNGstate() and PutRNGstate().
+class CMRRandom : public CMRandom
+{
+public:
+   virtual double uniform()
    {
-      error("c_readCSV: expecting a list with schema as the only argument");
+      return unif_rand();
    }
-   SEXP rfilename = getListElement(rschema, "filename");
-   if (rfilename == R_NilValue) error("c_readCSV: missing 'filename' in the argument list");
-   string filename(CHAR(STRING_ELT(rfilename, 0)));
-
-   SEXP rcoltypes = getListElement(rschema, "coltypes");
-   if (rcoltypes == R_NilValue || length(rcoltypes) == 0) error("c_readCSV: missing 'coltypes' in the argument list");
+};
 
-   SEXP rcolnames = getListElement(rschema, "colnames");
+//-----------------------------------------------------------------------------
 
-   SEXP rheader = getListElement(rschema, "header");
-   bool hasHeader = true;
-   if (rheader != R_NilValue) hasHeader = *(LOGICAL(rheader));
+/// Load monitor of the threads of readCSVFiles. The monitor of the main thread checks for
+/// user interrupts, and the monitors of all threads stop their loads once it has seen one.
+class CMRThreadMonitor : public CMLoadMonitor
+{
+protected:
+   int* m_stop;         ///< Flag shared by all threads, set to 1 to stop.
+   bool m_main;         ///< Flag indicating that the monitor runs on the main thread.
 
-   SEXP rnrows = getListElement(rschema, "nrows");
-   int nrows = 0;
-   if (rnrows != R_NilValue)
+public:
+   CMRThreadMonitor(int* stop) : m_stop(stop), m_main(true)
    {
-      nrows = (int) *(REAL(rnrows));
-      if (nrows < 1) error("c_readCSV: 'nrows' must be positive");
+#ifdef _OPENMP
+      m_main = omp_get_thread_num() == 0;
+#endif
    }
-   bool verbose = false;
-   SEXP rverbose = getListElement(rschema, "verbose");
-   PROTECT(rverbose = coerceVector(rverbose, INTSXP));
-   if (rverbose != R_NilValue) verbose = (bool) *(INTEGER(rverbose));
-   UNPROTECT(1);
+   virtual ~CMRThreadMonitor() {}
 
-   char delim = ',';
-   SEXP rdelim = getListElement(rschema, "delimiter");
-   if (rdelim != R_NilValue)
+   virtual bool update(int /*lines*/, size_t /*bytes*/)
    {
-      string sdelim(CHAR(STRING_ELT(rdelim, 0)));
-      if (strlen(sdelim.c_str()) != 1) error("c_readCSV: delimiter must be a single character");
-      delim = sdelim.c_str()[0];
+      int stop;
+      if (m_main && !cmNotInterrupted())
+      {
+#ifdef _OPENMP
+#pragma omp atomic write
+#endif
+         *m_stop = 1;
+      }
+#ifdef _OPENMP
+#pragma omp atomic read
+#endif
+      stop = *m_stop;
+      return stop == 0;
    }
+};
 
-   int ncols = length(rcoltypes);
+/// Returns the number of threads for loading nfiles files or ranges of files from the option
+/// "csvread.threads".
+static int cmLoadThreads(int nfiles)
+{
+#ifdef _OPENMP
+   int nt = asInteger(GetOption1(install("csvread.threads")));
+   if (nt == NA_INTEGER || nt <= 1) return 1;
+   if (nt > omp_get_num_procs()) nt = omp_get_num_procs();
+   return nt < nfiles ? nt : nfiles;
+#else
+   return 1;
+#endif
+}
 
-   // Before going any further, check if the file is readable.
+//-----------------------------------------------------------------------------
 
-   //Rprintf("Trying to load %s\n", filename.c_str());
-   ifstream istr(filename.c_str());
-   if (istr.fail())
-   {
-      error("c_readCSV: can't open file %s.", filename.c_str());
-   }
+extern "C" SEXP getListElement(SEXP list, const char* str);
 
-   // Read the headers if necessary.
+/// Returns the base of the integer column types, or 0 for the other types.
+static int cmIntegerBase(const char* type)
+{
+   if (strcmp(type, "longhex") == 0) return 16;
+   if (strcmp(type, "integer") == 0 || strcmp(type, "long") == 0 || strcmp(type, "integer64") == 0) return 10;
+   return 0;
+}
 
-   string buffer;
-   SfiDelimitedRecordSTD rec(0, delim);
-   vector<string> headers;
-   int lineCount = 0;
-   if (hasHeader)
+/// Appends the values of rv converted to 64-bit integers to out. Strings are parsed in the
+/// given base, int64 and integer64 values are taken as is and numbers are truncated. NAs are
+/// skipped. Returns false if the values can't be converted: a string is not only a number, or
+/// a number is outside of the range of 64-bit integers.
+static bool cmInt64Values(SEXP rv, int base, vector<CMInt64>& out)
+{
+   if (rv == R_NilValue) return true;
+   int n = length(rv);
+   if (isString(rv))
    {
-      getline(istr, buffer);
-      rec = buffer.c_str();
-      for (int i = 0, n = rec.size(); i < n; i++)
+      for (int i = 0; i < n; i++)
       {
-         headers.push_back(rec[i]);
+         CMInt64 x;
+         bool exact;
+         if (STRING_ELT(rv, i) == NA_STRING) continue;
+         if (!cmParseInt64(CHAR(STRING_ELT(rv, i)), base, x, &exact) || !exact) return false;
+         out.push_back(x);
       }
-      lineCount++;
    }
-   istr.close();
-
-   // Count the lines if nrows hasn't been provided.
-
-   if (nrows == 0)
+   else if (isReal(rv) && (inherits(rv, "int64") || inherits(rv, "integer64")))
    {
-      istr.open(filename.c_str());
-      const int SZ = 1024 * 1024;
-      char buff[SZ];
-      int nn = 0;
-      int gotsz = 0;
-      while (!istr.eof() && !istr.fail())
+      for (int i = 0; i < n; i++)
       {
-         istr.read(buff, SZ);
-         gotsz = istr.gcount();
-//         for (int i = 0; i < gotsz; i++)
-//         {
-//            if (buff[i] == '\n') nn++;
-//         }
-         char* p = buff;
-         while ((p = (char*) memchr(p, '\n', (buff + gotsz) - p)))
-         {
-            nn++;
-            p++;
-         }
+         CMInt64 x;
+         memcpy(&x, REAL(rv) + i, sizeof(CMInt64));
+         if (x != NA_LONG.L) out.push_back(x);
       }
-      if (gotsz > 0 && buff[gotsz - 1] != '\n') nn++;
-
-      nrows = nn - (int) hasHeader;
-      if (verbose) Rprintf("Counted %d lines.\n", nn);
-      istr.close();
    }
-
-   // Count the lines if nrows hasn't been provided.
-
-/*   if (nrows == 0)
+   else if (isInteger(rv))
    {
-      if (!hasHeader) getline(istr, buffer);
-      while (istr)
+      for (int i = 0; i < n; i++)
       {
-         lineCount++;
-         getline(istr, buffer);
+         if (INTEGER(rv)[i] != NA_INTEGER) out.push_back(INTEGER(rv)[i]);
       }
-      //istr.seekg(ios_base::beg); // rewind
-      istr.close();
-      istr.open(filename.c_str());
-      if (hasHeader) getline(istr, buffer);
-      nrows = lineCount - (int) hasHeader;
-      Rprintf("Counted %d rows\n", nrows);
    }
-*/
-   // Figure out column names as follows:
-   // - the number of names is the number of types
-   // - if there are colnames provided, take that
-   // - if there are not enough colnames, take the header (if there is one)
-   // - if there's still not enough names, fill with "COL<N>" one-based.
-
-   vector<string> colnames;
-   int namecnt = 0;
-   for (int i = 0, n = length(rcolnames); i < n && namecnt < ncols; i++)
+   else if (isReal(rv))
    {
-      colnames.push_back(CHAR(STRING_ELT(rcolnames, i)));
-      namecnt++;
+      for (int i = 0; i < n; i++)
+      {
+         double d = REAL(rv)[i];
+         if (ISNAN(d)) continue;
+         // the cast is undefined outside of [-2^63, 2^63)
+         if (!(d >= -9223372036854775808.0 && d < 9223372036854775808.0)) return false;
+         out.push_back((CMInt64) d);
+      }
    }
+   else return false;
+   return true;
+}
 
-   for (int i = 0, n = headers.size(); i < n && namecnt < ncols; i++)
+/// Appends the values of rv converted to double to out, skipping NAs. Returns false if
+/// the values can't be converted, e.g., a string is not only a number.
+static bool cmDoubleValues(SEXP rv, vector<double>& out)
+{
+   if (rv == R_NilValue) return true;
+   int n = length(rv);
+   if (isString(rv))
    {
-      colnames.push_back(headers[i]);
-      namecnt++;
+      for (int i = 0; i < n; i++)
+      {
+         double x;
+         bool exact;
+         if (STRING_ELT(rv, i) == NA_STRING) continue;
+         if (!cmParseDouble(CHAR(STRING_ELT(rv, i)), x, &exact) || !exact) return false;
+         out.push_back(x);
+      }
+   }
+   else if (isReal(rv) && (inherits(rv, "int64") || inherits(rv, "integer64")))
+   {
+      for (int i = 0; i < n; i++)
+      {
+         CMInt64 x;
+         memcpy(&x, REAL(rv) + i, sizeof(CMInt64));
+         if (x != NA_LONG.L) out.push_back((double) x);
+      }
+   }
+   else if (isInteger(rv))
+   {
+      for (int i = 0; i < n; i++)
+      {
+         if (INTEGER(rv)[i] != NA_INTEGER) out.push_back(INTEGER(rv)[i]);
+      }
+   }
+   else if (isReal(rv))
+   {
+      for (int i = 0; i < n; i++)
+      {
+         if (!ISNAN(REAL(rv)[i])) out.push_back(REAL(rv)[i]);
+      }
    }
+   else return false;
+   return true;
+}
 
-   while (namecnt++ < ncols)
+/// Appends the non-NA strings in rv to out. Returns false if rv is not a character vector.
+static bool cmStringValues(SEXP rv, vector<string>& out)
+{
+   if (rv == R_NilValue) return true;
+   if (!isString(rv)) return false;
+   for (int i = 0, n = length(rv); i < n; i++)
    {
-      stringstream ss;
-      ss << "COL" << namecnt;
-      colnames.push_back(ss.str());
+      if (STRING_ELT(rv, i) != NA_STRING) out.push_back(CHAR(STRING_ELT(rv, i)));
    }
+   return true;
+}
 
-   // Allocate and attach collectors to resulting columns.
+/// Adds a predicate that the field in column col is one of values.
+template <class K>
+static void cmAddIn(CMRowFilter& filter, int col, const K& key, const vector<typename K::value_type>& values)
+{
+   filter.add(new CMPredicateIn<K>(col, key, values));
+}
 
-   vector<CMRDataCollector*> lst(ncols);
+/// Adds a predicate that the field in column col is between the only elements of from and to,
+/// if they are not empty.
+template <class K>
+static void cmAddRange(CMRowFilter& filter, int col, const K& key, const vector<typename K::value_type>& from,
+                       const vector<typename K::value_type>& to)
+{
+   typename K::value_type none = typename K::value_type();
+   filter.add(new CMPredicateRange<K>(col, key, from.empty() ? none : from[0], !from.empty(),
+                                      to.empty() ? none : to[0], !to.empty()));
+}
 
-   SEXP rframe; // the return value
-   PROTECT(rframe = allocVector(VECSXP, ncols));
-   if (nrows > 0)
-   for (int i = 0; i < ncols; i++)
+/// Adds the predicates in rfilter to filter. Each element of rfilter is a list with the elements
+/// - column - name or 1-based index of the column
+/// - op     - "in", "range" or "prefix"
+/// - values - the values for "in" or the prefix for "prefix"
+/// - from, to - the ends of the range for "range"; NULL for an open end.
+/// The values are compared as the type of the column: 64-bit integers for the integer types,
+/// doubles for double and strings for string columns. Returns false with a message in msg if
+/// a predicate is invalid.
+static bool cmBuildFilter(SEXP rfilter, SEXP rcoltypes, const vector<string>& colnames, CMRowFilter& filter,
+                          char* msg, size_t msgsz)
+{
+   int ncols = length(rcoltypes);
+   for (int k = 0, np = length(rfilter); k < np; k++)
    {
-      if (strcmp(CHAR(STRING_ELT(rcoltypes, i)), "integer") == 0)
+      SEXP rpred = VECTOR_ELT(rfilter, k);
+      SEXP rcol = isNewList(rpred) ? getListElement(rpred, "column") : R_NilValue;
+      SEXP rop = isNewList(rpred) ? getListElement(rpred, "op") : R_NilValue;
+      if (length(rcol) != 1 || !isString(rop) || length(rop) != 1)
       {
-         SET_VECTOR_ELT(rframe, i, allocVector(INTSXP, nrows));
-         lst[i] = new CMRDataCollectorInt();
-         lst[i]->attach(VECTOR_ELT(rframe, i));
+         snprintf(msg, msgsz, "filter predicate %d must have a column and an op", k + 1);
+         return false;
       }
-      else
-      if (strcmp(CHAR(STRING_ELT(rcoltypes, i)), "double") == 0)
+      int col = -1;
+      if (isString(rcol))
       {
-         SET_VECTOR_ELT(rframe, i, allocVector(REALSXP, nrows));
-         lst[i] = new CMRDataCollectorDbl();
-         lst[i]->attach(VECTOR_ELT(rframe, i));
+         for (int i = 0; i < ncols && col < 0; i++)
+         {
+            if (colnames[i] == CHAR(STRING_ELT(rcol, 0))) col = i;
+         }
       }
       else
-      if (strcmp(CHAR(STRING_ELT(rcoltypes, i)), "integer64") == 0)
       {
-         SET_VECTOR_ELT(rframe, i, allocVector(REALSXP, nrows));
-         lst[i] = new CMRDataCollectorLong(10);
-         lst[i]->attach(VECTOR_ELT(rframe, i));
-
-         SEXP cls;
-         PROTECT(cls = allocVector(STRSXP, 1));
-         SET_STRING_ELT(cls, 0, mkChar("integer64"));
-         classgets(VECTOR_ELT(rframe, i), cls);
-         UNPROTECT(1);
+         col = asInteger(rcol) - 1;
+         if (col >= ncols) col = -1;
       }
-      else
-      if (strcmp(CHAR(STRING_ELT(rcoltypes, i)), "long") == 0)
+      if (col < 0)
       {
-         SET_VECTOR_ELT(rframe, i, allocVector(REALSXP, nrows));
-         lst[i] = new CMRDataCollectorLong(10);
-         lst[i]->attach(VECTOR_ELT(rframe, i));
-
-         SEXP cls;
-         PROTECT(cls = allocVector(STRSXP, 1));
-         SET_STRING_ELT(cls, 0, mkChar("int64"));
-         classgets(VECTOR_ELT(rframe, i), cls);
-         UNPROTECT(1);
+         snprintf(msg, msgsz, "column of filter predicate %d not found", k + 1);
+         return false;
       }
-      else
-      if (strcmp(CHAR(STRING_ELT(rcoltypes, i)), "longhex") == 0)
-      {
-         SET_VECTOR_ELT(rframe, i, allocVector(REALSXP, nrows));
-         lst[i] = new CMRDataCollectorLong(16);
-         lst[i]->attach(VECTOR_ELT(rframe, i));
 
-         SEXP cls;
-         PROTECT(cls = allocVector(STRSXP, 1));
-         SET_STRING_ELT(cls, 0, mkChar("int64"));
-         classgets(VECTOR_ELT(rframe, i), cls);
-         UNPROTECT(1);
+      const char* type = CHAR(STRING_ELT(rcoltypes, col));
+      const char* op = CHAR(STRING_ELT(rop, 0));
+      int base = cmIntegerBase(type);
+      bool isDouble = strcmp(type, "double") == 0;
+      bool isStr = strcmp(type, "string") == 0;
+      bool ok = base > 0 || isDouble || isStr;
+      if (!ok)
+      {
+         snprintf(msg, msgsz, "unsupported column type '%s' in filter predicate %d", type, k + 1);
+         return false;
+      }
 
-         SEXP rb;
-         PROTECT(rb = allocVector(INTSXP, 1));
-         INTEGER(rb)[0] = 16;
-         setAttrib(VECTOR_ELT(rframe, i), install("base"), rb);
-         UNPROTECT(1);
+      if (strcmp(op, "prefix") == 0)
+      {
+         SEXP rv = getListElement(rpred, "values");
+         ok = isString(rv) && length(rv) == 1 && STRING_ELT(rv, 0) != NA_STRING;
+         if (ok) filter.add(new CMPredicatePrefix(col, CHAR(STRING_ELT(rv, 0))));
       }
-      else
-      if (strcmp(CHAR(STRING_ELT(rcoltypes, i)), "string") == 0)
+      else if (strcmp(op, "in") == 0)
       {
-         SET_VECTOR_ELT(rframe, i, allocVector(STRSXP, nrows));
-         lst[i] = new CMRDataCollectorStr();
-         lst[i]->attach(VECTOR_ELT(rframe, i));
+         SEXP rv = getListElement(rpred, "values");
+         if (base > 0)
+         {
+            vector<CMInt64> v;
+            if ((ok = cmInt64Values(rv, base, v))) cmAddIn(filter, col, CMKeyInt64(base), v);
+         }
+         else if (isDouble)
+         {
+            vector<double> v;
+            if ((ok = cmDoubleValues(rv, v))) cmAddIn(filter, col, CMKeyDouble(), v);
+         }
+         else
+         {
+            vector<string> v;
+            if ((ok = cmStringValues(rv, v))) cmAddIn(filter, col, CMKeyString(), v);
+         }
       }
-      else
+      else if (strcmp(op, "range") == 0)
       {
-         UNPROTECT(1);
-         for (int k = 0; k < i; k++)
+         SEXP rfrom = getListElement(rpred, "from");
+         SEXP rto = getListElement(rpred, "to");
+         ok = length(rfrom) <= 1 && length(rto) <= 1;
+         if (ok && base > 0)
          {
-            delete lst[k];
+            vector<CMInt64> from, to;
+            ok = cmInt64Values(rfrom, base, from) && cmInt64Values(rto, base, to);
+            if (ok) cmAddRange(filter, col, CMKeyInt64(base), from, to);
+         }
+         else if (ok && isDouble)
+         {
+            vector<double> from, to;
+            ok = cmDoubleValues(rfrom, from) && cmDoubleValues(rto, to);
+            if (ok) cmAddRange(filter, col, CMKeyDouble(), from, to);
+         }
+         else if (ok)
+         {
+            vector<string> from, to;
+            ok = cmStringValues(rfrom, from) && cmStringValues(rto, to);
+            if (ok) cmAddRange(filter, col, CMKeyString(), from, to);
          }
-         if (istr.is_open()) istr.close();
-         error("c_readCSV: unsupported column type '%s'", CHAR(STRING_ELT(rcoltypes, i)));
       }
-   }
-
-   // Load the CSV
-
-   CMLineStream lstr(filename.c_str());
-   char* s;
-   if (hasHeader) s = lstr.getline();
-   while ((s = lstr.getline()))
-   {
-      //Rprintf("%s\n", s);
-/*      rec = s;
-      for (int i = 0, n = cm::cmMin(ncols, rec.size()); i < n; i++)
+      else
       {
-         lst[i]->append(rec[i]);
+         snprintf(msg, msgsz, "unknown op '%s' in filter predicate %d", op, k + 1);
+         return false;
       }
-      */
-      rec.split(s, lstr.len());
-      for (int i = 0, nr = rec.size(); i < ncols; i++)
+      if (!ok)
       {
-         if (i >= nr) lst[i]->append("");
-         else lst[i]->append(rec.get(i));
+         snprintf(msg, msgsz, "invalid values in filter predicate %d on column '%s'", k + 1, colnames[col].c_str());
+         return false;
       }
-    }
-/*
+   }
+   return true;
+}
 
-   istr.open(filename.c_str());
-   if (hasHeader) getline(istr, buffer);
-   getline(istr, buffer);
-   rec = buffer.c_str();
-   while (istr)
+/// Shortens the columns of rframe to n elements, keeping their attributes.
+static void cmShrinkColumns(SEXP rframe, int n)
+{
+   for (int i = 0, ncols = length(rframe); i < ncols; i++)
    {
-      lineCount++;
-      rec = buffer.c_str();
-
-      // TODO: check that record type matches the schema
+      SEXP col = VECTOR_ELT(rframe, i);
+      if (length(col) <= n) continue;
+      SEXP shorter;
+      PROTECT(shorter = lengthgets(col, n));
+      DUPLICATE_ATTRIB(shorter, col);
+      SET_VECTOR_ELT(rframe, i, shorter);
+      UNPROTECT(1);
+   }
+}
 
-      for (int i = 0, n = cm::cmMin(ncols, rec.size()); i < n; i++)
+/// Sets the column names of a data frame as follows:
+/// - the number of names is the number of types
+/// - if there are colnames provided, take that
+/// - if there are not enough colnames, take the header (if there is one)
+/// - if there's still not enough names, fill with "COL<N>" one-based.
+static void cmColumnNames(SEXP rcolnames, const vector<string>& headers, int ncols, vector<string>& colnames)
+{
+   int namecnt = 0;
+   for (int i = 0, n = length(rcolnames); i < n && namecnt < ncols; i++)
+   {
+      colnames.push_back(CHAR(STRING_ELT(rcolnames, i)));
+      namecnt++;
+   }
+
+   for (int i = 0, n = headers.size(); i < n && namecnt < ncols; i++)
+   {
+      colnames.push_back(headers[i]);
+      namecnt++;
+   }
+
+   while (namecnt++ < ncols)
+   {
+      stringstream ss;
+      ss << "COL" << namecnt;
+      colnames.push_back(ss.str());
+   }
+}
+
+/// Reads the offsets (zero-based) and widths of the fields of a fixed-width file from the schema
+/// elements starts and widths, which are absent for a delimited file, in which case the vectors
+/// are left empty. Returns false with a message in msg if the elements don't match.
+static bool cmFixedWidths(SEXP rschema, vector<int>& starts, vector<int>& widths, char* msg, size_t msgsz)
+{
+   starts.clear();
+   widths.clear();
+   SEXP rstarts = getListElement(rschema, "starts");
+   SEXP rwidths = getListElement(rschema, "widths");
+   if (rstarts == R_NilValue && rwidths == R_NilValue) return true;
+   if (!isInteger(rstarts) || !isInteger(rwidths) || length(rstarts) != length(rwidths) || length(rwidths) == 0)
+   {
+      snprintf(msg, msgsz, "'starts' and 'widths' must be integer vectors of the same length");
+      return false;
+   }
+   for (int i = 0, n = length(rwidths); i < n; i++)
+   {
+      int start = INTEGER(rstarts)[i];
+      int width = INTEGER(rwidths)[i];
+      if (start == NA_INTEGER || width == NA_INTEGER || start < 0 || width <= 0)
       {
-         lst[i]->append(rec[i]);
+         snprintf(msg, msgsz, "field %d has an invalid start or width", i + 1);
+         return false;
       }
-      //cout << buffer << endl;
-      //cout << rec.size() << " " << rec[0] << " " << rec[3] << endl;
+      starts.push_back(start);
+      widths.push_back(width);
+   }
+   return true;
+}
 
-      getline(istr, buffer);
+/// Returns true if the columns are selected by name, i.e., every element of rcoltypes has a
+/// name. If some are empty or NA, as map.coltypes returns for an empty header field, the
+/// columns are matched by position, as they were before the selection by name.
+static bool cmNamedColumns(SEXP rcoltypes)
+{
+   SEXP rnames = getAttrib(rcoltypes, R_NamesSymbol);
+   if (!isString(rnames)) return false;
+   for (int i = 0, n = length(rnames); i < n; i++)
+   {
+      SEXP rname = STRING_ELT(rnames, i);
+      if (rname == NA_STRING || *CHAR(rname) == '\0') return false;
    }
-*/
+   return true;
+}
+
+/// Returns a header field as read.csv would name its column: without a trailing carriage
+/// return and without the double quotes around it, with doubled quotes unescaped.
+static string cmHeaderName(const string& field)
+{
+   string name = field;
+   if (!name.empty() && name[name.size() - 1] == '\r') name.erase(name.size() - 1);
+   if (name.size() < 2 || name[0] != '"' || name[name.size() - 1] != '"') return name;
+   string unquoted;
+   for (size_t i = 1; i + 1 < name.size(); i++)
+   {
+      unquoted += name[i];
+      if (name[i] == '"' && name[i + 1] == '"') i++;
+   }
+   return unquoted;
+}
+
+/// Opens the file in lstr at its first data line: sets the quoted mode and skips the header.
+static void cmOpenLines(CMLineStream& lstr, const char* filename, bool quoted, bool hasHeader)
+{
+   lstr.open(filename);
+   lstr.setQuoted(quoted);
+   if (hasHeader) lstr.getline();
+}
+
+/// Finds the field of the file for each column of named rcoltypes: column i is loaded from field
+/// positions[i] (zero-based), the field whose header is the name of the column. Headers are
+/// compared as cmHeaderName returns them, so that the names from map.coltypes match, and the n-th
+/// column with a repeated name is the n-th field with that header. The fields that are not named
+/// are not loaded. headers is replaced by the names of the columns; if it is empty, the file has
+/// no header, and the columns are the fields in order. Returns false with a message in msg if a
+/// name is not found in the header as many times as it is in rcoltypes.
+static bool cmSelectColumns(SEXP rcoltypes, vector<string>& headers, vector<int>& positions, char* msg, size_t msgsz)
+{
+   SEXP rnames = getAttrib(rcoltypes, R_NamesSymbol);
+   int ncols = length(rcoltypes);
+   vector<string> names;
+   positions.clear();
+   for (int i = 0; i < ncols; i++)
+   {
+      names.push_back(CHAR(STRING_ELT(rnames, i)));
+      int skip = 0;
+      for (int k = 0; k < i; k++) skip += names[k] == names[i];
+      int seen = 0;
+      int pos = headers.empty() ? i : -1;
+      for (int j = 0, n = headers.size(); j < n && pos < 0; j++)
+      {
+         if (cmHeaderName(headers[j]) == names[i] && seen++ == skip) pos = j;
+      }
+      if (pos < 0)
+      {
+         snprintf(msg, msgsz, seen == 0 ? "column '%s' not found in the header" :
+            "column '%s' is repeated more times than in the header", names[i].c_str());
+         return false;
+      }
+      positions.push_back(pos);
+   }
+   headers.swap(names);
+   return true;
+}
+
+/// Returns a new collector for a column type or 0 if the type is not supported. The integer
+/// collectors are promoted as given by promotion.
+static CMRDataCollector* cmNewCollector(const char* type, CMPromotion promotion = CM_PROMOTE_NONE)
+{
+   if (strcmp(type, "integer") == 0) return new CMRDataCollectorInt(promotion);
+   if (strcmp(type, "double") == 0) return new CMRDataCollectorDbl();
+   if (strcmp(type, "integer64") == 0 || strcmp(type, "long") == 0) return new CMRDataCollectorLong(10);
+   if (strcmp(type, "longhex") == 0) return new CMRDataCollectorLong(16);
+   if (strcmp(type, "string") == 0) return new CMRDataCollectorStr();
+   return 0;
+}
+
+/// Allocates a column of n elements for a type supported by cmNewCollector, with the class
+/// attributes of the 64-bit integer types. The result is not protected.
+static SEXP cmAllocColumn(const char* type, int n)
+{
+   if (strcmp(type, "integer") == 0) return allocVector(INTSXP, n);
+   if (strcmp(type, "string") == 0) return allocVector(STRSXP, n);
 
-   // Set the column names
+   SEXP col;
+   PROTECT(col = allocVector(REALSXP, n));
+   if (strcmp(type, "double") != 0)
+   {
+      SEXP cls;
+      PROTECT(cls = allocVector(STRSXP, 1));
+      SET_STRING_ELT(cls, 0, mkChar(strcmp(type, "integer64") == 0 ? "integer64" : "int64"));
+      classgets(col, cls);
+      UNPROTECT(1);
+   }
+   if (strcmp(type, "longhex") == 0)
+   {
+      SEXP rb;
+      PROTECT(rb = allocVector(INTSXP, 1));
+      INTEGER(rb)[0] = 16;
+      setAttrib(col, install("base"), rb);
+      UNPROTECT(1);
+   }
+   UNPROTECT(1);
+   return col;
+}
+
+/// Reads the promotion of the integer columns from the schema element promote, which is
+/// "none" (default), "double" or "long". Returns false if the value is not one of these.
+static bool cmPromotionOption(SEXP rschema, CMPromotion& promotion)
+{
+   promotion = CM_PROMOTE_NONE;
+   SEXP rpromote = getListElement(rschema, "promote");
+   if (rpromote == R_NilValue) return true;
+   const char* p = CHAR(STRING_ELT(rpromote, 0));
+   if (strcmp(p, "double") == 0) promotion = CM_PROMOTE_DOUBLE;
+   else if (strcmp(p, "long") == 0) promotion = CM_PROMOTE_LONG;
+   else if (strcmp(p, "none") != 0) return false;
+   return true;
+}
+
+/// Replaces the integer column i of rframe with a double or a 64-bit integer column if any of
+/// the collectors cols, which have filled the slices of the column at offsets starts, has been
+/// promoted: the promoted collectors store their values, and the others convert their ints.
+/// Returns the type of the column, which is "double" or "long" after a promotion.
+static const char* cmPromoteColumn(SEXP rframe, int i, const char* type, const vector<CMColumnSink*>& cols,
+                                   const vector<int>& starts)
+{
+   if (strcmp(type, "integer") != 0) return type;
+   bool promoted = false;
+   CMPromotion promotion = CM_PROMOTE_NONE;
+   for (size_t k = 0; k < cols.size(); k++)
+   {
+      const CMRDataCollectorInt* c = static_cast<const CMRDataCollectorInt*>(cols[k]);
+      if (c->promoted()) promoted = true;
+      promotion = c->promotion();
+   }
+   if (!promoted) return type;
+   const char* wideType = promotion == CM_PROMOTE_DOUBLE ? "double" : "long";
+   SEXP col;
+   PROTECT(col = cmAllocColumn(wideType, length(VECTOR_ELT(rframe, i))));
+   for (size_t k = 0; k < cols.size(); k++)
+   {
+      static_cast<const CMRDataCollectorInt*>(cols[k])->storeWide(REAL(col) + starts[k]);
+   }
+   SET_VECTOR_ELT(rframe, i, col);
+   UNPROTECT(1);
+   return wideType;
+}
 
+/// Makes rframe a data frame with nrows rows: adds the names, the row names and the class.
+static void cmSetFrameAttributes(SEXP rframe, const vector<string>& colnames, int nrows)
+{
+   int ncols = colnames.size();
    SEXP rOutColNames;
    PROTECT(rOutColNames = allocVector(STRSXP, ncols));
    for (int i = 0; i < ncols; i++)
@@ -408,10 +725,6 @@ SEXP readCSV(SEXP rschema)
       SET_STRING_ELT(rOutColNames, i, mkChar(colnames[i].c_str()));
    }
    setAttrib(rframe, R_NamesSymbol, rOutColNames);
-   //for (int i = 0; i < ncols; i++) Rprintf("%d %s\n", i, colnames[i].c_str());
-
-
-   // Make it a data frame: add class and rownames
 
    SEXP rOutRowNames;
    PROTECT(rOutRowNames = allocVector(INTSXP, nrows));
@@ -426,17 +739,1465 @@ SEXP readCSV(SEXP rschema)
    PROTECT(cls = allocVector(STRSXP, 1));
    SET_STRING_ELT(cls, 0, mkChar("data.frame"));
    classgets(rframe, cls);
+   UNPROTECT(3);
+}
 
-   // Clean up
+/// Returns the statistics of a column of the given type as list(n, na, min, max, distinct),
+/// where min and max have the type and the class of the column, and are NA if the column has
+/// no values. The result is not protected.
+static SEXP cmColumnSummary(const CMColumnStats& stats, const char* type)
+{
+   bool empty = stats.count() == 0;
+   SEXP rmin, rmax;
+   if (strcmp(type, "integer") == 0)
+   {
+      PROTECT(rmin = ScalarInteger(empty ? NA_INTEGER : (int) stats.min()));
+      PROTECT(rmax = ScalarInteger(empty ? NA_INTEGER : (int) stats.max()));
+   }
+   else if (strcmp(type, "double") == 0)
+   {
+      PROTECT(rmin = ScalarReal(empty ? NA_REAL : stats.min()));
+      PROTECT(rmax = ScalarReal(empty ? NA_REAL : stats.max()));
+   }
+   else if (strcmp(type, "string") == 0)
+   {
+      PROTECT(rmin = ScalarString(empty ? NA_STRING : mkChar(stats.minString().c_str())));
+      PROTECT(rmax = ScalarString(empty ? NA_STRING : mkChar(stats.maxString().c_str())));
+   }
+   else
+   {
+      CMInt64 lmin = empty ? NA_LONG.L : stats.minInt64();
+      CMInt64 lmax = empty ? NA_LONG.L : stats.maxInt64();
+      PROTECT(rmin = cmAllocColumn(type, 1));
+      memcpy(REAL(rmin), &lmin, sizeof(lmin));
+      PROTECT(rmax = cmAllocColumn(type, 1));
+      memcpy(REAL(rmax), &lmax, sizeof(lmax));
+   }
 
+   const int NITEMS = 5;
+   const char* items[NITEMS] = { "n", "na", "min", "max", "distinct" };
+   SEXP rsummary;
+   PROTECT(rsummary = allocVector(VECSXP, NITEMS));
+   SET_VECTOR_ELT(rsummary, 0, ScalarInteger(stats.count()));
+   SET_VECTOR_ELT(rsummary, 1, ScalarInteger(stats.na()));
+   SET_VECTOR_ELT(rsummary, 2, rmin);
+   SET_VECTOR_ELT(rsummary, 3, rmax);
+   SET_VECTOR_ELT(rsummary, 4, ScalarReal(stats.distinct()));
+   SEXP rnames;
+   PROTECT(rnames = allocVector(STRSXP, NITEMS));
+   for (int k = 0; k < NITEMS; k++)
+   {
+      SET_STRING_ELT(rnames, k, mkChar(items[k]));
+   }
+   setAttrib(rsummary, R_NamesSymbol, rnames);
    UNPROTECT(4);
-   for (int k = 0; k < ncols; k++)
+   return rsummary;
+}
+
+/// Returns a list of the columns of rframe appended to the same columns of rfirst, with the
+/// attributes of the columns of rframe, or R_NilValue if the number or the types of the
+/// columns differ. The result is not protected.
+static SEXP cmConcatColumns(SEXP rfirst, SEXP rframe)
+{
+   int ncols = length(rframe);
+   if (!isNewList(rfirst) || length(rfirst) != ncols) return R_NilValue;
+   for (int i = 0; i < ncols; i++)
    {
-      delete lst[k];
+      if (TYPEOF(VECTOR_ELT(rfirst, i)) != TYPEOF(VECTOR_ELT(rframe, i))) return R_NilValue;
    }
-   if (istr.is_open()) istr.close();
+   SEXP res;
+   PROTECT(res = allocVector(VECSXP, ncols));
+   for (int i = 0; i < ncols; i++)
+   {
+      SEXP a = VECTOR_ELT(rfirst, i);
+      SEXP b = VECTOR_ELT(rframe, i);
+      int na = length(a);
+      int nb = length(b);
+      SEXP col = allocVector(TYPEOF(b), na + nb);
+      SET_VECTOR_ELT(res, i, col);
+      switch (TYPEOF(b))
+      {
+      case INTSXP:
+         memcpy(INTEGER(col), INTEGER(a), na * sizeof(int));
+         memcpy(INTEGER(col) + na, INTEGER(b), nb * sizeof(int));
+         break;
+      case REALSXP:
+         memcpy(REAL(col), REAL(a), na * sizeof(double));
+         memcpy(REAL(col) + na, REAL(b), nb * sizeof(double));
+         break;
+      default:
+         for (int k = 0; k < na; k++) SET_STRING_ELT(col, k, STRING_ELT(a, k));
+         for (int k = 0; k < nb; k++) SET_STRING_ELT(col, na + k, STRING_ELT(b, k));
+      }
+      DUPLICATE_ATTRIB(col, b);
+   }
+   UNPROTECT(1);
+   return res;
+}
 
-   return(rframe);
+/// Moves the first used[k] elements of the slices of the columns of rframe that start at
+/// starts[k] together, so that the columns begin with the used elements of all slices in
+/// order. Returns the number of used elements.
+static int cmCompactColumns(SEXP rframe, const vector<int>& starts, const vector<int>& used)
+{
+   int total = 0;
+   for (int k = 0, nk = starts.size(); k < nk; k++)
+   {
+      if (starts[k] != total)
+      {
+         for (int i = 0, ncols = length(rframe); i < ncols; i++)
+         {
+            SEXP col = VECTOR_ELT(rframe, i);
+            switch (TYPEOF(col))
+            {
+            case INTSXP:
+               memmove(INTEGER(col) + total, INTEGER(col) + starts[k], used[k] * sizeof(int));
+               break;
+            case REALSXP:
+               memmove(REAL(col) + total, REAL(col) + starts[k], used[k] * sizeof(double));
+               break;
+            default:
+               for (int r = 0; r < used[k]; r++) SET_STRING_ELT(col, total + r, STRING_ELT(col, starts[k] + r));
+            }
+         }
+      }
+      total += used[k];
+   }
+   return total;
+}
+
+//-----------------------------------------------------------------------------
+
+#ifndef MAYBE_SHARED
+#define MAYBE_SHARED(x) (NAMED(x) > 1)
+#endif
+#ifndef MAYBE_REFERENCED
+#define MAYBE_REFERENCED(x) (NAMED(x) > 0)
+#endif
+
+/// State of a chunked reader that is kept between the calls of readCSVChunk and chunkCSV:
+/// the open line stream positioned at the next row, and the parsed schema and filter.
+class CMRChunkReader
+{
+public:
+   CMLineStream lstr;            ///< Input positioned at the next line.
+   SfiDelimitedRecordSTD rec;    ///< Record used for splitting the lines.
+   vector<string> coltypes;      ///< Column types.
+   vector<string> colnames;      ///< Column names.
+   CMRowFilter filter;           ///< Rows to keep, empty to keep all.
+   int rows;                     ///< Number of rows returned so far.
+
+   CMRChunkReader(const string& delim) : rec(0, delim), rows(0) {}
+};
+
+/// Returns the reader of an external pointer created by openCSVReader, or raises an error if
+/// the reader has been closed.
+static CMRChunkReader* cmChunkReader(SEXP rreader)
+{
+   if (TYPEOF(rreader) != EXTPTRSXP) error("c_readCSVChunk: expecting a csvreader");
+   CMRChunkReader* reader = (CMRChunkReader*) R_ExternalPtrAddr(rreader);
+   if (reader == 0) error("c_readCSVChunk: the reader is closed");
+   return reader;
+}
+
+/// Finalizer of the reader external pointer; also called by closeCSVReader.
+static void cmFinalizeChunkReader(SEXP rreader)
+{
+   CMRChunkReader* reader = (CMRChunkReader*) R_ExternalPtrAddr(rreader);
+   if (reader == 0) return;
+   delete reader;
+   R_ClearExternalPtr(rreader);
+}
+
+/// Allocates a data frame of n rows with the columns of the reader. The result is not protected.
+static SEXP cmAllocChunk(const CMRChunkReader* reader, int n)
+{
+   int ncols = reader->coltypes.size();
+   SEXP rframe;
+   PROTECT(rframe = allocVector(VECSXP, ncols));
+   for (int i = 0; i < ncols; i++)
+   {
+      SET_VECTOR_ELT(rframe, i, cmAllocColumn(reader->coltypes[i].c_str(), n));
+   }
+   UNPROTECT(1);
+   return rframe;
+}
+
+/// Reads up to the number of rows in rframe from the reader into the columns of rframe, which
+/// is shortened and made a data frame if fewer rows are left. Returns the number of rows, or -1
+/// if the user interrupted the load.
+static int cmReadChunk(CMRChunkReader* reader, SEXP rframe)
+{
+   int ncols = reader->coltypes.size();
+   int n = ncols > 0 ? length(VECTOR_ELT(rframe, 0)) : 0;
+   vector<CMColumnSink*> sinks(ncols);
+   for (int i = 0; i < ncols; i++)
+   {
+      CMRDataCollector* c = cmNewCollector(reader->coltypes[i].c_str());
+      c->attach(VECTOR_ELT(rframe, i));
+      sinks[i] = c;
+   }
+   CMRLoadMonitor monitor(R_NilValue, false, 0);
+   CMParseOptions opt;
+   opt.monitor = &monitor;
+   opt.filter = reader->filter.empty() ? 0 : &reader->filter;
+   opt.maxRows = n;
+   int nread = cmParseLines(reader->lstr, reader->rec, sinks, opt);
+   for (int i = 0; i < ncols; i++)
+   {
+      delete sinks[i];
+   }
+   if (monitor.stopped()) return -1;
+   reader->rows += nread;
+   if (nread < n) cmShrinkColumns(rframe, nread);
+   cmSetFrameAttributes(rframe, reader->colnames, nread);
+   return nread;
+}
+
+//-----------------------------------------------------------------------------
+
+/// Creates a chunked reader from a schema with the elements filename, coltypes, header, colnames,
+/// delimiter, quoted, starts, widths and filter as for readCSV. The file is opened and
+/// positioned after the header, whose length, including the newline, is returned in dataStart.
+/// Errors are prefixed with caller.
+static CMRChunkReader* cmNewChunkReader(SEXP rschema, const char* caller, size_t& dataStart)
+{
+   if (!isNewList(rschema))
+   {
+      error("%s: expecting a list with schema as the only argument", caller);
+   }
+   SEXP rfilename = getListElement(rschema, "filename");
+   if (rfilename == R_NilValue) error("%s: missing 'filename' in the argument list", caller);
+   string filename(CHAR(STRING_ELT(rfilename, 0)));
+
+   SEXP rcoltypes = getListElement(rschema, "coltypes");
+   if (rcoltypes == R_NilValue || length(rcoltypes) == 0) error("%s: missing 'coltypes' in the argument list", caller);
+   int ncols = length(rcoltypes);
+   for (int i = 0; i < ncols; i++)
+   {
+      CMRDataCollector* c = cmNewCollector(CHAR(STRING_ELT(rcoltypes, i)));
+      if (c == 0) error("%s: unsupported column type '%s'", caller, CHAR(STRING_ELT(rcoltypes, i)));
+      delete c;
+   }
+
+   SEXP rcolnames = getListElement(rschema, "colnames");
+
+   SEXP rheader = getListElement(rschema, "header");
+   bool hasHeader = true;
+   if (rheader != R_NilValue) hasHeader = *(LOGICAL(rheader));
+
+   string delim(",");
+   SEXP rdelim = getListElement(rschema, "delimiter");
+   if (rdelim != R_NilValue)
+   {
+      delim = CHAR(STRING_ELT(rdelim, 0));
+      if (delim.find('\n') != string::npos) error("%s: delimiter can't contain a newline", caller);
+   }
+
+   SEXP rfilter = getListElement(rschema, "filter");
+   if (rfilter != R_NilValue && !isNewList(rfilter)) error("%s: 'filter' must be a list of predicates", caller);
+
+   SEXP rquoted = getListElement(rschema, "quoted");
+   bool quoted = rquoted != R_NilValue && asLogical(rquoted) == TRUE;
+
+   vector<int> fieldStarts, fieldWidths;
+   char fmsg[256];
+   if (!cmFixedWidths(rschema, fieldStarts, fieldWidths, fmsg, sizeof(fmsg))) error("%s: %s", caller, fmsg);
+
+   CMRChunkReader* reader = new CMRChunkReader(delim);
+   if (!reader->lstr.open(filename.c_str()))
+   {
+      delete reader;
+      error("%s: can't open file %s.", caller, filename.c_str());
+   }
+   reader->lstr.setQuoted(quoted);
+   reader->rec.setQuoted(quoted);
+   reader->rec.setFixedWidths(fieldStarts, fieldWidths);
+
+   vector<string> headers;
+   dataStart = 0;
+   if (hasHeader)
+   {
+      char* s = reader->lstr.getline();
+      if (s)
+      {
+         dataStart = reader->lstr.len() + 1;
+         reader->rec.split(s, reader->lstr.len());
+         for (int i = 0, n = reader->rec.size(); i < n; i++)
+         {
+            headers.push_back(reader->rec.get(i));
+         }
+      }
+      if (cmNamedColumns(rcoltypes))
+      {
+         vector<int> positions;
+         char msg[256];
+         if (!cmSelectColumns(rcoltypes, headers, positions, msg, sizeof(msg)))
+         {
+            delete reader;
+            error("%s: %s", caller, msg);
+         }
+         reader->rec.setColumns(positions);
+      }
+   }
+   cmColumnNames(rcolnames, headers, ncols, reader->colnames);
+   for (int i = 0; i < ncols; i++)
+   {
+      reader->coltypes.push_back(CHAR(STRING_ELT(rcoltypes, i)));
+   }
+
+   if (rfilter != R_NilValue)
+   {
+      char msg[256];
+      if (!cmBuildFilter(rfilter, rcoltypes, reader->colnames, reader->filter, msg, sizeof(msg)))
+      {
+         delete reader;
+         error("%s: %s", caller, msg);
+      }
+   }
+   return reader;
+}
+
+//-----------------------------------------------------------------------------
+
+extern "C"
+{
+//-----------------------------------------------------------------------------
+
+/// Get the list element named str or return NULL - from the manual.
+SEXP getListElement(SEXP list, const char* str)
+{
+   SEXP elmt = R_NilValue;
+   SEXP names = getAttrib(list, R_NamesSymbol);
+   for (int i = 0, n = length(list); i < n; i++)
+   {
+      if (strcmp(CHAR(STRING_ELT(names, i)), str) == 0)
+      {
+         elmt = VECTOR_ELT(list, i);
+         break;
+      }
+   }
+   return elmt;
+}
+
+//-----------------------------------------------------------------------------
+
+SEXP numLines(SEXP filename)
+{
+   const char* fname = CHAR(STRING_ELT(filename, 0));
+   CMLineStream lstr(fname);
+   char* s;
+   int n = 0;
+   while ((s = lstr.getline()))
+   {
+      //Rprintf("--->%s\n", s);
+      n++;
+   }
+   SEXP ret;
+   PROTECT(ret = allocVector(INTSXP,1));
+   INTEGER(ret)[0] = n;
+   UNPROTECT(1);
+   return ret;
+}
+
+//-----------------------------------------------------------------------------
+
+// dyn.load("cmrlib.so")
+// lst <- .Call("readCSV", list(filename="blah.csv", coltypes=c("integer", "integer", "double", "string"), nrows=10))
+
+/// Reads a CSV file according to provided schema.
+/// The argument is a list of the following structure:
+/// - filename - name of the CSV file
+/// - coltypes - (required) vector of column types; accepted types are integer, logical, string, double
+/// - nrows    - resulting number of rows, overriding actual number of rows in the file; saves time
+/// - header   - TRUE (default) or FALSE; source of column names if \c colnames is not provided
+/// - colnames - column names for all columns; overrides header names when present
+/// - verbose  - flag indicating if progress messages should be printed.
+/// - delimiter - delimiter of one or more characters (default is comma), or an empty string for
+///              runs of spaces and tabs.
+/// - profile  - flag indicating if load statistics should be returned in attribute "profile".
+/// - progress - TRUE to print the progress, or an R function(rows, fraction) to call with it.
+/// - filter   - list of predicates (see cmBuildFilter); only the rows matching all of them are loaded.
+/// - sample   - number of rows to sample at random instead of loading all rows; nrows is ignored.
+/// - sample.method - "reservoir" (default) for an exact uniform sample, or "offset" for an
+///              approximate sample of lines at random byte offsets.
+/// - quoted   - flag indicating that the fields are quoted as in RFC 4180: the quotes are removed,
+///              and the quoted fields can contain delimiters, quotes and newlines.
+/// - starts, widths - offsets (zero-based) and widths of the fields of a fixed-width file, which
+///              is read without a delimiter; the spaces around the fields are removed.
+/// - stats    - flag indicating if the number of values and NAs, the range and the approximate
+///              number of distinct values of each column should be collected while parsing
+///              and returned in attribute "summary".
+/// - promote  - "none" (default), "double" or "long": the type that an integer column is changed
+///              to during the load when it has a value outside of the int range, which is NA
+///              with "none".
+/// The load can be interrupted by the user; the memory is released before R handles the interrupt.
+/// If number of columns, which is inferred from the number of provided coltypes, is greater than
+/// the actual number of columns, the extra columns are still created. If the number of columns is
+/// less than the actual number of columns in the file, the extra columns in the file are ignored.
+SEXP readCSV(SEXP rschema)
+{
+   // Check the arguments.
+
+   if (!isNewList(rschema))
+   {
+      error("c_readCSV: expecting a list with schema as the only argument");
+   }
+   SEXP rfilename = getListElement(rschema, "filename");
+   if (rfilename == R_NilValue) error("c_readCSV: missing 'filename' in the argument list");
+   string filename(CHAR(STRING_ELT(rfilename, 0)));
+
+   SEXP rcoltypes = getListElement(rschema, "coltypes");
+   if (rcoltypes == R_NilValue || length(rcoltypes) == 0) error("c_readCSV: missing 'coltypes' in the argument list");
+
+   SEXP rcolnames = getListElement(rschema, "colnames");
+
+   SEXP rheader = getListElement(rschema, "header");
+   bool hasHeader = true;
+   if (rheader != R_NilValue) hasHeader = *(LOGICAL(rheader));
+
+   SEXP rnrows = getListElement(rschema, "nrows");
+   int nrows = 0;
+   if (rnrows != R_NilValue)
+   {
+      nrows = (int) *(REAL(rnrows));
+      if (nrows < 1) error("c_readCSV: 'nrows' must be positive");
+   }
+   bool verbose = false;
+   SEXP rverbose = getListElement(rschema, "verbose");
+   PROTECT(rverbose = coerceVector(rverbose, INTSXP));
+   if (rverbose != R_NilValue) verbose = (bool) *(INTEGER(rverbose));
+   UNPROTECT(1);
+
+   string delim(",");
+   SEXP rdelim = getListElement(rschema, "delimiter");
+   if (rdelim != R_NilValue)
+   {
+      delim = CHAR(STRING_ELT(rdelim, 0));
+      if (delim.find('\n') != string::npos) error("c_readCSV: delimiter can't contain a newline");
+   }
+
+   SEXP rprofile = getListElement(rschema, "profile");
+   bool profile = rprofile != R_NilValue && asLogical(rprofile) == TRUE;
+
+   SEXP rfilter = getListElement(rschema, "filter");
+   if (rfilter != R_NilValue && !isNewList(rfilter)) error("c_readCSV: 'filter' must be a list of predicates");
+
+   SEXP rsample = getListElement(rschema, "sample");
+   int sampleSize = -1;
+   bool sampleOffsets = false;
+   if (rsample != R_NilValue)
+   {
+      sampleSize = asInteger(rsample);
+      if (sampleSize == NA_INTEGER || sampleSize < 0) error("c_readCSV: 'sample' must be a non-negative number");
+      SEXP rmethod = getListElement(rschema, "sample.method");
+      if (rmethod != R_NilValue)
+      {
+         const char* method = CHAR(STRING_ELT(rmethod, 0));
+         if (strcmp(method, "offset") == 0) sampleOffsets = true;
+         else if (strcmp(method, "reservoir") != 0) error("c_readCSV: unknown sample.method '%s'", method);
+      }
+   }
+
+   SEXP rprogress = getListElement(rschema, "progress");
+   SEXP progressFn = R_NilValue;
+   bool progressPrint = false;
+   if (isFunction(rprogress)) progressFn = rprogress;
+   else if (rprogress != R_NilValue) progressPrint = asLogical(rprogress) == TRUE;
+
+   SEXP rstats = getListElement(rschema, "stats");
+   bool collectStats = rstats != R_NilValue && asLogical(rstats) == TRUE;
+
+   SEXP rquoted = getListElement(rschema, "quoted");
+   bool quoted = rquoted != R_NilValue && asLogical(rquoted) == TRUE;
+   if (quoted && sampleSize >= 0 && sampleOffsets)
+   {
+      error("c_readCSV: sample.method 'offset' is not supported for quoted fields");
+   }
+
+   vector<int> fieldStarts, fieldWidths;
+   char fmsg[256];
+   if (!cmFixedWidths(rschema, fieldStarts, fieldWidths, fmsg, sizeof(fmsg))) error("c_readCSV: %s", fmsg);
+
+   CMPromotion promotion;
+   if (!cmPromotionOption(rschema, promotion)) error("c_readCSV: 'promote' must be \"none\", \"double\" or \"long\"");
+
+   int ncols = length(rcoltypes);
+
+   // Before going any further, check if the file is readable.
+
+   CMTimer theader, tcount, tparse, tframe;
+   CMTimer tstr(false); // started and stopped for every string field
+   size_t countBytes = 0;
+   theader.start();
+
+   //Rprintf("Trying to load %s\n", filename.c_str());
+   ifstream istr(filename.c_str());
+   if (istr.fail())
+   {
+      error("c_readCSV: can't open file %s.", filename.c_str());
+   }
+
+   // Read the headers if necessary.
+
+   string buffer;
+   SfiDelimitedRecordSTD rec(0, delim);
+   rec.setQuoted(quoted);
+   rec.setFixedWidths(fieldStarts, fieldWidths);
+   vector<string> headers;
+   int lineCount = 0;
+   size_t dataStart = 0;
+   if (hasHeader)
+   {
+      getline(istr, buffer);
+      char empty[1] = { 0 };
+      rec.split(buffer.empty() ? empty : &buffer[0], buffer.size());
+      for (int i = 0, n = rec.size(); i < n; i++)
+      {
+         headers.push_back(rec.get(i));
+      }
+      lineCount++;
+      if (istr) dataStart = (size_t) istr.tellg();
+   }
+   istr.close();
+
+   // With named coltypes, the header maps the fields of the file to the columns, and the
+   // record returns the selected fields only.
+
+   if (hasHeader && cmNamedColumns(rcoltypes))
+   {
+      vector<int> positions;
+      char msg[256];
+      if (!cmSelectColumns(rcoltypes, headers, positions, msg, sizeof(msg))) error("c_readCSV: %s", msg);
+      rec.setColumns(positions);
+   }
+   theader.stop();
+
+   // Figure out column names.
+
+   vector<string> colnames;
+   cmColumnNames(rcolnames, headers, ncols, colnames);
+
+   // Set up the row filter.
+
+   CMRowFilter filter;
+   if (rfilter != R_NilValue)
+   {
+      char msg[256];
+      if (!cmBuildFilter(rfilter, rcoltypes, colnames, filter, msg, sizeof(msg)))
+      {
+         filter.clear();
+         error("c_readCSV: %s", msg);
+      }
+   }
+
+   double fileSize = 0;
+   if (progressPrint || progressFn != R_NilValue)
+   {
+      istr.open(filename.c_str(), ios::binary);
+      istr.seekg(0, ios::end);
+      if (istr) fileSize = (double) istr.tellg();
+      istr.close();
+      istr.clear();
+   }
+
+   // The data lines are opened where they are read, so that no file is left open by an
+   // interrupted count.
+   CMLineStream lstr;
+
+   // With sampling, draw the sample of lines, which determines the number of rows. The
+   // reservoir sample takes a pass over the file, and the offset sample takes a seek per line.
+   // Otherwise, count the lines if nrows hasn't been provided. With a filter, count the
+   // matching lines, so that the columns are allocated for the matches only. With quoted
+   // fields, the newlines are counted regardless of the quotes, which may allocate more rows
+   // than there are records.
+
+   vector<CMSampledLine> sampled;
+   if (sampleSize >= 0)
+   {
+      tcount.start();
+      CMRRandom rng;
+      bool ok = true;
+      GetRNGstate();
+      if (sampleOffsets)
+      {
+         cmSampleOffsets(filename.c_str(), dataStart, rec, filter.empty() ? 0 : &filter, sampleSize, rng, sampled);
+      }
+      else
+      {
+         CMRLoadMonitor smonitor(progressFn, progressPrint, fileSize);
+         cmOpenLines(lstr, filename.c_str(), quoted, hasHeader);
+         ok = cmSampleReservoir(lstr, rec, filter.empty() ? 0 : &filter, sampleSize, rng, sampled, &smonitor);
+      }
+      PutRNGstate();
+      if (!ok)
+      {
+         vector<CMSampledLine>().swap(sampled);
+         filter.clear();
+         lstr.close();
+         error("c_readCSV: interrupted");
+      }
+      nrows = sampled.size();
+      if (verbose) Rprintf("Sampled %d lines.\n", nrows);
+      tcount.stop();
+   }
+   else
+   if (nrows == 0 && !filter.empty())
+   {
+      tcount.start();
+      CMLineStream cstr(filename.c_str());
+      cstr.setQuoted(quoted);
+      if (hasHeader) cstr.getline();
+      CMRLoadMonitor cmonitor(R_NilValue, false, 0);
+      nrows = cmCountMatches(cstr, rec, filter, &cmonitor);
+      countBytes = cstr.bufferBytes();
+      cstr.close();
+      if (nrows < 0)
+      {
+         filter.clear();
+         error("c_readCSV: interrupted");
+      }
+      if (verbose) Rprintf("Counted %d matching lines.\n", nrows);
+      tcount.stop();
+   }
+   else
+   if (nrows == 0)
+   {
+      tcount.start();
+      istr.open(filename.c_str());
+      const int SZ = 1024 * 1024;
+      countBytes = SZ;
+      char buff[SZ];
+      int nn = 0;
+      int gotsz = 0;
+      int nchunks = 0;
+      while (!istr.eof() && !istr.fail())
+      {
+         if (++nchunks % 64 == 0 && !cmNotInterrupted())
+         {
+            istr.close();
+            error("c_readCSV: interrupted");
+         }
+         istr.read(buff, SZ);
+         gotsz = istr.gcount();
+//         for (int i = 0; i < gotsz; i++)
+//         {
+//            if (buff[i] == '\n') nn++;
+//         }
+         char* p = buff;
+         while ((p = (char*) memchr(p, '\n', (buff + gotsz) - p)))
+         {
+            nn++;
+            p++;
+         }
+      }
+      if (gotsz > 0 && buff[gotsz - 1] != '\n') nn++;
+
+      nrows = nn - (int) hasHeader;
+      if (nrows < 0) nrows = 0;
+      if (verbose) Rprintf("Counted %d lines.\n", nn);
+      istr.close();
+      tcount.stop();
+   }
+
+   // Count the lines if nrows hasn't been provided.
+
+/*   if (nrows == 0)
+   {
+      if (!hasHeader) getline(istr, buffer);
+      while (istr)
+      {
+         lineCount++;
+         getline(istr, buffer);
+      }
+      //istr.seekg(ios_base::beg); // rewind
+      istr.close();
+      istr.open(filename.c_str());
+      if (hasHeader) getline(istr, buffer);
+      nrows = lineCount - (int) hasHeader;
+      Rprintf("Counted %d rows\n", nrows);
+   }
+*/
+   // Allocate and attach collectors to resulting columns. With stats, the collectors update
+   // the statistics of each column as they store the values.
+
+   vector<CMRDataCollector*> lst(ncols);
+   vector<CMColumnStats> stats(collectStats ? ncols : 0);
+
+   tframe.start();
+   SEXP rframe; // the return value
+   PROTECT(rframe = allocVector(VECSXP, ncols));
+   for (int i = 0; i < ncols; i++)
+   {
+      const char* type = CHAR(STRING_ELT(rcoltypes, i));
+      lst[i] = cmNewCollector(type, promotion);
+      if (lst[i] == 0)
+      {
+         UNPROTECT(1);
+         for (int k = 0; k < i; k++)
+         {
+            delete lst[k];
+         }
+         if (istr.is_open()) istr.close();
+         filter.clear();
+         vector<CMSampledLine>().swap(sampled);
+         vector<CMColumnStats>().swap(stats);
+         lstr.close();
+         error("c_readCSV: unsupported column type '%s'", type);
+      }
+      SET_VECTOR_ELT(rframe, i, cmAllocColumn(type, nrows));
+      lst[i]->attach(VECTOR_ELT(rframe, i));
+      if (collectStats) lst[i]->setStats(&stats[i]);
+   }
+
+   tframe.stop();
+
+   // Load the CSV
+
+   vector<CMColumnSink*> sinks(lst.begin(), lst.end());
+   vector<CMTimedSink*> timed;
+   vector<int> failures(ncols, 0);
+   if (profile)
+   {
+      // measure the time spent in creating the R strings
+      for (int i = 0; i < ncols; i++)
+      {
+         if (strcmp(CHAR(STRING_ELT(rcoltypes, i)), "string") != 0) continue;
+         timed.push_back(new CMTimedSink(sinks[i], &tstr));
+         sinks[i] = timed.back();
+      }
+   }
+
+   CMRLoadMonitor monitor(progressFn, progressPrint, fileSize);
+   tparse.start();
+   int nread = 0;
+   if (sampleSize >= 0)
+   {
+      // the sampled lines have already been filtered
+      char empty[1] = { 0 };
+      for (int r = 0; r < nrows; r++)
+      {
+         string& line = sampled[r].line;
+         rec.split(line.empty() ? empty : &line[0], line.size());
+         cmAppendRecord(rec, sinks, profile ? &failures : 0, r);
+      }
+      nread = nrows;
+      vector<CMSampledLine>().swap(sampled);
+   }
+   else
+   {
+      CMParseOptions opt;
+      opt.failures = profile ? &failures : 0;
+      opt.monitor = &monitor;
+      opt.filter = filter.empty() ? 0 : &filter;
+      opt.maxRows = nrows;
+      cmOpenLines(lstr, filename.c_str(), quoted, hasHeader);
+      nread = cmParseLines(lstr, rec, sinks, opt);
+   }
+   for (int k = 0, n = timed.size(); k < n; k++)
+   {
+      delete timed[k];
+   }
+   if (monitor.stopped())
+   {
+      UNPROTECT(1);
+      for (int k = 0; k < ncols; k++)
+      {
+         delete lst[k];
+      }
+      lstr.close();
+      filter.clear();
+      vector<CMColumnStats>().swap(stats);
+      if (monitor.interrupted()) error("c_readCSV: interrupted after %d rows", nread);
+      error("c_readCSV: the progress function failed after %d rows", nread);
+   }
+   monitor.finish(nread);
+
+   // Replace the integer columns that had values outside of the int range, if they are promoted.
+
+   vector<const char*> types(ncols);
+   for (int i = 0; i < ncols; i++)
+   {
+      const char* type = CHAR(STRING_ELT(rcoltypes, i));
+      types[i] = cmPromoteColumn(rframe, i, type, vector<CMColumnSink*>(1, lst[i]), vector<int>(1, 0));
+      if (verbose && types[i] != type) Rprintf("Column %s promoted to %s.\n", colnames[i].c_str(), types[i]);
+   }
+
+   // With a filter and a given nrows, there may be fewer matching rows than allocated, and
+   // with quoted fields, fewer records than lines.
+
+   if ((!filter.empty() || quoted) && nread < nrows)
+   {
+      cmShrinkColumns(rframe, nread);
+      nrows = nread;
+   }
+/*
+
+   istr.open(filename.c_str());
+   if (hasHeader) getline(istr, buffer);
+   getline(istr, buffer);
+   rec = buffer.c_str();
+   while (istr)
+   {
+      lineCount++;
+      rec = buffer.c_str();
+
+      // TODO: check that record type matches the schema
+
+      for (int i = 0, n = cm::cmMin(ncols, rec.size()); i < n; i++)
+      {
+         lst[i]->append(rec[i]);
+      }
+      //cout << buffer << endl;
+      //cout << rec.size() << " " << rec[0] << " " << rec[3] << endl;
+
+      getline(istr, buffer);
+   }
+*/
+   tparse.stop();
+
+   // Set the column names and make it a data frame: add class and rownames
+
+   tframe.start();
+   cmSetFrameAttributes(rframe, colnames, nrows);
+   tframe.stop();
+
+   if (collectStats)
+   {
+      SEXP rsummary;
+      PROTECT(rsummary = allocVector(VECSXP, ncols));
+      for (int i = 0; i < ncols; i++)
+      {
+         SET_VECTOR_ELT(rsummary, i, cmColumnSummary(stats[i], types[i]));
+      }
+      setAttrib(rsummary, R_NamesSymbol, getAttrib(rframe, R_NamesSymbol));
+      setAttrib(rframe, install("summary"), rsummary);
+      UNPROTECT(1);
+   }
+
+   if (profile)
+   {
+      // The wall-clock time spent in the string collectors is reported separately from
+      // parsing. Its CPU time is not measured and is included in the parse phase.
+      const int NPHASES = 5;
+      const char* phases[NPHASES] = { "header", "count", "parse", "strings", "frame" };
+      double wall[NPHASES] = { theader.wall(), tcount.wall(), tparse.wall() - tstr.wall(),
+                               tstr.wall(), tframe.wall() };
+      double cpu[NPHASES] = { theader.cpu(), tcount.cpu(), tparse.cpu(), NA_REAL, tframe.cpu() };
+
+      SEXP rtime;
+      PROTECT(rtime = allocVector(VECSXP, 3));
+      SEXP rphase = allocVector(STRSXP, NPHASES);
+      SET_VECTOR_ELT(rtime, 0, rphase);
+      SEXP rwall = allocVector(REALSXP, NPHASES);
+      SET_VECTOR_ELT(rtime, 1, rwall);
+      SEXP rcpu = allocVector(REALSXP, NPHASES);
+      SET_VECTOR_ELT(rtime, 2, rcpu);
+      for (int k = 0; k < NPHASES; k++)
+      {
+         SET_STRING_ELT(rphase, k, mkChar(phases[k]));
+         REAL(rwall)[k] = wall[k];
+         REAL(rcpu)[k] = cpu[k];
+      }
+      SEXP rtimenames;
+      PROTECT(rtimenames = allocVector(STRSXP, 3));
+      SET_STRING_ELT(rtimenames, 0, mkChar("phase"));
+      SET_STRING_ELT(rtimenames, 1, mkChar("wall"));
+      SET_STRING_ELT(rtimenames, 2, mkChar("cpu"));
+      setAttrib(rtime, R_NamesSymbol, rtimenames);
+
+      SEXP rfailures;
+      PROTECT(rfailures = allocVector(INTSXP, ncols));
+      for (int i = 0; i < ncols; i++)
+      {
+         INTEGER(rfailures)[i] = failures[i];
+      }
+      setAttrib(rfailures, R_NamesSymbol, getAttrib(rframe, R_NamesSymbol));
+
+      // The count pass is finished before the line stream is opened, so the peak is the
+      // larger of the two buffers.
+      size_t bufferBytes = lstr.bufferBytes();
+      if (countBytes > bufferBytes) bufferBytes = countBytes;
+
+      SEXP rprof;
+      PROTECT(rprof = allocVector(VECSXP, 5));
+      SET_VECTOR_ELT(rprof, 0, rtime);
+      SET_VECTOR_ELT(rprof, 1, ScalarReal((double) lstr.bytesRead()));
+      SET_VECTOR_ELT(rprof, 2, ScalarInteger(lstr.spannedLines()));
+      SET_VECTOR_ELT(rprof, 3, rfailures);
+      SET_VECTOR_ELT(rprof, 4, ScalarReal((double) bufferBytes));
+      SEXP rprofnames;
+      PROTECT(rprofnames = allocVector(STRSXP, 5));
+      SET_STRING_ELT(rprofnames, 0, mkChar("time"));
+      SET_STRING_ELT(rprofnames, 1, mkChar("bytes"));
+      SET_STRING_ELT(rprofnames, 2, mkChar("spanned.lines"));
+      SET_STRING_ELT(rprofnames, 3, mkChar("failures"));
+      SET_STRING_ELT(rprofnames, 4, mkChar("buffer.bytes"));
+      setAttrib(rprof, R_NamesSymbol, rprofnames);
+      setAttrib(rframe, install("profile"), rprof);
+      UNPROTECT(5);
+   }
+
+   // Clean up
+
+   UNPROTECT(1);
+   for (int k = 0; k < ncols; k++)
+   {
+      delete lst[k];
+   }
+   if (istr.is_open()) istr.close();
+
+   return(rframe);
+}
+
+//-----------------------------------------------------------------------------
+
+/// Opens a CSV file for reading in chunks with readCSVChunk or chunkCSV. The argument is a list
+/// with the elements filename, coltypes, header, colnames, delimiter and filter as for readCSV.
+/// Returns an external pointer to the reader, which keeps the file open until closeCSVReader is
+/// called, the end of the file is reached or the pointer is garbage collected.
+SEXP openCSVReader(SEXP rschema)
+{
+   size_t dataStart;
+   CMRChunkReader* reader = cmNewChunkReader(rschema, "c_openCSVReader", dataStart);
+
+   SEXP rreader;
+   PROTECT(rreader = R_MakeExternalPtr(reader, install("csvreader"), R_NilValue));
+   R_RegisterCFinalizerEx(rreader, cmFinalizeChunkReader, TRUE);
+   UNPROTECT(1);
+   return rreader;
+}
+
+//-----------------------------------------------------------------------------
+
+/// Returns the next rows of a reader created by openCSVReader as a data frame: n rows, or
+/// fewer at the end of the file, where the data frame has no rows.
+SEXP readCSVChunk(SEXP rreader, SEXP rn)
+{
+   CMRChunkReader* reader = cmChunkReader(rreader);
+   int n = asInteger(rn);
+   if (n == NA_INTEGER || n < 1) error("c_readCSVChunk: the chunk size must be positive");
+
+   SEXP rframe;
+   PROTECT(rframe = cmAllocChunk(reader, n));
+   int nread = cmReadChunk(reader, rframe);
+   UNPROTECT(1);
+   if (nread < 0)
+   {
+      cmFinalizeChunkReader(rreader);
+      error("c_readCSVChunk: interrupted; the reader is closed");
+   }
+   return rframe;
+}
+
+//-----------------------------------------------------------------------------
+
+/// Reads the remaining rows of a reader created by openCSVReader in chunks of n rows and calls
+/// the R function fn with each chunk as a data frame. Returns a list of the results of fn.
+/// The columns of a chunk are reused for the next chunk unless fn has kept a reference to the
+/// chunk or to any of its columns, so that streaming through a file does not allocate new
+/// columns for every chunk. If fn signals an error, the reader is left after that chunk.
+SEXP chunkCSV(SEXP rreader, SEXP rn, SEXP fn)
+{
+   CMRChunkReader* reader = cmChunkReader(rreader);
+   int n = asInteger(rn);
+   if (n == NA_INTEGER || n < 1) error("c_chunkCSV: the chunk size must be positive");
+   if (!isFunction(fn)) error("c_chunkCSV: expecting a function");
+
+   SEXP res;
+   PROTECT_INDEX ires;
+   PROTECT_WITH_INDEX(res = allocVector(VECSXP, 16), &ires);
+   SEXP rframe;
+   PROTECT_INDEX iframe;
+   PROTECT_WITH_INDEX(rframe = cmAllocChunk(reader, n), &iframe);
+   int nres = 0;
+   while (true)
+   {
+      int nread = cmReadChunk(reader, rframe);
+      if (nread < 0)
+      {
+         UNPROTECT(2);
+         cmFinalizeChunkReader(rreader);
+         error("c_chunkCSV: interrupted after %d chunks; the reader is closed", nres);
+      }
+      if (nread == 0) break;
+
+      SEXP call, val;
+      int err = 0;
+      PROTECT(call = lang2(fn, rframe));
+      val = R_tryEval(call, R_GlobalEnv, &err);
+      SETCAR(CDR(call), R_NilValue); // drop the reference of the call to the chunk
+      UNPROTECT(1);
+      if (err)
+      {
+         UNPROTECT(2);
+         error("c_chunkCSV: the function failed on chunk %d", nres + 1);
+      }
+      if (nres == length(res)) REPROTECT(res = lengthgets(res, 2 * nres), ires);
+      SET_VECTOR_ELT(res, nres++, val);
+      if (nread < n) break;
+
+      // Reuse the columns unless the function kept a reference to them.
+      bool shared = MAYBE_REFERENCED(rframe);
+      for (int i = 0, ncols = length(rframe); i < ncols && !shared; i++)
+      {
+         shared = MAYBE_SHARED(VECTOR_ELT(rframe, i));
+      }
+      if (shared) REPROTECT(rframe = cmAllocChunk(reader, n), iframe);
+   }
+   res = lengthgets(res, nres);
+   UNPROTECT(2);
+   return res;
+}
+
+//-----------------------------------------------------------------------------
+
+/// Closes a reader created by openCSVReader. Returns the number of rows read.
+SEXP closeCSVReader(SEXP rreader)
+{
+   if (TYPEOF(rreader) != EXTPTRSXP) error("c_closeCSVReader: expecting a csvreader");
+   CMRChunkReader* reader = (CMRChunkReader*) R_ExternalPtrAddr(rreader);
+   int rows = reader ? reader->rows : NA_INTEGER;
+   cmFinalizeChunkReader(rreader);
+   return ScalarInteger(rows);
+}
+
+//-----------------------------------------------------------------------------
+
+/// Loads the rows appended to a file since the previous load. The argument is a list with the
+/// elements filename, coltypes, header, colnames, delimiter and filter as for readCSV, and
+/// - state  - the "tail.state" attribute of the result of the previous load, or NULL to load
+///            the file from the beginning; a list with the elements
+///            offset   - the end of the last complete line loaded;
+///            rows     - the number of rows loaded so far;
+///            checksum - the checksum of the last bytes before offset (see cmTailChecksum).
+/// - append - optional data frame with the same columns to which the new rows are appended.
+/// Only complete lines are loaded; a last line without a newline is left for the next load.
+/// If the file is shorter than offset or the checksum differs, the file is assumed to have been
+/// replaced, and it is loaded from the beginning with a warning; append is then ignored.
+/// Returns a data frame with the attribute "tail.state" for the next load, which also has the
+/// element reset indicating that the file was loaded from the beginning.
+SEXP tailCSV(SEXP rschema)
+{
+   size_t dataStart;
+   CMRChunkReader* reader = cmNewChunkReader(rschema, "c_tailCSV", dataStart);
+   SEXP rfilename = getListElement(rschema, "filename");
+   string filename(CHAR(STRING_ELT(rfilename, 0)));
+   SEXP rstate = getListElement(rschema, "state");
+   SEXP rappend = getListElement(rschema, "append");
+   if (!isNewList(rstate))
+   {
+      delete reader;
+      error("c_tailCSV: 'state' must be a list");
+   }
+
+   ifstream istr(filename.c_str(), ios::binary);
+   size_t size = cmStreamSize(istr);
+   double rows = 0;
+   size_t start = dataStart;
+   bool reset = false;
+   if (rstate != R_NilValue)
+   {
+      // An offset before the first data line means that nothing has been loaded yet.
+      double offset = asReal(getListElement(rstate, "offset"));
+      double checksum = asReal(getListElement(rstate, "checksum"));
+      reset = ISNAN(offset) || offset > size ||
+              (offset > dataStart && checksum != cmTailChecksum(istr, (size_t) offset, CM_TAIL_WINDOW));
+      if (!reset && offset > dataStart)
+      {
+         start = (size_t) offset;
+         rows = asReal(getListElement(rstate, "rows"));
+      }
+   }
+   if (start > size) start = size;
+   size_t end = cmLastLineEnd(istr, start, size);
+   int nlines = cmCountNewlines(istr, start, end);
+   unsigned int checksum = cmTailChecksum(istr, end, CM_TAIL_WINDOW);
+   istr.close();
+   if (reset) warning("c_tailCSV: %s has changed since the last load; reading from the beginning", filename.c_str());
+
+   SEXP rframe;
+   PROTECT(rframe = cmAllocChunk(reader, nlines));
+   int nread = 0;
+   if (!reader->lstr.open(filename.c_str(), start, end))
+   {
+      UNPROTECT(1);
+      delete reader;
+      error("c_tailCSV: can't open file %s.", filename.c_str());
+   }
+   nread = cmReadChunk(reader, rframe);
+   if (nread < 0)
+   {
+      UNPROTECT(1);
+      delete reader;
+      error("c_tailCSV: interrupted");
+   }
+
+   if (rappend != R_NilValue && !reset)
+   {
+      SEXP rcols = cmConcatColumns(rappend, rframe);
+      if (rcols == R_NilValue)
+      {
+         UNPROTECT(1);
+         delete reader;
+         error("c_tailCSV: the columns of 'append' don't match the column types");
+      }
+      UNPROTECT(1);
+      PROTECT(rframe = rcols);
+      cmSetFrameAttributes(rframe, reader->colnames, length(VECTOR_ELT(rframe, 0)));
+   }
+   delete reader;
+
+   SEXP rnewstate;
+   PROTECT(rnewstate = allocVector(VECSXP, 4));
+   SET_VECTOR_ELT(rnewstate, 0, ScalarReal((double) end));
+   SET_VECTOR_ELT(rnewstate, 1, ScalarReal(rows + nread));
+   SET_VECTOR_ELT(rnewstate, 2, ScalarReal((double) checksum));
+   SET_VECTOR_ELT(rnewstate, 3, ScalarLogical(reset));
+   SEXP rnames;
+   PROTECT(rnames = allocVector(STRSXP, 4));
+   SET_STRING_ELT(rnames, 0, mkChar("offset"));
+   SET_STRING_ELT(rnames, 1, mkChar("rows"));
+   SET_STRING_ELT(rnames, 2, mkChar("checksum"));
+   SET_STRING_ELT(rnames, 3, mkChar("reset"));
+   setAttrib(rnewstate, R_NamesSymbol, rnames);
+   setAttrib(rframe, install("tail.state"), rnewstate);
+   UNPROTECT(3);
+   return rframe;
+}
+
+//-----------------------------------------------------------------------------
+
+// The files of readCSVFiles are loaded in two parallel passes over the files: the first one
+// counts the rows of each file, which gives the slice of the output columns that each file
+// fills, and after the columns have been allocated once for all rows, the second one parses
+// the files into their slices. The threads write the numeric values directly into the R
+// vectors, but don't call the R API, so the strings are kept by the collectors until the
+// main thread creates the R strings after the parse. With more threads than files, the files
+// are split into byte ranges of whole records (see CMFileSplit.h), which are loaded the same
+// way as separate files.
+
+/// Reads several CSV files with the same columns into one data frame. The argument is a list
+/// with the elements as for readCSV, except that
+/// - filenames - replaces filename and contains the names of the files;
+/// - header    - a logical vector with an element for each file;
+/// - nrows, profile, progress, sample and stats are not supported.
+/// The column names are taken from colnames or from the header of the first file that has one.
+/// With named coltypes, the columns are found by name in the header of each file, so the files
+/// can have the fields in different orders.
+/// The files are loaded on getOption("csvread.threads") threads when OpenMP is available; a
+/// single file is also loaded on several threads if it is large enough.
+SEXP readCSVFiles(SEXP rschema)
+{
+   if (!isNewList(rschema))
+   {
+      error("c_readCSVFiles: expecting a list with schema as the only argument");
+   }
+   SEXP rfilenames = getListElement(rschema, "filenames");
+   if (rfilenames == R_NilValue || length(rfilenames) == 0) error("c_readCSVFiles: missing 'filenames' in the argument list");
+   int nfiles = length(rfilenames);
+   vector<string> filenames;
+   for (int f = 0; f < nfiles; f++)
+   {
+      filenames.push_back(CHAR(STRING_ELT(rfilenames, f)));
+   }
+
+   SEXP rcoltypes = getListElement(rschema, "coltypes");
+   if (rcoltypes == R_NilValue || length(rcoltypes) == 0) error("c_readCSVFiles: missing 'coltypes' in the argument list");
+   int ncols = length(rcoltypes);
+   for (int i = 0; i < ncols; i++)
+   {
+      CMRDataCollector* c = cmNewCollector(CHAR(STRING_ELT(rcoltypes, i)));
+      if (c == 0) error("c_readCSVFiles: unsupported column type '%s'", CHAR(STRING_ELT(rcoltypes, i)));
+      delete c;
+   }
+
+   SEXP rcolnames = getListElement(rschema, "colnames");
+
+   SEXP rheader = getListElement(rschema, "header");
+   if (rheader != R_NilValue && length(rheader) != nfiles) error("c_readCSVFiles: 'header' must have an element for each file");
+   vector<int> hasHeader(nfiles, 1);
+   for (int f = 0; f < nfiles && rheader != R_NilValue; f++)
+   {
+      hasHeader[f] = LOGICAL(rheader)[f] == TRUE;
+   }
+
+   bool verbose = false;
+   SEXP rverbose = getListElement(rschema, "verbose");
+   if (rverbose != R_NilValue) verbose = asLogical(rverbose) == TRUE;
+
+   string delim(",");
+   SEXP rdelim = getListElement(rschema, "delimiter");
+   if (rdelim != R_NilValue)
+   {
+      delim = CHAR(STRING_ELT(rdelim, 0));
+      if (delim.find('\n') != string::npos) error("c_readCSVFiles: delimiter can't contain a newline");
+   }
+
+   SEXP rfilter = getListElement(rschema, "filter");
+   if (rfilter != R_NilValue && !isNewList(rfilter)) error("c_readCSVFiles: 'filter' must be a list of predicates");
+
+   SEXP rquoted = getListElement(rschema, "quoted");
+   bool quoted = rquoted != R_NilValue && asLogical(rquoted) == TRUE;
+
+   vector<int> fieldStarts, fieldWidths;
+   char fmsg[256];
+   if (!cmFixedWidths(rschema, fieldStarts, fieldWidths, fmsg, sizeof(fmsg))) error("c_readCSVFiles: %s", fmsg);
+
+   CMPromotion promotion;
+   if (!cmPromotionOption(rschema, promotion)) error("c_readCSVFiles: 'promote' must be \"none\", \"double\" or \"long\"");
+
+   // Check that the files are readable and read the header of the first file that has one.
+   // With named coltypes, read the header of each file to find the fields of the columns. Also
+   // find the size of each file and the offset of its first record.
+
+   bool named = cmNamedColumns(rcoltypes);
+   vector<vector<int> > positions(nfiles);
+   vector<string> headers;
+   vector<size_t> sizes(nfiles, 0);
+   vector<size_t> dataStarts(nfiles, 0);
+   for (int f = 0; f < nfiles; f++)
+   {
+      ifstream istr(filenames[f].c_str(), ios::binary);
+      if (istr.fail()) error("c_readCSVFiles: can't open file %s.", filenames[f].c_str());
+      if (hasHeader[f] && (headers.empty() || named))
+      {
+         string buffer;
+         getline(istr, buffer);
+         SfiDelimitedRecordSTD rec(0, delim);
+         rec.setQuoted(quoted);
+         rec.setFixedWidths(fieldStarts, fieldWidths);
+         char empty[1] = { 0 };
+         rec.split(buffer.empty() ? empty : &buffer[0], buffer.size());
+         vector<string> fileHeaders;
+         for (int i = 0, n = rec.size(); i < n; i++)
+         {
+            fileHeaders.push_back(rec.get(i));
+         }
+         if (named)
+         {
+            char msg[256];
+            if (!cmSelectColumns(rcoltypes, fileHeaders, positions[f], msg, sizeof(msg)))
+            {
+               error("c_readCSVFiles: %s in file %s", msg, filenames[f].c_str());
+            }
+         }
+         if (headers.empty()) headers.swap(fileHeaders);
+      }
+      sizes[f] = cmStreamSize(istr);
+      if (hasHeader[f]) dataStarts[f] = cmRecordStart(istr, 1, sizes[f], false, false);
+   }
+   vector<string> colnames;
+   cmColumnNames(rcolnames, headers, ncols, colnames);
+
+   CMRowFilter filter;
+   if (rfilter != R_NilValue)
+   {
+      char msg[256];
+      if (!cmBuildFilter(rfilter, rcoltypes, colnames, filter, msg, sizeof(msg)))
+      {
+         filter.clear();
+         error("c_readCSVFiles: %s", msg);
+      }
+   }
+   const CMRowFilter* pfilter = filter.empty() ? 0 : &filter;
+
+   // Split the files into ranges, so that there are about as many ranges as threads, unless
+   // the ranges would be too small. With quoted fields, the quotes are counted first to find
+   // whether the nominal start of each range is inside quotes.
+
+   int nt = cmLoadThreads(INT_MAX);
+   size_t rangeSize = 0;
+   if (nt > nfiles)
+   {
+      double totalBytes = 0;
+      for (int f = 0; f < nfiles; f++)
+      {
+         totalBytes += sizes[f] - dataStarts[f];
+      }
+      rangeSize = (size_t) (totalBytes / nt);
+      if (rangeSize < CM_MIN_RANGE) rangeSize = CM_MIN_RANGE;
+   }
+   vector<CMFileRange> ranges;
+   for (int f = 0; f < nfiles; f++)
+   {
+      cmSplitRange(f, dataStarts[f], sizes[f], rangeSize, ranges);
+   }
+   int nranges = ranges.size();
+   int stop = 0;
+   if (nranges > nfiles)
+   {
+      if (quoted)
+      {
+         vector<size_t> quotes(nranges, 0);
+         CM_OMP_PARALLEL_FOR_DYNAMIC(nt)
+         for (int r = 0; r < nranges; r++)
+         {
+            CMRThreadMonitor monitor(&stop);
+            if (!monitor.update(0, 0)) continue;
+            ifstream istr(filenames[ranges[r].file].c_str(), ios::binary);
+            quotes[r] = cmCountChars(istr, ranges[r].start, ranges[r].end, '"');
+         }
+         if (stop)
+         {
+            filter.clear();
+            error("c_readCSVFiles: interrupted");
+         }
+         cmSetQuoteStates(ranges, quotes);
+      }
+      CM_OMP_PARALLEL_FOR_DYNAMIC(nt)
+      for (int r = 0; r < nranges; r++)
+      {
+         int f = ranges[r].file;
+         if (ranges[r].start == dataStarts[f]) continue;
+         ifstream istr(filenames[f].c_str(), ios::binary);
+         ranges[r].start = cmRecordStart(istr, ranges[r].start, sizes[f], quoted, ranges[r].inQuotes);
+      }
+      cmJoinRanges(ranges);
+   }
+   nt = cmLoadThreads(nranges);
+
+   // Count the rows of each range, or the matching rows with a filter.
+
+   vector<int> counts(nranges, 0);
+   CM_OMP_PARALLEL_FOR_DYNAMIC(nt)
+   for (int r = 0; r < nranges; r++)
+   {
+      CMRThreadMonitor monitor(&stop);
+      if (!monitor.update(0, 0)) continue;
+      const CMFileRange& range = ranges[r];
+      if (pfilter)
+      {
+         CMLineStream* lstr = new CMLineStream();
+         lstr->open(filenames[range.file].c_str(), range.start, range.end);
+         SfiDelimitedRecordSTD rec(0, delim);
+         rec.setColumns(positions[range.file]);
+         rec.setQuoted(quoted);
+         rec.setFixedWidths(fieldStarts, fieldWidths);
+         lstr->setQuoted(quoted);
+         counts[r] = cmCountMatches(*lstr, rec, *pfilter, &monitor);
+         delete lstr;
+      }
+      else
+      {
+         ifstream istr(filenames[range.file].c_str(), ios::binary);
+         counts[r] = cmCountRangeLines(istr, range.start, range.end);
+      }
+      if (counts[r] < 0) counts[r] = 0;
+   }
+   if (stop)
+   {
+      filter.clear();
+      error("c_readCSVFiles: interrupted");
+   }
+
+   vector<int> starts(nranges, 0);
+   double total = 0;
+   for (int r = 0; r < nranges; r++)
+   {
+      starts[r] = (int) total;
+      total += counts[r];
+   }
+   if (total > INT_MAX)
+   {
+      filter.clear();
+      error("c_readCSVFiles: the files have more than %d rows", INT_MAX);
+   }
+   int nrows = (int) total;
+   if (verbose) Rprintf("Counted %d rows in %d files (%d ranges).\n", nrows, nfiles, nranges);
+
+   // Allocate the columns and a collector for the slice of each range in each column.
+
+   SEXP rframe;
+   PROTECT(rframe = allocVector(VECSXP, ncols));
+   for (int i = 0; i < ncols; i++)
+   {
+      SET_VECTOR_ELT(rframe, i, cmAllocColumn(CHAR(STRING_ELT(rcoltypes, i)), nrows));
+   }
+   vector<vector<CMColumnSink*> > sinks(nranges, vector<CMColumnSink*>(ncols));
+   vector<CMRDataCollectorStrBuffer*> strings;
+   for (int r = 0; r < nranges; r++)
+   {
+      for (int i = 0; i < ncols; i++)
+      {
+         const char* type = CHAR(STRING_ELT(rcoltypes, i));
+         CMRDataCollector* c;
+         if (strcmp(type, "string") == 0)
+         {
+            strings.push_back(new CMRDataCollectorStrBuffer());
+            c = strings.back();
+         }
+         else c = cmNewCollector(type, promotion);
+         c->attach(VECTOR_ELT(rframe, i), starts[r], counts[r]);
+         sinks[r][i] = c;
+      }
+   }
+
+   // Parse the ranges into their slices.
+
+   vector<int> nread(nranges, 0);
+   CM_OMP_PARALLEL_FOR_DYNAMIC(nt)
+   for (int r = 0; r < nranges; r++)
+   {
+      CMRThreadMonitor monitor(&stop);
+      if (counts[r] == 0 || !monitor.update(0, 0)) continue;
+      const CMFileRange& range = ranges[r];
+      CMLineStream* lstr = new CMLineStream();
+      lstr->open(filenames[range.file].c_str(), range.start, range.end);
+      SfiDelimitedRecordSTD rec(0, delim);
+      rec.setColumns(positions[range.file]);
+      rec.setQuoted(quoted);
+      rec.setFixedWidths(fieldStarts, fieldWidths);
+      lstr->setQuoted(quoted);
+      CMParseOptions opt;
+      opt.monitor = &monitor;
+      opt.filter = pfilter;
+      opt.maxRows = counts[r];
+      nread[r] = cmParseLines(*lstr, rec, sinks[r], opt);
+      delete lstr;
+   }
+
+   for (int k = 0, n = strings.size(); k < n && !stop; k++)
+   {
+      strings[k]->flush();
+   }
+   for (int i = 0; i < ncols && !stop; i++)
+   {
+      vector<CMColumnSink*> cols(nranges);
+      for (int r = 0; r < nranges; r++)
+      {
+         cols[r] = sinks[r][i];
+      }
+      const char* type = CHAR(STRING_ELT(rcoltypes, i));
+      const char* wideType = cmPromoteColumn(rframe, i, type, cols, starts);
+      if (verbose && wideType != type) Rprintf("Column %s promoted to %s.\n", colnames[i].c_str(), wideType);
+   }
+   for (int r = 0; r < nranges; r++)
+   {
+      for (int i = 0; i < ncols; i++)
+      {
+         delete sinks[r][i];
+      }
+   }
+   filter.clear();
+   if (stop)
+   {
+      UNPROTECT(1);
+      error("c_readCSVFiles: interrupted");
+   }
+
+   // A file that became shorter since it was counted, or a range with quoted newlines, which
+   // are counted as lines, leaves a gap in the columns.
+
+   if (nread != counts)
+   {
+      nrows = cmCompactColumns(rframe, starts, nread);
+      cmShrinkColumns(rframe, nrows);
+   }
+
+   cmSetFrameAttributes(rframe, colnames, nrows);
+   UNPROTECT(1);
+   return rframe;
 }
 
 //-----------------------------------------------------------------------------
@@ -31,41 +31,279 @@
 #include <Rmath.h>
 #include <errno.h>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 //-----------------------------------------------------------------------------
 
 //namespace cm
 //{
 
-// from http://stackoverflow.com/questions/18858115/c-long-long-to-char-conversion-function-in-embedded-system
-static char* cm_lltoa(CMInt64 val, char* buf, int base)
+/// Default for the option csvread.parallel.threshold.
+#define CM_PARALLEL_THRESHOLD 100000
+
+/// Number of threads for an element-wise kernel on n elements (see int64.h).
+int cm_int64_threads(int n)
+{
+#ifdef _OPENMP
+   int nt = asInteger(GetOption1(install("csvread.threads")));
+   if (nt == NA_INTEGER || nt <= 1) return 1;
+   SEXP rthreshold = GetOption1(install("csvread.parallel.threshold"));
+   double threshold = isNull(rthreshold) ? CM_PARALLEL_THRESHOLD : asReal(rthreshold);
+   if (ISNAN(threshold) || n < threshold) return 1;
+   if (nt > omp_get_num_procs()) nt = omp_get_num_procs();
+   return nt;
+#else
+   return 1;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+
+// Formatting of int64 values. Digits are produced two at a time from tables of the
+// decimal digit pairs 00-99 and of the hex digit pairs 00-ff, which halves the number
+// of divisions, and are written backwards from the end of the buffer, so the length
+// is known without scanning the result and can be passed on to mkCharLenCE.
+
+/// Size of the buffers for cm_format_dec and cm_format_hex.
+#define CM_INT64_BUFSIZE 24
+
+static const char cm_dec_pairs[201] =
+   "0001020304050607080910111213141516171819"
+   "2021222324252627282930313233343536373839"
+   "4041424344454647484950515253545556575859"
+   "6061626364656667686970717273747576777879"
+   "8081828384858687888990919293949596979899";
+
+static const char cm_hex_pairs[513] =
+   "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f"
+   "202122232425262728292a2b2c2d2e2f303132333435363738393a3b3c3d3e3f"
+   "404142434445464748494a4b4c4d4e4f505152535455565758595a5b5c5d5e5f"
+   "606162636465666768696a6b6c6d6e6f707172737475767778797a7b7c7d7e7f"
+   "808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f"
+   "a0a1a2a3a4a5a6a7a8a9aaabacadaeafb0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+   "c0c1c2c3c4c5c6c7c8c9cacbcccdcecfd0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+   "e0e1e2e3e4e5e6e7e8e9eaebecedeeeff0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+
+/// Formats val in base 10 into buf of CM_INT64_BUFSIZE chars. Returns the first char
+/// and stores the length in *len; the result is not null-terminated.
+static char* cm_format_dec(CMInt64 val, char* buf, int* len)
+{
+   char* end = buf + CM_INT64_BUFSIZE;
+   char* p = end;
+   uint64_t u = val < 0 ? 0 - (uint64_t) val : (uint64_t) val;
+   while (u >= 100)
+   {
+      const char* d = cm_dec_pairs + 2 * (u % 100);
+      u /= 100;
+      *--p = d[1];
+      *--p = d[0];
+   }
+   if (u >= 10)
+   {
+      *--p = cm_dec_pairs[2 * u + 1];
+      *--p = cm_dec_pairs[2 * u];
+   }
+   else
+   {
+      *--p = (char) ('0' + u);
+   }
+   if (val < 0) *--p = '-';
+   *len = (int) (end - p);
+   return p;
+}
+
+/// Same as cm_format_dec for base 16 and lower case digits. val must not be negative.
+static char* cm_format_hex(CMInt64 val, char* buf, int* len)
 {
+   char* end = buf + CM_INT64_BUFSIZE;
+   char* p = end;
+   uint64_t u = (uint64_t) val;
+   while (u >= 0x100)
+   {
+      const char* d = cm_hex_pairs + 2 * (u & 0xff);
+      u >>= 8;
+      *--p = d[1];
+      *--p = d[0];
+   }
+   *--p = cm_hex_pairs[2 * u + 1];
+   if (u >= 0x10) *--p = cm_hex_pairs[2 * u];
+   *len = (int) (end - p);
+   return p;
+}
 
-    *buf = '\0';
+//}
 
-    int i = 62;
-    int sign = (val < 0);
-    if (sign) val = -val;
+//-----------------------------------------------------------------------------
 
-    if (val == 0)
-    {
-       buf[0] = '0';
-       buf[1] = '\0';
-       return buf;
-    }
+// Arithmetic on int64 values. NA_LONG is the smallest 64-bit integer, so the valid
+// range is symmetric, and a result equal to NA_LONG counts as an overflow. Each
+// operation returns NA_LONG for NA operands, overflows and division by zero, and sets
+// *ovf if the result overflowed.
 
-    for (; val && i ; --i, val /= base)
-    {
-        buf[i] = "0123456789abcdef"[val % base];
-    }
+/// Arithmetic operators of cm_arith_int64.
+enum { CM_ADD, CM_SUB, CM_MUL, CM_DIV, CM_MOD };
 
-    if (sign)
-    {
-        buf[i--] = '-';
-    }
-    return &buf[i+1];
+static inline CMInt64 cm_add_int64(CMInt64 a, CMInt64 b, int* ovf)
+{
+   CMInt64 r = (CMInt64) ((uint64_t) a + (uint64_t) b);
+   int na = (a == NA_LONG.L) | (b == NA_LONG.L);
+   int ov = (((a ^ r) & (b ^ r)) < 0) | (r == NA_LONG.L);
+   *ovf = ov & !na;
+   return (na | ov) ? NA_LONG.L : r;
 }
 
-//}
+static inline CMInt64 cm_sub_int64(CMInt64 a, CMInt64 b, int* ovf)
+{
+   CMInt64 r = (CMInt64) ((uint64_t) a - (uint64_t) b);
+   int na = (a == NA_LONG.L) | (b == NA_LONG.L);
+   int ov = (((a ^ b) & (a ^ r)) < 0) | (r == NA_LONG.L);
+   *ovf = ov & !na;
+   return (na | ov) ? NA_LONG.L : r;
+}
+
+static inline CMInt64 cm_mul_int64(CMInt64 a, CMInt64 b, int* ovf)
+{
+   CMInt64 r;
+   int na = (a == NA_LONG.L) | (b == NA_LONG.L);
+#if defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__))
+   int ov = __builtin_mul_overflow(a, b, &r);
+#else
+   // see http://www.fefe.de/intof.html
+   int ov;
+   if (a > 0) ov = b > 0 ? a > INT64_MAX / b : b < INT64_MIN / a;
+   else ov = b > 0 ? a < INT64_MIN / b : (a != 0 && b < INT64_MAX / a);
+   r = ov ? 0 : a * b;
+#endif
+   ov |= r == NA_LONG.L;
+   *ovf = ov & !na;
+   return (na | ov) ? NA_LONG.L : r;
+}
+
+/// Integer division rounding towards negative infinity, as R's %/%.
+static inline CMInt64 cm_div_int64(CMInt64 a, CMInt64 b, int* ovf)
+{
+   *ovf = 0;
+   if (a == NA_LONG.L || b == NA_LONG.L || b == 0) return NA_LONG.L;
+   CMInt64 q = a / b;
+   if (a % b != 0 && ((a < 0) != (b < 0))) q--;
+   return q;
+}
+
+/// Remainder with the sign of the divisor, as R's %%.
+static inline CMInt64 cm_mod_int64(CMInt64 a, CMInt64 b, int* ovf)
+{
+   *ovf = 0;
+   if (a == NA_LONG.L || b == NA_LONG.L || b == 0) return NA_LONG.L;
+   CMInt64 r = a % b;
+   if (r != 0 && ((r < 0) != (b < 0))) r += b;
+   return r;
+}
+
+/// The arithmetic loops for operation FUNC with the same recycling cases as
+/// CM_INT64_COMPARE; counts overflows in novf.
+#define CM_INT64_ARITH(FUNC)                                                  \
+   if (n1 == n2)                                                              \
+   {                                                                          \
+      CM_OMP_PARALLEL_FOR_SIMD_SUM(nt, novf)                                  \
+      for (int i = 0; i < n; i++)                                             \
+      {                                                                       \
+         CMInt64 a, b, r;                                                     \
+         int ov;                                                              \
+         memcpy(&a, &(x1[i]), sizeof(CMInt64));                               \
+         memcpy(&b, &(x2[i]), sizeof(CMInt64));                               \
+         r = FUNC(a, b, &ov);                                                 \
+         novf += ov;                                                          \
+         memcpy(&(x[i]), &r, sizeof(CMInt64));                                \
+      }                                                                       \
+   }                                                                          \
+   else if (n2 == 1)                                                          \
+   {                                                                          \
+      CMInt64 b;                                                              \
+      memcpy(&b, &(x2[0]), sizeof(CMInt64));                                  \
+      CM_OMP_PARALLEL_FOR_SIMD_SUM(nt, novf)                                  \
+      for (int i = 0; i < n; i++)                                             \
+      {                                                                       \
+         CMInt64 a, r;                                                        \
+         int ov;                                                              \
+         memcpy(&a, &(x1[i]), sizeof(CMInt64));                               \
+         r = FUNC(a, b, &ov);                                                 \
+         novf += ov;                                                          \
+         memcpy(&(x[i]), &r, sizeof(CMInt64));                                \
+      }                                                                       \
+   }                                                                          \
+   else if (n1 == 1)                                                          \
+   {                                                                          \
+      CMInt64 a;                                                              \
+      memcpy(&a, &(x1[0]), sizeof(CMInt64));                                  \
+      CM_OMP_PARALLEL_FOR_SIMD_SUM(nt, novf)                                  \
+      for (int i = 0; i < n; i++)                                             \
+      {                                                                       \
+         CMInt64 b, r;                                                        \
+         int ov;                                                              \
+         memcpy(&b, &(x2[i]), sizeof(CMInt64));                               \
+         r = FUNC(a, b, &ov);                                                 \
+         novf += ov;                                                          \
+         memcpy(&(x[i]), &r, sizeof(CMInt64));                                \
+      }                                                                       \
+   }                                                                          \
+   else                                                                       \
+   {                                                                          \
+      for (int i = 0, i1 = 0, i2 = 0; i < n; i++)                             \
+      {                                                                       \
+         CMInt64 a, b, r;                                                     \
+         int ov;                                                              \
+         memcpy(&a, &(x1[i1]), sizeof(CMInt64));                              \
+         memcpy(&b, &(x2[i2]), sizeof(CMInt64));                              \
+         r = FUNC(a, b, &ov);                                                 \
+         novf += ov;                                                          \
+         memcpy(&(x[i]), &r, sizeof(CMInt64));                                \
+         if (++i1 == n1) i1 = 0;                                              \
+         if (++i2 == n2) i2 = 0;                                              \
+      }                                                                       \
+   }
+
+/// Computes x1 op x2 of lengths n1 and n2 with recycling into x of length n on nt
+/// threads. Returns the number of overflows.
+CM_SIMD_CLONES
+static int cm_arith_kernel(const double* x1, int n1, const double* x2, int n2, double* x, int n, int op, int nt)
+{
+   int novf = 0;
+   switch (op)
+   {
+   case CM_ADD: CM_INT64_ARITH(cm_add_int64); break;
+   case CM_SUB: CM_INT64_ARITH(cm_sub_int64); break;
+   case CM_MUL: CM_INT64_ARITH(cm_mul_int64); break;
+   case CM_DIV: CM_INT64_ARITH(cm_div_int64); break;
+   case CM_MOD: CM_INT64_ARITH(cm_mod_int64); break;
+   }
+   return novf;
+}
+
+/// Allocates the int64 result of r1 op r2 with R's recycling rules and computes it.
+static SEXP cm_arith_int64(SEXP r1, SEXP r2, int op)
+{
+   int n1 = length(r1);
+   int n2 = length(r2);
+   int n = (n1 == 0 || n2 == 0) ? 0 : (n1 > n2 ? n1 : n2);
+   if (n > 0 && (n % n1 != 0 || n % n2 != 0))
+   {
+      warning("longer object length is not a multiple of shorter object length");
+   }
+   SEXP res;
+   PROTECT(res = allocVector(REALSXP, n));
+   int novf = cm_arith_kernel(REAL(r1), n1, REAL(r2), n2, REAL(res), n, op, cm_int64_threads(n));
+   if (novf > 0) warning("NAs produced by int64 overflow");
+
+   SEXP cls;
+   PROTECT(cls = allocVector(STRSXP, 1));
+   SET_STRING_ELT(cls, 0, mkChar("int64"));
+   classgets(res, cls);
+
+   UNPROTECT(2);
+   return res;
+}
 
 //-----------------------------------------------------------------------------
 
@@ -84,19 +322,28 @@ SEXP charToInt64(SEXP rinp, SEXP rbase)
    int n = length(rinp);
    SEXP res;
    PROTECT(res = allocVector(REALSXP, n));
-   char* p;
    double* x = REAL(res);
+   // the strings are collected first, since the R API can't be used from other threads
+   const char** strs = (const char**) R_alloc(n > 0 ? n : 1, sizeof(const char*));
    for (int i = 0; i < n; i++)
    {
-      CMInt64 xi = 0;
       SEXP s = STRING_ELT(rinp, i);
-      if (s == NA_STRING)
+      strs[i] = s == NA_STRING ? NULL : CHAR(s);
+   }
+   int nt = cm_int64_threads(n);
+   CM_OMP_PARALLEL_FOR(nt)
+   for (int i = 0; i < n; i++)
+   {
+      CMInt64 xi = 0;
+      if (strs[i] == NULL)
       {
          xi = NA_LONG.L;
       }
       else
       {
-         CMInt64 val = strtoll(CHAR(STRING_ELT(rinp, i)), &p, base);
+         char* p;
+         errno = 0;
+         CMInt64 val = strtoll(strs[i], &p, base);
          if (errno == EINVAL || errno == ERANGE)
          {
             xi = NA_LONG.L;
@@ -138,8 +385,7 @@ SEXP int64ToChar(SEXP rinp)
    int n = length(rinp);
    SEXP res;
    PROTECT(res = allocVector(STRSXP, n));
-//   CMInt64* x = (CMInt64*) REAL(rinp);
-   char s[100];
+   char s[CM_INT64_BUFSIZE];
    double* x = REAL(rinp);
    for (int i = 0; i < n; i++)
    {
@@ -148,13 +394,13 @@ SEXP int64ToChar(SEXP rinp)
       memcpy(&xi, &(x[i]), sizeof(CMInt64));
       if (xi == NA_LONG.L)
       {
-         //SET_STRING_ELT(res, i, mkChar("NA"));
          SET_STRING_ELT(res, i, NA_STRING);
       }
       else
       {
-//         sprintf(s, "%lld", xi);
-         SET_STRING_ELT(res, i, mkChar(cm_lltoa(xi, s, 10)));
+         int len;
+         char* p = cm_format_dec(xi, s, &len);
+         SET_STRING_ELT(res, i, mkCharLenCE(p, len, CE_NATIVE));
       }
    }
 
@@ -172,7 +418,7 @@ SEXP int64ToHex(SEXP rinp)
    SEXP res;
    PROTECT(res = allocVector(STRSXP, n));
    double* x = REAL(rinp);
-   char s[100];
+   char s[CM_INT64_BUFSIZE + 1];
    for (int i = 0; i < n; i++)
    {
       CMInt64 xi;
@@ -184,9 +430,16 @@ SEXP int64ToHex(SEXP rinp)
       }
       else
       {
-         if (xi < 0) error("Can't convert a negative number %lld to hex format, item %d.", x[i], i + 1);
-//         sprintf(s, "%llx", xi);
-         SET_STRING_ELT(res, i, mkChar(cm_lltoa(xi, s, 16)));
+         int len;
+         char* p;
+         if (xi < 0)
+         {
+            p = cm_format_dec(xi, s, &len);
+            p[len] = '\0';
+            error("Can't convert a negative number %s to hex format, item %d.", p, i + 1);
+         }
+         p = cm_format_hex(xi, s, &len);
+         SET_STRING_ELT(res, i, mkCharLenCE(p, len, CE_NATIVE));
       }
    }
 
@@ -200,80 +453,7 @@ SEXP int64ToHex(SEXP rinp)
 /// r1 + r2
 SEXP addInt64Int64(SEXP r1, SEXP r2)
 {
-   int n = length(r1);
-   if (n != length(r2)) error("Can't add int64 vectors: lengths don't match.");
-   SEXP res;
-   PROTECT(res = allocVector(REALSXP, n));
-   double* x1 = REAL(r1);
-   double* x2 = REAL(r2);
-   double* x  = REAL(res);
-   for (int i = 0; i < n; i++)
-   {
-      CMInt64 x1i, x2i, xi;
-      memcpy(&x1i, &(x1[i]), sizeof(CMInt64));
-      memcpy(&x2i, &(x2[i]), sizeof(CMInt64));
-
-      if (x1i == NA_LONG.L || x2i == NA_LONG.L)
-      {
-         xi = NA_LONG.L;
-      }
-      else
-      {
-         // TODO: check for overflow
-         xi = x1i + x2i;
-      }
-      double d;
-      memcpy(&d, &xi, sizeof(CMInt64));
-      x[i] = d;
-   }
-
-   SEXP cls;
-   PROTECT(cls = allocVector(STRSXP, 1));
-   SET_STRING_ELT(cls, 0, mkChar("int64"));
-   classgets(res, cls);
-
-   UNPROTECT(2);
-   return res;
-}
-
-//-----------------------------------------------------------------------------
-
-/// r1 + r2, where r1 is int64 and r2 is int
-SEXP addInt64Int(SEXP r1, SEXP r2)
-{
-   int n = length(r1);
-   if (n != length(r2)) error("Can't add int64 vectors: lengths don't match.");
-   SEXP res;
-   PROTECT(res = allocVector(REALSXP, n));
-   double* x1 = REAL(r1);
-   int* x2 = INTEGER(r2);
-   double* x = REAL(res);
-   for (int i = 0; i < n; i++)
-   {
-      CMInt64 x1i, xi;
-      memcpy(&x1i, &(x1[i]), sizeof(CMInt64));
-
-      if (x1i == NA_LONG.L || x2[i] == NA_INTEGER)
-      {
-         xi = NA_LONG.L;
-      }
-      else
-      {
-         // TODO: check for overflow, see http://www.fefe.de/intof.html on multiplication of 64-bit ints
-         xi = x1i + (CMInt64) x2[i];
-      }
-      double d;
-      memcpy(&d, &xi, sizeof(CMInt64));
-      x[i] = d;
-   }
-
-   SEXP cls;
-   PROTECT(cls = allocVector(STRSXP, 1));
-   SET_STRING_ELT(cls, 0, mkChar("int64"));
-   classgets(res, cls);
-
-   UNPROTECT(2);
-   return res;
+   return cm_arith_int64(r1, r2, CM_ADD);
 }
 
 //-----------------------------------------------------------------------------
@@ -286,6 +466,8 @@ SEXP integerToInt64(SEXP r)
    PROTECT(res = allocVector(REALSXP, n));
    int* xin = INTEGER(r);
    double* xout  = REAL(res);
+   int nt = cm_int64_threads(n);
+   CM_OMP_PARALLEL_FOR_SIMD(nt)
    for (int i = 0; i < n; i++)
    {
       CMInt64 xi;
@@ -321,6 +503,8 @@ SEXP doubleToInt64(SEXP r)
    PROTECT(res = allocVector(REALSXP, n));
    double* xin = REAL(r);
    double* xout  = REAL(res);
+   int nt = cm_int64_threads(n);
+   CM_OMP_PARALLEL_FOR_SIMD(nt)
    for (int i = 0; i < n; i++)
    {
       CMInt64 xi;
@@ -356,6 +540,8 @@ SEXP int64ToDouble(SEXP r)
    PROTECT(res = allocVector(REALSXP, n));
    double* xin = REAL(r);
    double* xd  = REAL(res);
+   int nt = cm_int64_threads(n);
+   CM_OMP_PARALLEL_FOR_SIMD(nt)
    for (int i = 0; i < n; i++)
    {
       CMInt64 xi;
@@ -384,6 +570,8 @@ SEXP int64ToInteger(SEXP r)
    PROTECT(res = allocVector(INTSXP, n));
    double* xin = REAL(r);
    int* xout  = INTEGER(res);
+   int nt = cm_int64_threads(n);
+   CM_OMP_PARALLEL_FOR_SIMD(nt)
    for (int i = 0; i < n; i++)
    {
       CMInt64 xi;
@@ -414,6 +602,8 @@ SEXP isInt64NA(SEXP r)
    double* xin = REAL(r);
    int* xout  = LOGICAL(res);
    //memset(xout, 0, sizeof(int) * n);
+   int nt = cm_int64_threads(n);
+   CM_OMP_PARALLEL_FOR_SIMD(nt)
    for (int i = 0; i < n; i++)
    {
       CMInt64 xi;
@@ -440,41 +630,382 @@ SEXP isInt64NA(SEXP r)
 /// r1 - r2
 SEXP subInt64Int64(SEXP r1, SEXP r2)
 {
-   int n = length(r1);
-   if (n != length(r2)) error("Can't add int64 vectors: lengths don't match.");
+   return cm_arith_int64(r1, r2, CM_SUB);
+}
+
+//-----------------------------------------------------------------------------
+
+/// Comparison operators in the order of their codes in compareInt64.
+static const char* cm_cmpops[] = { "==", "!=", "<", "<=", ">", ">=" };
+
+/// The comparison loops for operator OP: equal lengths, a scalar on either side and
+/// general recycling. NA in either operand gives NA.
+#define CM_INT64_COMPARE(OP)                                                  \
+   if (n1 == n2)                                                              \
+   {                                                                          \
+      CM_OMP_PARALLEL_FOR_SIMD(nt)                                            \
+      for (int i = 0; i < n; i++)                                             \
+      {                                                                       \
+         CMInt64 a, b;                                                        \
+         memcpy(&a, &(x1[i]), sizeof(CMInt64));                               \
+         memcpy(&b, &(x2[i]), sizeof(CMInt64));                               \
+         int na = (a == NA_LONG.L) | (b == NA_LONG.L);                        \
+         x[i] = na ? naval : (a OP b);                                        \
+      }                                                                       \
+   }                                                                          \
+   else if (n2 == 1)                                                          \
+   {                                                                          \
+      CMInt64 b;                                                              \
+      memcpy(&b, &(x2[0]), sizeof(CMInt64));                                  \
+      CM_OMP_PARALLEL_FOR_SIMD(nt)                                            \
+      for (int i = 0; i < n; i++)                                             \
+      {                                                                       \
+         CMInt64 a;                                                           \
+         memcpy(&a, &(x1[i]), sizeof(CMInt64));                               \
+         int na = (a == NA_LONG.L) | (b == NA_LONG.L);                        \
+         x[i] = na ? naval : (a OP b);                                        \
+      }                                                                       \
+   }                                                                          \
+   else if (n1 == 1)                                                          \
+   {                                                                          \
+      CMInt64 a;                                                              \
+      memcpy(&a, &(x1[0]), sizeof(CMInt64));                                  \
+      CM_OMP_PARALLEL_FOR_SIMD(nt)                                            \
+      for (int i = 0; i < n; i++)                                             \
+      {                                                                       \
+         CMInt64 b;                                                           \
+         memcpy(&b, &(x2[i]), sizeof(CMInt64));                               \
+         int na = (a == NA_LONG.L) | (b == NA_LONG.L);                        \
+         x[i] = na ? naval : (a OP b);                                        \
+      }                                                                       \
+   }                                                                          \
+   else                                                                       \
+   {                                                                          \
+      for (int i = 0, i1 = 0, i2 = 0; i < n; i++)                             \
+      {                                                                       \
+         CMInt64 a, b;                                                        \
+         memcpy(&a, &(x1[i1]), sizeof(CMInt64));                              \
+         memcpy(&b, &(x2[i2]), sizeof(CMInt64));                              \
+         int na = (a == NA_LONG.L) | (b == NA_LONG.L);                        \
+         x[i] = na ? naval : (a OP b);                                        \
+         if (++i1 == n1) i1 = 0;                                              \
+         if (++i2 == n2) i2 = 0;                                              \
+      }                                                                       \
+   }
+
+/// Compares x1 and x2 of lengths n1 and n2 with recycling into x of length n on nt threads.
+CM_SIMD_CLONES
+static void cm_compare_int64(const double* x1, int n1, const double* x2, int n2, int* x, int n, int op, int nt)
+{
+   const int naval = NA_LOGICAL;
+   switch (op)
+   {
+   case 0: CM_INT64_COMPARE(==); break;
+   case 1: CM_INT64_COMPARE(!=); break;
+   case 2: CM_INT64_COMPARE(<);  break;
+   case 3: CM_INT64_COMPARE(<=); break;
+   case 4: CM_INT64_COMPARE(>);  break;
+   case 5: CM_INT64_COMPARE(>=); break;
+   }
+}
+
+/// r1 op r2, where op is one of ==, !=, <, <=, >, >= and both r1 and r2 are int64.
+/// The shorter vector is recycled.
+SEXP compareInt64(SEXP r1, SEXP r2, SEXP rop)
+{
+   const char* sop = CHAR(STRING_ELT(rop, 0));
+   int op = -1;
+   for (int k = 0; k < 6; k++)
+   {
+      if (strcmp(sop, cm_cmpops[k]) == 0) op = k;
+   }
+   if (op < 0) error("Can't compare int64 vectors: unknown operator %s.", sop);
+
+   int n1 = length(r1);
+   int n2 = length(r2);
+   int n = (n1 == 0 || n2 == 0) ? 0 : (n1 > n2 ? n1 : n2);
+   if (n > 0 && (n % n1 != 0 || n % n2 != 0))
+   {
+      warning("longer object length is not a multiple of shorter object length");
+   }
    SEXP res;
-   PROTECT(res = allocVector(REALSXP, n));
-   double* x1 = REAL(r1);
-   double* x2 = REAL(r2);
-   double* x  = REAL(res);
+   PROTECT(res = allocVector(LGLSXP, n));
+   cm_compare_int64(REAL(r1), n1, REAL(r2), n2, LOGICAL(res), n, op, cm_int64_threads(n));
+
+   UNPROTECT(1);
+   return res;
+}
+
+//-----------------------------------------------------------------------------
+
+/// r1 * r2
+SEXP mulInt64Int64(SEXP r1, SEXP r2)
+{
+   return cm_arith_int64(r1, r2, CM_MUL);
+}
+
+//-----------------------------------------------------------------------------
+
+/// r1 %/% r2
+SEXP divInt64Int64(SEXP r1, SEXP r2)
+{
+   return cm_arith_int64(r1, r2, CM_DIV);
+}
+
+//-----------------------------------------------------------------------------
+
+/// r1 %% r2
+SEXP modInt64Int64(SEXP r1, SEXP r2)
+{
+   return cm_arith_int64(r1, r2, CM_MOD);
+}
+
+//-----------------------------------------------------------------------------
+
+/// Negates int64 values (if absolute is 0) or takes their absolute values. Since the
+/// valid range is symmetric, neither can overflow; negating NA_LONG gives NA_LONG.
+CM_SIMD_CLONES
+static void cm_neg_kernel(const double* xin, double* xout, int n, int absolute, int nt)
+{
+   CM_OMP_PARALLEL_FOR_SIMD(nt)
    for (int i = 0; i < n; i++)
    {
-      CMInt64 x1i, x2i, xi;
-      memcpy(&x1i, &(x1[i]), sizeof(CMInt64));
-      memcpy(&x2i, &(x2[i]), sizeof(CMInt64));
+      CMInt64 a, r;
+      memcpy(&a, &(xin[i]), sizeof(CMInt64));
+      r = (CMInt64) (0 - (uint64_t) a);
+      if (absolute) r = a < 0 ? r : a;
+      memcpy(&(xout[i]), &r, sizeof(CMInt64));
+   }
+}
+
+static SEXP cm_unary_int64(SEXP r, int absolute)
+{
+   int n = length(r);
+   SEXP res;
+   PROTECT(res = allocVector(REALSXP, n));
+   cm_neg_kernel(REAL(r), REAL(res), n, absolute, cm_int64_threads(n));
+
+   SEXP cls;
+   PROTECT(cls = allocVector(STRSXP, 1));
+   SET_STRING_ELT(cls, 0, mkChar("int64"));
+   classgets(res, cls);
+
+   UNPROTECT(2);
+   return res;
+}
+
+/// -r
+SEXP negInt64(SEXP r)
+{
+   return cm_unary_int64(r, 0);
+}
+
+//-----------------------------------------------------------------------------
+
+/// abs(r)
+SEXP absInt64(SEXP r)
+{
+   return cm_unary_int64(r, 1);
+}
+
+//-----------------------------------------------------------------------------
 
-      if (x1i == NA_LONG.L || x2i == NA_LONG.L)
+/// Number of independent accumulators in the reduction loops, which lets the compiler
+/// keep several additions or comparisons in flight (or in one vector register).
+#define CM_LANES 4
+
+/// Sums int64 values. Each value is split into its upper 32 bits (signed) and lower
+/// 32 bits (unsigned), which are summed separately so that the partial sums cannot
+/// overflow for vectors shorter than 2^31; the sum is then checked against the 64-bit
+/// range once. NAs are counted in *nna and add 0. Returns NA_LONG and sets *ovf if the
+/// sum overflows.
+CM_SIMD_CLONES
+static CMInt64 cm_sum_kernel(const double* x, int n, int* nna, int* ovf)
+{
+   CMInt64 hi[CM_LANES] = { 0 };
+   uint64_t lo[CM_LANES] = { 0 };
+   int na[CM_LANES] = { 0 };
+   int i, k;
+   int n4 = n - n % CM_LANES;
+   for (i = 0; i < n4; i += CM_LANES)
+   {
+      for (k = 0; k < CM_LANES; k++)
       {
-         xi = NA_LONG.L;
+         CMInt64 a;
+         memcpy(&a, &(x[i + k]), sizeof(CMInt64));
+         int isna = a == NA_LONG.L;
+         a = isna ? 0 : a;
+         na[k] += isna;
+         hi[k] += a >> 32;
+         lo[k] += (uint64_t) a & 0xFFFFFFFFu;
       }
-      else
+   }
+   for (i = n4; i < n; i++)
+   {
+      CMInt64 a;
+      memcpy(&a, &(x[i]), sizeof(CMInt64));
+      int isna = a == NA_LONG.L;
+      a = isna ? 0 : a;
+      na[0] += isna;
+      hi[0] += a >> 32;
+      lo[0] += (uint64_t) a & 0xFFFFFFFFu;
+   }
+
+   CMInt64 h = 0;
+   uint64_t l = 0;
+   *nna = 0;
+   for (k = 0; k < CM_LANES; k++)
+   {
+      *nna += na[k];
+      h += hi[k] + (CMInt64) (lo[k] >> 32);
+      l += lo[k] & 0xFFFFFFFFu;
+   }
+   h += (CMInt64) (l >> 32);
+   l &= 0xFFFFFFFFu;
+   // the sum is h * 2^32 + l with 0 <= l < 2^32
+   CMInt64 sum = (CMInt64) (((uint64_t) h << 32) | l);
+   *ovf = h < -2147483647 - 1 || h > 2147483647 || sum == NA_LONG.L;
+   return *ovf ? NA_LONG.L : sum;
+}
+
+/// Finds the smallest and largest values other than NA. Returns the number of NAs.
+/// If all values are NA, *mn is larger than *mx.
+CM_SIMD_CLONES
+static int cm_range_kernel(const double* x, int n, CMInt64* mn, CMInt64* mx)
+{
+   const CMInt64 maxval = -(NA_LONG.L + 1);
+   CMInt64 lmn[CM_LANES], lmx[CM_LANES];
+   int na[CM_LANES] = { 0 };
+   int i, k;
+   int n4 = n - n % CM_LANES;
+   for (k = 0; k < CM_LANES; k++)
+   {
+      lmn[k] = maxval;
+      lmx[k] = NA_LONG.L;
+   }
+   // NA_LONG never exceeds the running maximum, so only the minimum needs a mask
+   for (i = 0; i < n4; i += CM_LANES)
+   {
+      for (k = 0; k < CM_LANES; k++)
       {
-         xi = x1[i] - x2[i];
+         CMInt64 a;
+         memcpy(&a, &(x[i + k]), sizeof(CMInt64));
+         int isna = a == NA_LONG.L;
+         CMInt64 b = isna ? maxval : a;
+         na[k] += isna;
+         lmn[k] = b < lmn[k] ? b : lmn[k];
+         lmx[k] = a > lmx[k] ? a : lmx[k];
       }
-      double d;
-      memcpy(&d, &xi, sizeof(CMInt64));
-      x[i] = d;
+   }
+   for (i = n4; i < n; i++)
+   {
+      CMInt64 a;
+      memcpy(&a, &(x[i]), sizeof(CMInt64));
+      int isna = a == NA_LONG.L;
+      CMInt64 b = isna ? maxval : a;
+      na[0] += isna;
+      lmn[0] = b < lmn[0] ? b : lmn[0];
+      lmx[0] = a > lmx[0] ? a : lmx[0];
    }
 
+   int nna = 0;
+   *mn = maxval;
+   *mx = NA_LONG.L;
+   for (k = 0; k < CM_LANES; k++)
+   {
+      nna += na[k];
+      if (lmn[k] < *mn) *mn = lmn[k];
+      if (lmx[k] > *mx) *mx = lmx[k];
+   }
+   // distinguish all NA from a vector of the largest values
+   if (nna == n) *mn = maxval, *mx = NA_LONG.L;
+   return nna;
+}
+
+/// Allocates an int64 vector of length n.
+static SEXP cm_alloc_int64(int n)
+{
+   SEXP res;
+   PROTECT(res = allocVector(REALSXP, n));
    SEXP cls;
    PROTECT(cls = allocVector(STRSXP, 1));
    SET_STRING_ELT(cls, 0, mkChar("int64"));
    classgets(res, cls);
-
    UNPROTECT(2);
    return res;
 }
 
 //-----------------------------------------------------------------------------
 
+/// sum(r, na.rm). Returns NA with a warning on overflow.
+SEXP sumInt64(SEXP r, SEXP rnarm)
+{
+   int narm = asLogical(rnarm) == TRUE;
+   int nna, ovf;
+   CMInt64 sum = cm_sum_kernel(REAL(r), length(r), &nna, &ovf);
+   if (nna > 0 && !narm) sum = NA_LONG.L;
+   else if (ovf) warning("int64 overflow in sum; returning NA");
+
+   SEXP res = cm_alloc_int64(1);
+   memcpy(REAL(res), &sum, sizeof(CMInt64));
+   return res;
+}
+
+//-----------------------------------------------------------------------------
+
+/// range(r, na.rm) as an int64 vector c(min, max). Returns NA values with a warning
+/// if there are no values other than NA.
+SEXP rangeInt64(SEXP r, SEXP rnarm)
+{
+   int narm = asLogical(rnarm) == TRUE;
+   int n = length(r);
+   CMInt64 mn, mx;
+   int nna = cm_range_kernel(REAL(r), n, &mn, &mx);
+   if ((nna > 0 && !narm) || nna == n)
+   {
+      if (nna == n && (narm || n == 0)) warning("no non-missing arguments to min or max; returning NA");
+      mn = mx = NA_LONG.L;
+   }
+
+   SEXP res = cm_alloc_int64(2);
+   memcpy(&(REAL(res)[0]), &mn, sizeof(CMInt64));
+   memcpy(&(REAL(res)[1]), &mx, sizeof(CMInt64));
+   return res;
+}
+
+//-----------------------------------------------------------------------------
+
+/// cumsum(r), cummax(r) or cummin(r) for op 0, 1 or 2. The values starting at the first
+/// NA, or at the first overflow of cumsum (with a warning), are NA.
+SEXP cumInt64(SEXP r, SEXP rop)
+{
+   int op = asInteger(rop);
+   int n = length(r);
+   SEXP res;
+   PROTECT(res = cm_alloc_int64(n));
+   const double* xin = REAL(r);
+   double* xout = REAL(res);
+   CMInt64 acc = 0;
+   int i, ovf = 0;
+   for (i = 0; i < n; i++)
+   {
+      CMInt64 a;
+      memcpy(&a, &(xin[i]), sizeof(CMInt64));
+      if (a == NA_LONG.L) break;
+      if (i == 0 && op != 0) acc = a;
+      else if (op == 0) acc = cm_add_int64(acc, a, &ovf);
+      else if (op == 1) acc = a > acc ? a : acc;
+      else acc = a < acc ? a : acc;
+      if (ovf) break;
+      memcpy(&(xout[i]), &acc, sizeof(CMInt64));
+   }
+   if (ovf) warning("int64 overflow in cumsum; NAs produced");
+   for (; i < n; i++) xout[i] = NA_LONG.D;
+
+   UNPROTECT(1);
+   return res;
+}
+
+//-----------------------------------------------------------------------------
+
 //}
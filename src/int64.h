@@ -21,6 +21,9 @@
 // limitations under the License.
 //-------------------------------------------------------------------------------
 
+#ifndef int64_INCLUDED
+#define int64_INCLUDED
+
 #include <stdlib.h>
 #include <stdint.h>
 
@@ -44,3 +47,62 @@ static const union CMRLongNA { CMInt64 L; double D; } NA_LONG = { LLONG_MIN };
 #endif
 
 //}
+
+//-----------------------------------------------------------------------------
+
+// Element-wise kernels are written as branch-free loops over the 64-bit payloads.
+// CM_OMP_SIMD asks the compiler to vectorize such a loop (the OpenMP flags are set
+// in Makevars), and CM_SIMD_CLONES additionally builds an AVX2 version of a kernel,
+// selected at load time, since SSE2 has no 64-bit integer comparisons.
+
+#define CM_PRAGMA(x) _Pragma(#x)
+
+#ifdef _OPENMP
+#define CM_OMP_SIMD CM_PRAGMA(omp simd)
+#define CM_OMP_SIMD_SUM(v) CM_PRAGMA(omp simd reduction(+:v))
+#else
+#define CM_OMP_SIMD
+#define CM_OMP_SIMD_SUM(v)
+#endif
+
+// Element-wise kernels run on several threads when the vectors are long enough to pay
+// for starting them. cm_int64_threads returns the number of threads for n elements from
+// the options "csvread.threads" (default 1) and "csvread.parallel.threshold" (default
+// 100000), and 1 for shorter vectors or when OpenMP is not available. It must be called
+// from the main thread, before the parallel loop:
+//
+//    int nt = cm_int64_threads(n);
+//    CM_OMP_PARALLEL_FOR_SIMD(nt)
+//    for (int i = 0; i < n; i++) ...
+//
+// The loop body must not call the R API. CM_OMP_PARALLEL_FOR is for loops that cannot
+// be vectorized, for example because they call library functions that set errno, and
+// CM_OMP_PARALLEL_FOR_DYNAMIC for loops whose iterations take very different times.
+
+#ifdef _OPENMP
+#define CM_OMP_PARALLEL_FOR(nt) CM_PRAGMA(omp parallel for num_threads(nt) if(nt > 1))
+#define CM_OMP_PARALLEL_FOR_DYNAMIC(nt) CM_PRAGMA(omp parallel for num_threads(nt) if(nt > 1) schedule(dynamic))
+#define CM_OMP_PARALLEL_FOR_SIMD(nt) CM_PRAGMA(omp parallel for simd num_threads(nt) if(nt > 1))
+#define CM_OMP_PARALLEL_FOR_SIMD_SUM(nt, v) CM_PRAGMA(omp parallel for simd num_threads(nt) if(nt > 1) reduction(+:v))
+#else
+#define CM_OMP_PARALLEL_FOR(nt) (void) (nt);
+#define CM_OMP_PARALLEL_FOR_DYNAMIC(nt) (void) (nt);
+#define CM_OMP_PARALLEL_FOR_SIMD(nt) (void) (nt);
+#define CM_OMP_PARALLEL_FOR_SIMD_SUM(nt, v) (void) (nt);
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+int cm_int64_threads(int n);
+#ifdef __cplusplus
+}
+#endif
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 6 && defined(__x86_64__) && defined(__linux__)
+#define CM_SIMD_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define CM_SIMD_CLONES
+#endif
+
+#endif // int64_INCLUDED
@@ -0,0 +1,217 @@
+//-------------------------------------------------------------------------------
+//
+// Package csvread
+//
+// Hash-based unique, duplicated, match and table for int64 vectors.
+//
+// Sergei Izrailev, 2011-2014
+//-------------------------------------------------------------------------------
+// Copyright 2011-2014 Collective, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//-------------------------------------------------------------------------------
+
+#include "int64.h"
+
+#include <string.h>
+#include <R.h>
+#include <Rinternals.h>
+
+//-----------------------------------------------------------------------------
+
+// The distinct values of a vector are numbered 0, 1, ... in the order of their first
+// occurrence. An open-addressing table with linear probing maps a value to its number
+// plus one (zero marks an empty slot), and the value itself is read back from the
+// vector at the position of its first occurrence. The table has at least twice as many
+// slots as there are values, and the slot is chosen by Fibonacci hashing, which spreads
+// sequential IDs well. NA is the smallest 64-bit integer and is hashed like any other
+// value, so NA matches NA as in base R.
+
+typedef struct
+{
+   const double* x;  ///< the values
+   int* slots;       ///< value number plus one, or 0 for an empty slot
+   int* first;       ///< position of the first occurrence of each value number
+   size_t mask;      ///< number of slots minus one
+   int shift;        ///< 64 minus the number of bits in a slot index
+   int nuniq;        ///< number of distinct values so far
+} CMInt64Hash;
+
+static inline CMInt64 cm_int64_at(const double* x, int i)
+{
+   CMInt64 v;
+   memcpy(&v, x + i, sizeof(CMInt64));
+   return v;
+}
+
+/// Allocates a table for up to n distinct values of x with R_alloc.
+static void cm_hash_init(CMInt64Hash* h, const double* x, int n)
+{
+   int bits = 4;
+   while (((size_t) 1 << bits) < 2 * (size_t) n) ++bits;
+   h->x = x;
+   h->mask = ((size_t) 1 << bits) - 1;
+   h->shift = 64 - bits;
+   h->slots = (int*) R_alloc(h->mask + 1, sizeof(int));
+   memset(h->slots, 0, (h->mask + 1) * sizeof(int));
+   h->first = (int*) R_alloc(n > 0 ? n : 1, sizeof(int));
+   h->nuniq = 0;
+}
+
+static inline size_t cm_hash_slot(const CMInt64Hash* h, CMInt64 v)
+{
+   return (size_t) (((uint64_t) v * UINT64_C(0x9E3779B97F4A7C15)) >> h->shift);
+}
+
+/// Returns the number of value x[i], numbering it if it has not been seen before.
+static inline int cm_hash_insert(CMInt64Hash* h, int i)
+{
+   CMInt64 v = cm_int64_at(h->x, i);
+   size_t s = cm_hash_slot(h, v);
+   while (h->slots[s] != 0)
+   {
+      int id = h->slots[s] - 1;
+      if (cm_int64_at(h->x, h->first[id]) == v) return id;
+      s = (s + 1) & h->mask;
+   }
+   h->first[h->nuniq] = i;
+   h->slots[s] = ++h->nuniq;
+   return h->nuniq - 1;
+}
+
+/// Returns the number of value v, or -1 if it is not in the table.
+static inline int cm_hash_find(const CMInt64Hash* h, CMInt64 v)
+{
+   size_t s = cm_hash_slot(h, v);
+   while (h->slots[s] != 0)
+   {
+      int id = h->slots[s] - 1;
+      if (cm_int64_at(h->x, h->first[id]) == v) return id;
+      s = (s + 1) & h->mask;
+   }
+   return -1;
+}
+
+/// Allocates an int64 vector of n values of rx at positions pos, keeping the base attribute.
+static SEXP cm_int64_subset(SEXP rx, const int* pos, int n)
+{
+   const double* x = REAL(rx);
+   int i;
+   SEXP res;
+   PROTECT(res = allocVector(REALSXP, n));
+   double* r = REAL(res);
+   for (i = 0; i < n; ++i) r[i] = x[pos[i]];
+
+   SEXP cls;
+   PROTECT(cls = allocVector(STRSXP, 1));
+   SET_STRING_ELT(cls, 0, mkChar("int64"));
+   classgets(res, cls);
+   setAttrib(res, install("base"), getAttrib(rx, install("base")));
+
+   UNPROTECT(2);
+   return res;
+}
+
+//-----------------------------------------------------------------------------
+
+/// Returns the distinct values of an int64 vector in the order of first occurrence.
+SEXP uniqueInt64(SEXP rx)
+{
+   int n = length(rx);
+   int i;
+   CMInt64Hash h;
+   cm_hash_init(&h, REAL(rx), n);
+   for (i = 0; i < n; ++i) cm_hash_insert(&h, i);
+   return cm_int64_subset(rx, h.first, h.nuniq);
+}
+
+//-----------------------------------------------------------------------------
+
+/// Returns TRUE for the elements of an int64 vector that repeat an earlier element
+/// (or a later one if fromLast is TRUE).
+SEXP duplicatedInt64(SEXP rx, SEXP rfromlast)
+{
+   int n = length(rx);
+   int fromlast = asLogical(rfromlast) == TRUE;
+   int i;
+   CMInt64Hash h;
+   cm_hash_init(&h, REAL(rx), n);
+
+   SEXP res;
+   PROTECT(res = allocVector(LGLSXP, n));
+   int* r = LOGICAL(res);
+   for (i = 0; i < n; ++i)
+   {
+      int k = fromlast ? n - 1 - i : i;
+      int nuniq = h.nuniq;
+      r[k] = cm_hash_insert(&h, k) < nuniq;
+   }
+
+   UNPROTECT(1);
+   return res;
+}
+
+//-----------------------------------------------------------------------------
+
+/// Returns the 1-based positions of the first matches of int64 values in an int64
+/// table, or nomatch where there is no match.
+SEXP matchInt64(SEXP rx, SEXP rtable, SEXP rnomatch)
+{
+   int n = length(rx);
+   int nt = length(rtable);
+   int nomatch = asInteger(rnomatch);
+   const double* x = REAL(rx);
+   int i;
+   CMInt64Hash h;
+   cm_hash_init(&h, REAL(rtable), nt);
+   for (i = 0; i < nt; ++i) cm_hash_insert(&h, i);
+
+   SEXP res;
+   PROTECT(res = allocVector(INTSXP, n));
+   int* r = INTEGER(res);
+   for (i = 0; i < n; ++i)
+   {
+      int id = cm_hash_find(&h, cm_int64_at(x, i));
+      r[i] = id < 0 ? nomatch : h.first[id] + 1;
+   }
+
+   UNPROTECT(1);
+   return res;
+}
+
+//-----------------------------------------------------------------------------
+
+/// Counts the occurrences of the distinct values of an int64 vector. Returns a list
+/// of the values in the order of first occurrence and an integer vector of counts.
+SEXP tabulateInt64(SEXP rx)
+{
+   int n = length(rx);
+   int i;
+   CMInt64Hash h;
+   cm_hash_init(&h, REAL(rx), n);
+   int* counts = (int*) R_alloc(n > 0 ? n : 1, sizeof(int));
+   memset(counts, 0, (n > 0 ? n : 1) * sizeof(int));
+   for (i = 0; i < n; ++i) counts[cm_hash_insert(&h, i)]++;
+
+   SEXP res;
+   PROTECT(res = allocVector(VECSXP, 2));
+   SET_VECTOR_ELT(res, 0, cm_int64_subset(rx, h.first, h.nuniq));
+   SEXP rcounts = allocVector(INTSXP, h.nuniq);
+   SET_VECTOR_ELT(res, 1, rcounts);
+   memcpy(INTEGER(rcounts), counts, h.nuniq * sizeof(int));
+
+   UNPROTECT(1);
+   return res;
+}
+
+//-----------------------------------------------------------------------------
@@ -0,0 +1,322 @@
+//-------------------------------------------------------------------------------
+//
+// Package csvread
+//
+// Sorting and ordering of int64 vectors.
+//
+// Sergei Izrailev, 2011-2014
+//-------------------------------------------------------------------------------
+// Copyright 2011-2014 Collective, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//-------------------------------------------------------------------------------
+
+#include "int64.h"
+
+#include <string.h>
+#include <R.h>
+#include <Rinternals.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+//-----------------------------------------------------------------------------
+
+// The values are sorted with a stable LSD radix sort on 11-bit digits. Flipping the
+// sign bit maps the signed values to unsigned keys in the same order (flipping all the
+// other bits as well reverses it), and a pass is skipped when all keys have the same
+// digit, which is common for IDs drawn from a narrow range. NAs are set aside before
+// sorting and put back at the requested end.
+
+#define CM_RADIX_BITS 11
+#define CM_RADIX_SIZE (1 << CM_RADIX_BITS)
+#define CM_RADIX_MASK (CM_RADIX_SIZE - 1)
+#define CM_RADIX_PASSES 6
+#define CM_SIGN_BIT ((uint64_t) 1 << 63)
+
+#define CM_RADIX_DIGIT(key, pass) ((int) (((key) >> ((pass) * CM_RADIX_BITS)) & CM_RADIX_MASK))
+
+/// Converts the non-NA values of x to keys and records their 0-based positions in pos
+/// (unless pos is NULL). Returns the number of keys.
+static int cm_radix_keys(const double* x, int n, int decreasing, uint64_t* keys, int* pos)
+{
+   uint64_t flip = decreasing ? ~CM_SIGN_BIT : CM_SIGN_BIT;
+   int m = 0;
+   int i;
+   for (i = 0; i < n; ++i)
+   {
+      CMInt64 v;
+      memcpy(&v, x + i, sizeof(CMInt64));
+      if (v == NA_LONG.L) continue;
+      keys[m] = (uint64_t) v ^ flip;
+      if (pos != NULL) pos[m] = i;
+      ++m;
+   }
+   return m;
+}
+
+/// Inverse of cm_radix_keys for a single key.
+static inline CMInt64 cm_radix_value(uint64_t key, int decreasing)
+{
+   return (CMInt64) (key ^ (decreasing ? ~CM_SIGN_BIT : CM_SIGN_BIT));
+}
+
+/// Counts the digits of all passes at once; counts has CM_RADIX_PASSES * CM_RADIX_SIZE elements.
+static void cm_radix_histogram(const uint64_t* keys, int n, int* counts)
+{
+   int i, p;
+   memset(counts, 0, CM_RADIX_PASSES * CM_RADIX_SIZE * sizeof(int));
+   for (i = 0; i < n; ++i)
+   {
+      uint64_t k = keys[i];
+      for (p = 0; p < CM_RADIX_PASSES; ++p)
+      {
+         counts[p * CM_RADIX_SIZE + CM_RADIX_DIGIT(k, p)]++;
+      }
+   }
+}
+
+/// One counting sort pass on digit p from (keys, pos) to (tkeys, tpos), given the digit counts.
+static void cm_radix_pass(const uint64_t* keys, const int* pos, int n, int p, const int* counts,
+                          uint64_t* tkeys, int* tpos)
+{
+   int offsets[CM_RADIX_SIZE];
+   int i, b, sum = 0;
+   for (b = 0; b < CM_RADIX_SIZE; ++b)
+   {
+      offsets[b] = sum;
+      sum += counts[b];
+   }
+   for (i = 0; i < n; ++i)
+   {
+      int j = offsets[CM_RADIX_DIGIT(keys[i], p)]++;
+      tkeys[j] = keys[i];
+      if (pos != NULL) tpos[j] = pos[i];
+   }
+}
+
+#ifdef _OPENMP
+/// Same as cm_radix_pass with the input split into nthreads contiguous slices. Each thread
+/// counts its slice, and its offsets for a digit follow those of the preceding slices,
+/// which keeps the sort stable. tcounts has nthreads * CM_RADIX_SIZE elements.
+static void cm_radix_pass_parallel(const uint64_t* keys, const int* pos, int n, int p,
+                                   uint64_t* tkeys, int* tpos, int* tcounts, int nthreads)
+{
+   int nt = nthreads;
+#pragma omp parallel num_threads(nthreads)
+   {
+      int t = omp_get_thread_num();
+      int i, b;
+      int* c = tcounts + t * CM_RADIX_SIZE;
+      int lo, hi;
+#pragma omp single
+      nt = omp_get_num_threads();
+      lo = (int) ((double) n * t / nt);
+      hi = (int) ((double) n * (t + 1) / nt);
+
+      memset(c, 0, CM_RADIX_SIZE * sizeof(int));
+      for (i = lo; i < hi; ++i) c[CM_RADIX_DIGIT(keys[i], p)]++;
+#pragma omp barrier
+#pragma omp single
+      {
+         int s, sum = 0;
+         for (b = 0; b < CM_RADIX_SIZE; ++b)
+         {
+            for (s = 0; s < nt; ++s)
+            {
+               int cnt = tcounts[s * CM_RADIX_SIZE + b];
+               tcounts[s * CM_RADIX_SIZE + b] = sum;
+               sum += cnt;
+            }
+         }
+      }
+      for (i = lo; i < hi; ++i)
+      {
+         int j = c[CM_RADIX_DIGIT(keys[i], p)]++;
+         tkeys[j] = keys[i];
+         if (pos != NULL) tpos[j] = pos[i];
+      }
+   }
+}
+#endif
+
+/// Sorts n keys, and their positions if pos is not NULL. The work buffers are allocated
+/// with R_alloc and released by R when the .Call returns.
+static void cm_radix_sort(uint64_t* keys, int* pos, int n, int nthreads)
+{
+   int counts[CM_RADIX_PASSES * CM_RADIX_SIZE];
+   uint64_t* keys0 = keys;
+   int* pos0 = pos;
+   uint64_t* tkeys;
+   int* tpos = NULL;
+#ifdef _OPENMP
+   int* tcounts = NULL;
+#endif
+   int p;
+
+   if (n < 2) return;
+   tkeys = (uint64_t*) R_alloc(n, sizeof(uint64_t));
+   if (pos != NULL) tpos = (int*) R_alloc(n, sizeof(int));
+#ifdef _OPENMP
+   if (nthreads > 1) tcounts = (int*) R_alloc(nthreads * CM_RADIX_SIZE, sizeof(int));
+#else
+   nthreads = 1;
+#endif
+
+   cm_radix_histogram(keys, n, counts);
+   for (p = 0; p < CM_RADIX_PASSES; ++p)
+   {
+      const int* c = counts + p * CM_RADIX_SIZE;
+      uint64_t* sk;
+      int* sp;
+      // all keys in one bucket: the pass would not move anything
+      if (c[CM_RADIX_DIGIT(keys[0], p)] == n) continue;
+#ifdef _OPENMP
+      if (nthreads > 1) cm_radix_pass_parallel(keys, pos, n, p, tkeys, tpos, tcounts, nthreads);
+      else
+#endif
+      cm_radix_pass(keys, pos, n, p, c, tkeys, tpos);
+      sk = keys; keys = tkeys; tkeys = sk;
+      sp = pos; pos = tpos; tpos = sp;
+   }
+   // after an odd number of passes the result is in the work buffers
+   if (keys != keys0)
+   {
+      memcpy(keys0, keys, n * sizeof(uint64_t));
+      if (pos0 != NULL) memcpy(pos0, pos, n * sizeof(int));
+   }
+}
+
+//-----------------------------------------------------------------------------
+
+/// Sorts the non-NA values of rx with their positions if pos is not NULL. Returns the
+/// number of non-NA values; keys and *pos are allocated with R_alloc.
+static int cm_sort_int64(SEXP rx, int decreasing, uint64_t** keys, int** pos)
+{
+   int n = length(rx);
+   int nthreads = cm_int64_threads(n);
+   int m;
+   *keys = (uint64_t*) R_alloc(n, sizeof(uint64_t));
+   if (pos != NULL) *pos = (int*) R_alloc(n, sizeof(int));
+   m = cm_radix_keys(REAL(rx), n, decreasing, *keys, pos == NULL ? NULL : *pos);
+   cm_radix_sort(*keys, pos == NULL ? NULL : *pos, m, nthreads);
+   return m;
+}
+
+/// Returns TRUE or FALSE for na.last, or NA_LOGICAL if NAs are to be removed.
+static int cm_na_last(SEXP rnalast)
+{
+   return length(rnalast) == 0 ? NA_LOGICAL : asLogical(rnalast);
+}
+
+//-----------------------------------------------------------------------------
+
+/// Sorts an int64 vector. NAs are removed if na.last is NA, and otherwise put last
+/// or first. Keeps the base attribute.
+SEXP sortInt64(SEXP rx, SEXP rdecreasing, SEXP rnalast)
+{
+   int n = length(rx);
+   int decreasing = asLogical(rdecreasing) == TRUE;
+   int nalast = cm_na_last(rnalast);
+   uint64_t* keys;
+   int m = cm_sort_int64(rx, decreasing, &keys, NULL);
+   int nna = nalast == NA_LOGICAL ? 0 : n - m;
+   int i;
+
+   SEXP res;
+   PROTECT(res = allocVector(REALSXP, m + nna));
+   double* x = REAL(res);
+   double* xv = nalast == FALSE ? x + nna : x;
+   double* xna = nalast == FALSE ? x : x + m;
+   for (i = 0; i < m; ++i)
+   {
+      CMInt64 v = cm_radix_value(keys[i], decreasing);
+      memcpy(xv + i, &v, sizeof(CMInt64));
+   }
+   for (i = 0; i < nna; ++i) xna[i] = NA_LONG.D;
+
+   SEXP cls;
+   PROTECT(cls = allocVector(STRSXP, 1));
+   SET_STRING_ELT(cls, 0, mkChar("int64"));
+   classgets(res, cls);
+   setAttrib(res, install("base"), getAttrib(rx, install("base")));
+
+   UNPROTECT(2);
+   return res;
+}
+
+//-----------------------------------------------------------------------------
+
+/// Returns the 1-based permutation that sorts an int64 vector. Ties keep their
+/// original order. Positions of NAs are removed if na.last is NA, and otherwise
+/// put last or first in their original order.
+SEXP orderInt64(SEXP rx, SEXP rdecreasing, SEXP rnalast)
+{
+   int n = length(rx);
+   int decreasing = asLogical(rdecreasing) == TRUE;
+   int nalast = cm_na_last(rnalast);
+   uint64_t* keys;
+   int* pos;
+   int m = cm_sort_int64(rx, decreasing, &keys, &pos);
+   int nna = nalast == NA_LOGICAL ? 0 : n - m;
+   int i, j;
+
+   SEXP res;
+   PROTECT(res = allocVector(INTSXP, m + nna));
+   int* idx = INTEGER(res);
+   int* iv = nalast == FALSE ? idx + nna : idx;
+   int* ina = nalast == FALSE ? idx : idx + m;
+   for (i = 0; i < m; ++i) iv[i] = pos[i] + 1;
+   if (nna > 0)
+   {
+      const double* x = REAL(rx);
+      for (i = 0, j = 0; i < n; ++i)
+      {
+         CMInt64 v;
+         memcpy(&v, x + i, sizeof(CMInt64));
+         if (v == NA_LONG.L) ina[j++] = i + 1;
+      }
+   }
+
+   UNPROTECT(1);
+   return res;
+}
+
+//-----------------------------------------------------------------------------
+
+/// Returns integer ranks of an int64 vector, where ties get the lowest rank and NAs
+/// stay NA. Used by xtfrm, so that order, rank and sort in base R work on int64.
+SEXP rankInt64(SEXP rx)
+{
+   int n = length(rx);
+   uint64_t* keys;
+   int* pos;
+   int m = cm_sort_int64(rx, FALSE, &keys, &pos);
+   int i, rank = 0;
+
+   SEXP res;
+   PROTECT(res = allocVector(INTSXP, n));
+   int* r = INTEGER(res);
+   for (i = 0; i < n; ++i) r[i] = NA_INTEGER;
+   for (i = 0; i < m; ++i)
+   {
+      if (i == 0 || keys[i] != keys[i - 1]) rank = i + 1;
+      r[pos[i]] = rank;
+   }
+
+   UNPROTECT(1);
+   return res;
+}
+
+//-----------------------------------------------------------------------------